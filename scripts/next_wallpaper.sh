@@ -2,4 +2,5 @@
 
 # add this script to global shortcuts
 
-pkill -RTMIN+10 -f wpu-darkscore-select
+# the control socket answers right away, the signal is for a daemon started with --socket ""
+wpu next || pkill -RTMIN+10 -f wpu-darkscore-select
@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+
+# add this script to your autostarts (instead of running regen.sh by hand)
+# scores new wallpapers as they land and tells wpu-darkscore-select to reload
+WALLPAPERS_DIR="/media/SSD/media/bg"
+CSV_FILE="/media/SSD/media/bg/wpu-darkscore_output.csv"
+wpu-darkscore -i "$WALLPAPERS_DIR" -o "$CSV_FILE" -s --watch
@@ -0,0 +1,844 @@
+#include "analysis.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+std::vector<ColorGroup> colorGroups = {
+    {"Miscellaneous", 0, 0, 0.0f, 0.0f, 0.0f, 0.0f, cv::Vec3b(0, 0, 0)},
+    {"Blue_Cool", 200, 260, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(255, 100, 50)},
+    {"Red_Warm", 340, 20, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(50, 50, 255)},
+    {"Green_Nature", 80, 140, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(50, 255, 100)},
+    {"Orange_Sunset", 20, 50, 0.4f, 1.0f, 0.4f, 1.0f, cv::Vec3b(50, 165, 255)},
+    {"Purple_Mystical", 260, 300, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(255, 50, 200)},
+    {"Yellow_Bright", 50, 80, 0.4f, 1.0f, 0.5f, 1.0f, cv::Vec3b(50, 255, 255)},
+    {"Pink_Soft", 300, 340, 0.3f, 1.0f, 0.4f, 1.0f, cv::Vec3b(200, 100, 255)},
+    {"Cyan_Tech", 160, 200, 0.4f, 1.0f, 0.4f, 1.0f, cv::Vec3b(255, 200, 100)},
+    {"Dark_Moody", 0, 360, 0.0f, 1.0f, 0.0f, 0.25f, cv::Vec3b(40, 40, 40)},
+    {"Light_Minimal", 0, 360, 0.0f, 0.3f, 0.8f, 1.0f, cv::Vec3b(240, 240, 240)},
+    {"Monochrome", 0, 360, 0.0f, 0.15f, 0.25f, 0.8f, cv::Vec3b(128, 128, 128)},
+    {"Earth_Tones", 25, 45, 0.2f, 0.7f, 0.3f, 0.7f, cv::Vec3b(100, 150, 200)}};
+
+// Same integer math as cv::cvtColor(COLOR_BGR2HSV) for 8-bit images, H 0..179, S and V 0..255
+constexpr int HSV_SHIFT = 12;
+
+struct HsvTables {
+    int sdiv[256];
+    int hdiv[256];
+
+    HsvTables()
+    {
+        sdiv[0] = hdiv[0] = 0;
+        for (int i = 1; i < 256; i++) {
+            sdiv[i] = (int)std::lround((255 << HSV_SHIFT) / (double)i);
+            hdiv[i] = (int)std::lround((180 << HSV_SHIFT) / (6.0 * i));
+        }
+    }
+};
+
+static const HsvTables hsvTables;
+
+static inline void bgrToHsv(int b, int g, int r, int& h, int& s, int& v)
+{
+    v = std::max(b, std::max(g, r));
+    int diff = v - std::min(b, std::min(g, r));
+
+    s = (diff * hsvTables.sdiv[v] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+    h = v == r   ? g - b
+        : v == g ? b - r + 2 * diff
+                 : r - g + 4 * diff;
+    h = (h * hsvTables.hdiv[diff] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+    if (h < 0) h += 180;
+    if (h >= 180) h -= 180;
+}
+
+void calculateColorProperties(ColorInfo& colorInfo)
+{
+    int h, s, v;
+    bgrToHsv(colorInfo.color[0], colorInfo.color[1], colorInfo.color[2], h, s, v);
+    colorInfo.hue = h * 2.0;
+    colorInfo.saturation = s / 255.0;
+    colorInfo.brightness = v / 255.0;
+}
+
+void calculateColorProperties(PaletteColor& colorInfo)
+{
+    int h, s, v;
+    bgrToHsv(colorInfo.color[0], colorInfo.color[1], colorInfo.color[2], h, s, v);
+    colorInfo.hue = h * 2.0; // OpenCV hue is 0-179, convert to 0-359
+    colorInfo.saturation = s / 255.0;
+    colorInfo.brightness = v / 255.0;
+}
+
+
+// Fused BGR -> quantized HSV bin -> histogram in one pass over the pixels, no HSV copy of the image.
+// Bin layout matches cv::calcHist with ranges {0,180} {0,256} {0,256}.
+static void accumulateHsvHistogram(const cv::Mat& image, int hbins, int sbins, int vbins, uint32_t* hist)
+{
+    int hdivisor = 180 / hbins, sdivisor = 256 / sbins, vdivisor = 256 / vbins;
+    int rows = image.rows, cols = image.cols;
+    if (image.isContinuous()) {
+        cols *= rows;
+        rows = 1;
+    }
+
+    for (int y = 0; y < rows; y++) {
+        const uchar* px = image.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++, px += 3) {
+            int h, s, v;
+            bgrToHsv(px[0], px[1], px[2], h, s, v);
+            hist[((h / hdivisor) * sbins + s / sdivisor) * vbins + v / vdivisor]++;
+        }
+    }
+}
+
+// Histogram resolution
+constexpr int HIST_HBINS = 36, HIST_SBINS = 16, HIST_VBINS = 16;
+
+// HSV of a bin center
+static void histogramBinHsv(int bin, float& hue, float& sat, float& val)
+{
+    int h_idx = bin / (HIST_SBINS * HIST_VBINS);
+    int s_idx = bin / HIST_VBINS % HIST_SBINS;
+    int v_idx = bin % HIST_VBINS;
+
+    // Convert histogram indices back to HSV values
+    hue = (h_idx + 0.5f) * 180.0f / HIST_HBINS;
+    sat = (s_idx + 0.5f) * 256.0f / HIST_SBINS;
+    val = (v_idx + 0.5f) * 256.0f / HIST_VBINS;
+}
+
+// BGR of every bin center, converted once at startup instead of a 1x1 cvtColor (two Mats) per peak and image.
+// The float conversion wants H 0-360 and S/V 0-1 and gives B/G/R 0-1 (it used to get the 8-bit ranges).
+static std::vector<cv::Vec3f> histogramBinColors;
+static std::once_flag histogramBinColorsBuilt;
+
+static void buildHistogramBinColors()
+{
+    histogramBinColors.resize(HIST_HBINS * HIST_SBINS * HIST_VBINS);
+    for (size_t i = 0; i < histogramBinColors.size(); i++) {
+        float hue, sat, val;
+        histogramBinHsv((int)i, hue, sat, val);
+        cv::Mat hsvPixel(1, 1, CV_32FC3, cv::Scalar(hue * 2.0f, std::min(sat / 255.0f, 1.0f), std::min(val / 255.0f, 1.0f)));
+        cv::Mat bgrPixel;
+        cv::cvtColor(hsvPixel, bgrPixel, cv::COLOR_HSV2BGR);
+        histogramBinColors[i] = bgrPixel.at<cv::Vec3f>(0, 0) * 255.0f;
+    }
+}
+
+// Same bins from an image that already is HSV (converted on the device with --backend opencl)
+static void accumulateHistogramOfHsv(const cv::Mat& hsv, int hbins, int sbins, int vbins, uint32_t* hist)
+{
+    int hdivisor = 180 / hbins, sdivisor = 256 / sbins, vdivisor = 256 / vbins;
+    int rows = hsv.rows, cols = hsv.cols;
+    if (hsv.isContinuous()) {
+        cols *= rows;
+        rows = 1;
+    }
+
+    for (int y = 0; y < rows; y++) {
+        const uchar* px = hsv.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++, px += 3) {
+            int h = std::min<int>(px[0], 179); // OpenCV's rounding can give 180
+            hist[((h / hdivisor) * sbins + px[1] / sdivisor) * vbins + px[2] / vdivisor]++;
+        }
+    }
+}
+
+// The k fullest bins of workspace.histogram
+static std::vector<ColorInfo> histogramPeaks(int k, int totalPixels, ImageWorkspace& workspace)
+{
+    std::call_once(histogramBinColorsBuilt, buildHistogramBinColors);
+    const std::vector<uint32_t>& hist = workspace.histogram;
+
+    // Find dominant colors by finding histogram peaks
+    std::vector<ColorInfo> colors;
+    std::vector<int>& peaks = workspace.peaks;
+    peaks.clear();
+
+    // Extract all non-zero histogram bins
+    for (int i = 0; i < (int)hist.size(); i++) {
+        if (hist[i] > 0) peaks.push_back(i);
+    }
+
+    // Only the top k need to be in order
+    int numColors = std::min(k, static_cast<int>(peaks.size()));
+    std::partial_sort(peaks.begin(), peaks.begin() + numColors, peaks.end(),
+                      [&hist](int a, int b) {
+                          return hist[a] != hist[b] ? hist[a] > hist[b] : a < b;
+                      });
+
+    colors.reserve(numColors);
+    for (int i = 0; i < numColors; i++) {
+        float count = hist[peaks[i]];
+        float hue, sat, val;
+        histogramBinHsv(peaks[i], hue, sat, val);
+        const cv::Vec3f& bgr = histogramBinColors[peaks[i]];
+
+        ColorInfo colorInfo;
+        colorInfo.color = cv::Vec3b(
+            static_cast<uchar>(std::clamp(bgr[0], 0.0f, 255.0f)),
+            static_cast<uchar>(std::clamp(bgr[1], 0.0f, 255.0f)),
+            static_cast<uchar>(std::clamp(bgr[2], 0.0f, 255.0f)));
+        colorInfo.weight = count / totalPixels;
+        colorInfo.hue = hue * 2.0; // Convert to 0-360 range
+        colorInfo.saturation = sat / 255.0;
+        colorInfo.brightness = val / 255.0;
+
+        colors.push_back(colorInfo);
+    }
+
+    return colors;
+}
+
+std::vector<ColorInfo> extractDominantColorsHistogram(const cv::Mat& image, int k, ImageWorkspace& workspace)
+{
+    workspace.histogram.assign(HIST_HBINS * HIST_SBINS * HIST_VBINS, 0);
+    accumulateHsvHistogram(image, HIST_HBINS, HIST_SBINS, HIST_VBINS, workspace.histogram.data());
+    return histogramPeaks(k, image.rows * image.cols, workspace);
+}
+
+std::vector<ColorInfo> extractDominantColorsHistogramOfHsv(const cv::Mat& hsv, int k, ImageWorkspace& workspace)
+{
+    workspace.histogram.assign(HIST_HBINS * HIST_SBINS * HIST_VBINS, 0);
+    accumulateHistogramOfHsv(hsv, HIST_HBINS, HIST_SBINS, HIST_VBINS, workspace.histogram.data());
+    return histogramPeaks(k, hsv.rows * hsv.cols, workspace);
+}
+
+std::vector<ColorInfo> extractDominantColorsKmeansOpt(const cv::Mat& image, int k, ImageWorkspace& workspace)
+{
+    // Reduce image size for faster processing
+    cv::Mat smallImage;
+    int maxDim = 150; // Much smaller than 800x600
+    if (image.rows > maxDim || image.cols > maxDim) {
+        double scale = std::min((double)maxDim / image.rows, (double)maxDim / image.cols);
+        cv::Size size = scaledSize(image, scale);
+        smallImage = ImageWorkspace::view(workspace.thumbnail, size.height, size.width, image.type());
+        cv::resize(image, smallImage, cv::Size(), scale, scale);
+    }
+    else {
+        smallImage = image;
+    }
+
+    // Direct conversion to float data without reshaping
+    int totalPixels = smallImage.rows * smallImage.cols;
+    cv::Mat data = ImageWorkspace::view(workspace.samples, totalPixels, 3, CV_32F);
+
+    // Manually copy pixel data to avoid reshape overhead
+    const cv::Vec3b* srcPtr = smallImage.ptr<cv::Vec3b>();
+    float* dstPtr = data.ptr<float>();
+
+    for (int i = 0; i < totalPixels; i++) {
+        dstPtr[i * 3 + 0] = srcPtr[i][0]; // B
+        dstPtr[i * 3 + 1] = srcPtr[i][1]; // G
+        dstPtr[i * 3 + 2] = srcPtr[i][2]; // R
+    }
+
+    cv::Mat labels = ImageWorkspace::view(workspace.labels, totalPixels, 1, CV_32S);
+    cv::Mat centers = ImageWorkspace::view(workspace.centers, k, 3, CV_32F);
+    cv::kmeans(data, k, labels,
+               cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 1.0), // Reduced iterations
+               1, cv::KMEANS_PP_CENTERS, centers);                                         // Reduced attempts
+
+    std::vector<int> counts(k, 0);
+    for (int i = 0; i < labels.rows; i++) {
+        counts[labels.at<int>(i)]++;
+    }
+
+    std::vector<ColorInfo> colors;
+
+    for (int i = 0; i < k; i++) {
+        ColorInfo colorInfo;
+        colorInfo.color = cv::Vec3b(
+            static_cast<uchar>(std::clamp(centers.at<float>(i, 0), 0.0f, 255.0f)),
+            static_cast<uchar>(std::clamp(centers.at<float>(i, 1), 0.0f, 255.0f)),
+            static_cast<uchar>(std::clamp(centers.at<float>(i, 2), 0.0f, 255.0f)));
+        colorInfo.weight = (double)counts[i] / totalPixels;
+        calculateColorProperties(colorInfo);
+        colors.push_back(colorInfo);
+    }
+
+    std::sort(colors.begin(), colors.end(),
+              [](const ColorInfo& a, const ColorInfo& b) {
+                  return a.weight > b.weight;
+              });
+
+    return colors;
+}
+std::vector<ColorInfo> extractDominantColorsKmeans(const cv::Mat& image, int k, ImageWorkspace& workspace)
+{
+    int totalPixels = image.rows * image.cols;
+    cv::Mat data = ImageWorkspace::view(workspace.samples, totalPixels, 3, CV_32F);
+    image.reshape(1, totalPixels).convertTo(data, CV_32F);
+
+    cv::Mat labels = ImageWorkspace::view(workspace.labels, totalPixels, 1, CV_32S);
+    cv::Mat centers = ImageWorkspace::view(workspace.centers, k, 3, CV_32F);
+    cv::kmeans(data, k, labels,
+               cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 20, 1.0),
+               3, cv::KMEANS_PP_CENTERS, centers);
+
+    std::vector<int> counts(k, 0);
+    for (int i = 0; i < labels.rows; i++) {
+        counts[labels.at<int>(i)]++;
+    }
+
+    std::vector<ColorInfo> colors;
+    colors.reserve(k);
+    for (int i = 0; i < k; i++) {
+        ColorInfo colorInfo;
+        colorInfo.color = cv::Vec3b(
+            static_cast<uchar>(centers.at<float>(i, 0)),
+            static_cast<uchar>(centers.at<float>(i, 1)),
+            static_cast<uchar>(centers.at<float>(i, 2)));
+        colorInfo.weight = (double)counts[i] / totalPixels;
+        calculateColorProperties(colorInfo);
+        colors.push_back(colorInfo);
+    }
+
+    std::sort(colors.begin(), colors.end(),
+              [](const ColorInfo& a, const ColorInfo& b) {
+                  return a.weight > b.weight;
+              });
+
+    return colors;
+}
+
+// KMEANSFAST: purpose-built k-means over uint8 BGR pixels
+//  * clusters a strided subsample of the image instead of every pixel
+//  * channels are kept as separate float arrays so the assignment step runs 8 (AVX2) or 4 (NEON) pixels at a time
+//  * k-means++ seeding with a fixed seed, stops as soon as no center moves by more than a color level
+constexpr size_t FAST_KMEANS_SAMPLES = 4096;
+constexpr int FAST_KMEANS_MAX_ITERATIONS = 20;
+constexpr float FAST_KMEANS_EPS = 1.0f;
+
+// labels[i] = index of the nearest center, returns the summed squared distance
+static double assignToCenters(const float* b, const float* g, const float* r, size_t n,
+                              const float* centers, int k, int* labels)
+{
+    double total = 0.0;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256 pb = _mm256_loadu_ps(b + i);
+        __m256 pg = _mm256_loadu_ps(g + i);
+        __m256 pr = _mm256_loadu_ps(r + i);
+        __m256 best = _mm256_set1_ps(FLT_MAX);
+        __m256 bestIdx = _mm256_setzero_ps();
+        for (int c = 0; c < k; c++) {
+            __m256 db = _mm256_sub_ps(pb, _mm256_set1_ps(centers[c * 3 + 0]));
+            __m256 dg = _mm256_sub_ps(pg, _mm256_set1_ps(centers[c * 3 + 1]));
+            __m256 dr = _mm256_sub_ps(pr, _mm256_set1_ps(centers[c * 3 + 2]));
+#if defined(__FMA__)
+            __m256 d = _mm256_fmadd_ps(db, db, _mm256_fmadd_ps(dg, dg, _mm256_mul_ps(dr, dr)));
+#else // AVX2 without FMA (-mavx2 alone)
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(db, db), _mm256_add_ps(_mm256_mul_ps(dg, dg), _mm256_mul_ps(dr, dr)));
+#endif
+            __m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+            best = _mm256_blendv_ps(best, d, closer);
+            bestIdx = _mm256_blendv_ps(bestIdx, _mm256_set1_ps((float)c), closer);
+        }
+        _mm256_storeu_si256((__m256i*)(labels + i), _mm256_cvtps_epi32(bestIdx));
+
+        alignas(32) float dist[8];
+        _mm256_store_ps(dist, best);
+        for (float d : dist) total += d;
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t pb = vld1q_f32(b + i);
+        float32x4_t pg = vld1q_f32(g + i);
+        float32x4_t pr = vld1q_f32(r + i);
+        float32x4_t best = vdupq_n_f32(FLT_MAX);
+        uint32x4_t bestIdx = vdupq_n_u32(0);
+        for (int c = 0; c < k; c++) {
+            float32x4_t db = vsubq_f32(pb, vdupq_n_f32(centers[c * 3 + 0]));
+            float32x4_t dg = vsubq_f32(pg, vdupq_n_f32(centers[c * 3 + 1]));
+            float32x4_t dr = vsubq_f32(pr, vdupq_n_f32(centers[c * 3 + 2]));
+            float32x4_t d = vmlaq_f32(vmlaq_f32(vmulq_f32(dr, dr), dg, dg), db, db);
+            uint32x4_t closer = vcltq_f32(d, best);
+            best = vbslq_f32(closer, d, best);
+            bestIdx = vbslq_u32(closer, vdupq_n_u32(c), bestIdx);
+        }
+        vst1q_s32(labels + i, vreinterpretq_s32_u32(bestIdx));
+
+        float dist[4];
+        vst1q_f32(dist, best);
+        for (float d : dist) total += d;
+    }
+#endif
+
+    for (; i < n; i++) {
+        float best = FLT_MAX;
+        int bestIdx = 0;
+        for (int c = 0; c < k; c++) {
+            float db = b[i] - centers[c * 3 + 0];
+            float dg = g[i] - centers[c * 3 + 1];
+            float dr = r[i] - centers[c * 3 + 2];
+            float d = db * db + dg * dg + dr * dr;
+            if (d < best) {
+                best = d;
+                bestIdx = c;
+            }
+        }
+        labels[i] = bestIdx;
+        total += best;
+    }
+
+    return total;
+}
+
+std::vector<ColorInfo> extractDominantColorsFast(const cv::Mat& image, int k, ImageWorkspace& workspace)
+{
+    size_t totalPixels = (size_t)image.rows * image.cols;
+    if (totalPixels == 0) return {};
+
+    // strided subsample, channels split into separate arrays
+    size_t step = std::max<size_t>(1, totalPixels / FAST_KMEANS_SAMPLES);
+    std::vector<float>& b = workspace.b;
+    std::vector<float>& g = workspace.g;
+    std::vector<float>& r = workspace.r;
+    b.clear();
+    g.clear();
+    r.clear();
+    b.reserve(totalPixels / step + 1);
+    g.reserve(totalPixels / step + 1);
+    r.reserve(totalPixels / step + 1);
+    for (size_t i = 0; i < totalPixels; i += step) {
+        const cv::Vec3b& px = image.ptr<cv::Vec3b>(i / image.cols)[i % image.cols];
+        b.push_back(px[0]);
+        g.push_back(px[1]);
+        r.push_back(px[2]);
+    }
+    size_t n = b.size();
+    k = std::min<int>(k, n);
+
+    // k-means++ seeding
+    std::mt19937 rng(0x5eed);
+    std::vector<float>& centers = workspace.fastCenters;
+    std::vector<float>& nearest = workspace.nearest;
+    centers.assign(k * 3, 0.0f);
+    nearest.assign(n, FLT_MAX);
+    size_t pick = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    for (int c = 0; c < k; c++) {
+        centers[c * 3 + 0] = b[pick];
+        centers[c * 3 + 1] = g[pick];
+        centers[c * 3 + 2] = r[pick];
+        if (c + 1 == k) break;
+
+        double sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            float db = b[i] - centers[c * 3 + 0], dg = g[i] - centers[c * 3 + 1], dr = r[i] - centers[c * 3 + 2];
+            nearest[i] = std::min(nearest[i], db * db + dg * dg + dr * dr);
+            sum += nearest[i];
+        }
+        if (sum <= 0.0) { // fewer distinct colors than k
+            k = c + 1;
+            centers.resize(k * 3);
+            break;
+        }
+        double target = std::uniform_real_distribution<double>(0.0, sum)(rng);
+        for (pick = 0; pick + 1 < n && (target -= nearest[pick]) > 0.0; pick++) {}
+    }
+
+    // Lloyd iterations
+    std::vector<int>& labels = workspace.fastLabels;
+    std::vector<int>& counts = workspace.counts;
+    std::vector<double>& sums = workspace.sums;
+    labels.assign(n, 0);
+    counts.assign(k, 0);
+    sums.assign(k * 3, 0.0);
+    for (int iteration = 0; iteration < FAST_KMEANS_MAX_ITERATIONS; iteration++) {
+        assignToCenters(b.data(), g.data(), r.data(), n, centers.data(), k, labels.data());
+
+        std::fill(counts.begin(), counts.end(), 0);
+        std::fill(sums.begin(), sums.end(), 0.0);
+        for (size_t i = 0; i < n; i++) {
+            int l = labels[i];
+            counts[l]++;
+            sums[l * 3 + 0] += b[i];
+            sums[l * 3 + 1] += g[i];
+            sums[l * 3 + 2] += r[i];
+        }
+
+        float maxShift = 0.0f;
+        for (int c = 0; c < k; c++) {
+            if (counts[c] == 0) continue; // keep the old center
+            for (int ch = 0; ch < 3; ch++) {
+                float updated = (float)(sums[c * 3 + ch] / counts[c]);
+                maxShift = std::max(maxShift, std::abs(updated - centers[c * 3 + ch]));
+                centers[c * 3 + ch] = updated;
+            }
+        }
+        if (maxShift < FAST_KMEANS_EPS) break;
+    }
+
+    std::vector<ColorInfo> colors;
+    for (int c = 0; c < k; c++) {
+        ColorInfo colorInfo;
+        colorInfo.color = cv::Vec3b(
+            static_cast<uchar>(std::clamp(centers[c * 3 + 0] + 0.5f, 0.0f, 255.0f)),
+            static_cast<uchar>(std::clamp(centers[c * 3 + 1] + 0.5f, 0.0f, 255.0f)),
+            static_cast<uchar>(std::clamp(centers[c * 3 + 2] + 0.5f, 0.0f, 255.0f)));
+        colorInfo.weight = (double)counts[c] / n;
+        calculateColorProperties(colorInfo);
+        colors.push_back(colorInfo);
+    }
+
+    std::sort(colors.begin(), colors.end(),
+              [](const ColorInfo& a, const ColorInfo& b) {
+                  return a.weight > b.weight;
+              });
+
+    return colors;
+}
+
+// 1 inside the group's ranges, falling off with the distance to them
+static double colorGroupScore(double hue, double saturation, double brightness, const ColorGroup& group)
+{
+    // Check hue match (handle wraparound for red)
+    bool hueMatch = false;
+    if (group.hueMin > group.hueMax) { // wraparound case (red)
+        hueMatch = (hue >= group.hueMin || hue <= group.hueMax);
+    }
+    else {
+        hueMatch = (hue >= group.hueMin && hue <= group.hueMax);
+    }
+
+    if (hueMatch &&
+        saturation >= group.satMin && saturation <= group.satMax &&
+        brightness >= group.brightMin && brightness <= group.brightMax) {
+        return 1.0;
+    }
+
+    // Partial scoring for near matches
+    double hueDist = 0.0;
+    if (group.hueMin > group.hueMax) {
+        hueDist = std::min({std::abs(hue - group.hueMin),
+                            std::abs(hue - group.hueMax),
+                            std::abs(hue - (group.hueMin - 360)),
+                            std::abs(hue - (group.hueMax + 360))}) /
+                  180.0;
+    }
+    else {
+        hueDist = std::min(std::abs(hue - group.hueMin),
+                           std::abs(hue - group.hueMax)) /
+                  180.0;
+    }
+
+    double satDist = std::max(0.0, std::max(group.satMin - saturation,
+                                            saturation - group.satMax));
+    double brightDist = std::max(0.0, std::max(group.brightMin - brightness,
+                                               brightness - group.brightMax));
+
+    return std::max(0.0, 1.0 - (hueDist + satDist + brightDist) / 3.0);
+}
+
+double calculateGroupScore(const std::vector<ColorInfo>& colors, const ColorGroup& group)
+{
+    double score = 0.0;
+    double totalWeight = 0.0;
+
+    for (const auto& color : colors) {
+        score += colorGroupScore(color.hue, color.saturation, color.brightness, group) * color.weight;
+        totalWeight += color.weight;
+    }
+
+    return totalWeight > 0 ? score / totalWeight : 0.0;
+}
+
+// colorGroupScore split per HSV axis: for every 8-bit H, S and V value whether it's inside each group's range
+// and how far off it is. A color whose HSV fields sit on that grid (everything calculateColorProperties made)
+// is then three table reads per group, no wraparound branches and no doubles.
+struct GroupScoreTable {
+    size_t groups = 0;
+    std::vector<float> hueDist, satDist, brightDist;       // [value * groups + group]
+    std::vector<uint8_t> hueMatch, satMatch, brightMatch; // same layout
+};
+
+// Published whole through atomic_load/atomic_store: a grouping thread keeps the table it loaded,
+// rebuildGroupScores() swaps in a new one instead of writing over it
+static std::shared_ptr<const GroupScoreTable> groupScores;
+
+static void buildGroupScores(GroupScoreTable& table)
+{
+    const size_t groups = colorGroups.size();
+    table.groups = groups;
+    table.hueDist.assign(180 * groups, 0.0f);
+    table.hueMatch.assign(180 * groups, 0);
+    table.satDist.assign(256 * groups, 0.0f);
+    table.satMatch.assign(256 * groups, 0);
+    table.brightDist.assign(256 * groups, 0.0f);
+    table.brightMatch.assign(256 * groups, 0);
+
+    for (size_t i = 0; i < groups; i++) {
+        const ColorGroup& group = colorGroups[i];
+        const bool wraps = group.hueMin > group.hueMax;
+
+        for (int h = 0; h < 180; h++) {
+            double hue = h * 2.0;
+            bool match = wraps ? (hue >= group.hueMin || hue <= group.hueMax) : (hue >= group.hueMin && hue <= group.hueMax);
+            double dist = wraps ? std::min({std::abs(hue - group.hueMin), std::abs(hue - group.hueMax),
+                                            std::abs(hue - (group.hueMin - 360)), std::abs(hue - (group.hueMax + 360))})
+                                : std::min(std::abs(hue - group.hueMin), std::abs(hue - group.hueMax));
+            table.hueMatch[h * groups + i] = match;
+            table.hueDist[h * groups + i] = (float)(dist / 180.0);
+        }
+
+        for (int x = 0; x < 256; x++) {
+            double value = x / 255.0;
+            table.satMatch[x * groups + i] = value >= group.satMin && value <= group.satMax;
+            table.satDist[x * groups + i] = (float)std::max(0.0, std::max(group.satMin - value, value - group.satMax));
+            table.brightMatch[x * groups + i] = value >= group.brightMin && value <= group.brightMax;
+            table.brightDist[x * groups + i] = (float)std::max(0.0, std::max(group.brightMin - value, value - group.brightMax));
+        }
+    }
+}
+
+void rebuildGroupScores()
+{
+    auto table = std::make_shared<GroupScoreTable>();
+    buildGroupScores(*table);
+    std::atomic_store(&groupScores, std::shared_ptr<const GroupScoreTable>(std::move(table)));
+}
+
+// the current table, built from colorGroups on first use
+static std::shared_ptr<const GroupScoreTable> currentGroupScores()
+{
+    std::shared_ptr<const GroupScoreTable> table = std::atomic_load(&groupScores);
+    if (table) return table;
+
+    auto built = std::make_shared<GroupScoreTable>();
+    buildGroupScores(*built);
+    table = std::move(built);
+    std::shared_ptr<const GroupScoreTable> expected;
+    // another thread may have published one meanwhile, everybody then uses that
+    return std::atomic_compare_exchange_strong(&groupScores, &expected, table) ? table : expected;
+}
+
+std::vector<ColorInfo> extractDominantColors(const cv::Mat& image, ALGORITHM algorithm, ImageWorkspace& workspace)
+{
+    switch (algorithm) {
+        case KMEANS:     return extractDominantColorsKmeans(image, 5, workspace);
+        case KMEANSOPT:  return extractDominantColorsKmeansOpt(image, 5, workspace);
+        case HISTOGRAM:  return extractDominantColorsHistogram(image, 5, workspace);
+        case KMEANSFAST: return extractDominantColorsFast(image, 5, workspace);
+        case PALETTE:    return extractDominantColorsPalette(image, workspace);
+    }
+    return {};
+}
+
+int findBestGroup(const std::vector<ColorInfo>& colors, double& bestScore)
+{
+    const std::shared_ptr<const GroupScoreTable> current = currentGroupScores();
+    const GroupScoreTable& table = *current;
+    const size_t groups = table.groups;
+
+    float sums[64] = {};
+    std::vector<float> manyGroups;
+    float* sum = sums;
+    if (groups > 64) {
+        manyGroups.assign(groups, 0.0f);
+        sum = manyGroups.data();
+    }
+
+    float totalWeight = 0.0f;
+    for (const auto& color : colors) {
+        const float weight = (float)color.weight;
+        totalWeight += weight;
+
+        // the HSV fields are what calculateGroupScore scores, the histogram's bin centers are off the grid
+        double hq = color.hue / 2.0, sq = color.saturation * 255.0, vq = color.brightness * 255.0;
+        int h = (int)std::lround(hq), s = (int)std::lround(sq), v = (int)std::lround(vq);
+        bool onGrid = std::abs(hq - h) < 1e-6 && std::abs(sq - s) < 1e-6 && std::abs(vq - v) < 1e-6 &&
+                      h >= 0 && h < 180 && s >= 0 && s < 256 && v >= 0 && v < 256;
+        if (!onGrid) {
+            for (size_t i = 1; i < groups; i++) {
+                sum[i] += (float)colorGroupScore(color.hue, color.saturation, color.brightness, colorGroups[i]) * weight;
+            }
+            continue;
+        }
+        const size_t hi = h * groups, si = s * groups, vi = v * groups;
+
+        for (size_t i = 1; i < groups; i++) { // 0 is Miscellaneous, it never wins
+            float score;
+            if (table.hueMatch[hi + i] & table.satMatch[si + i] & table.brightMatch[vi + i]) score = 1.0f;
+            else score = std::max(0.0f, 1.0f - (table.hueDist[hi + i] + table.satDist[si + i] + table.brightDist[vi + i]) / 3.0f);
+            sum[i] += score * weight;
+        }
+    }
+
+    bestScore = 0.0;
+    int bestGroupId = 0;
+    if (totalWeight <= 0) return bestGroupId;
+
+    for (size_t i = 1; i < groups; i++) {
+        double score = sum[i] / totalWeight;
+        if (score > bestScore) {
+            bestScore = score;
+            bestGroupId = i;
+        }
+    }
+    return bestGroupId;
+}
+
+double computeDarkness(const cv::Mat& img, ImageWorkspace& workspace)
+{
+    cv::Mat gray = img;
+    if (img.channels() != 1) {
+        gray = ImageWorkspace::view(workspace.gray, img.rows, img.cols, CV_8UC1);
+        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    }
+    cv::Scalar meanVal = cv::mean(gray);
+    double avg_brightness = meanVal[0];
+    return 1.0 - (avg_brightness / 255.0);
+}
+
+// Extract dominant colors using K-means clustering
+std::vector<PaletteColor> extractPalette(const cv::Mat& image, int k, ImageWorkspace& workspace)
+{
+    std::vector<PaletteColor> palette;
+    if (image.empty()) return palette;
+
+    // the clusters of a 256x256 thumbnail are the clusters of the 8K original, at a fraction of the cost
+    cv::Mat sample = image;
+    const double pixels = (double)image.rows * image.cols;
+    if (pixels > PALETTE_MAX_PIXELS) {
+        double scale = std::sqrt(PALETTE_MAX_PIXELS / pixels);
+        cv::Size size = scaledSize(image, scale);
+        sample = ImageWorkspace::view(workspace.thumbnail, size.height, size.width, image.type());
+        cv::resize(image, sample, cv::Size(), scale, scale, cv::INTER_AREA);
+    }
+    if (sample.empty() || sample.rows * sample.cols < k) return palette;
+
+    // Reshape image to a 2D array of pixels
+    int samplePixels = sample.rows * sample.cols;
+    cv::Mat data = ImageWorkspace::view(workspace.samples, samplePixels, 3, CV_32F);
+    sample.reshape(1, samplePixels).convertTo(data, CV_32F);
+
+    // Apply K-means clustering
+    cv::Mat labels = ImageWorkspace::view(workspace.labels, samplePixels, 1, CV_32S);
+    cv::Mat centers = ImageWorkspace::view(workspace.centers, k, 3, CV_32F);
+    cv::kmeans(data, k, labels,
+               cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 20, 1.0),
+               3, cv::KMEANS_PP_CENTERS, centers);
+
+    // Count occurrences of each cluster
+    std::vector<int> counts(k, 0);
+    for (int i = 0; i < labels.rows; i++) {
+        counts[labels.at<int>(i)]++;
+    }
+
+    // Convert centers to color info
+    palette.reserve(k);
+    for (int i = 0; i < k; i++) {
+        PaletteColor colorInfo;
+        colorInfo.color = cv::Vec3b(
+            static_cast<uchar>(centers.at<float>(i, 0)),
+            static_cast<uchar>(centers.at<float>(i, 1)),
+            static_cast<uchar>(centers.at<float>(i, 2)));
+        colorInfo.count = (int)std::lround(counts[i] * pixels / labels.rows); // back to pixels of the full image
+        calculateColorProperties(colorInfo);
+        palette.push_back(colorInfo);
+    }
+
+    // Sort by count (most dominant first)
+    std::sort(palette.begin(), palette.end(),
+              [](const PaletteColor& a, const PaletteColor& b) {
+                  return a.count > b.count;
+              });
+
+    return palette;
+}
+
+const char* paletteGroupName(const PaletteColor& color)
+{
+    // clang-format off
+    if (color.saturation > 0.6 && color.brightness > 0.6) return "Vibrant"; // high saturation and brightness
+    if (color.brightness < 0.3)                           return "Dark";    // low brightness
+    if (color.brightness > 0.8 && color.saturation < 0.3) return "Light";   // high brightness, low saturation
+    if (color.saturation < 0.4)                           return "Muted";   // medium brightness, low saturation
+    return "Medium";                                                        // everything else
+    // clang-format on
+}
+
+std::vector<ColorInfo> extractDominantColorsPalette(const cv::Mat& image, ImageWorkspace& workspace)
+{
+    std::vector<PaletteColor> palette = extractPalette(image, PALETTE_COLORS, workspace);
+
+    double total = 0;
+    for (const auto& color : palette) total += color.count;
+
+    std::vector<ColorInfo> colors;
+    colors.reserve(palette.size());
+    for (const auto& color : palette) {
+        ColorInfo info;
+        info.color = color.color;
+        info.weight = total > 0 ? color.count / total : 0.0;
+        calculateColorProperties(info);
+        colors.push_back(info);
+    }
+    return colors;
+}
+
+std::vector<ColorInfo> fromCachedColors(const std::vector<CachedColor>& cached)
+{
+    std::vector<ColorInfo> colors;
+    colors.reserve(cached.size());
+    for (const auto& c : cached) {
+        ColorInfo colorInfo;
+        colorInfo.color = cv::Vec3b(c.b, c.g, c.r);
+        colorInfo.weight = c.weight;
+        if (c.hue >= 0) {
+            colorInfo.hue = c.hue;
+            colorInfo.saturation = c.saturation;
+            colorInfo.brightness = c.brightness;
+        }
+        else {
+            calculateColorProperties(colorInfo); // older cache, exact for every algorithm but -a 2
+        }
+        colors.push_back(colorInfo);
+    }
+    return colors;
+}
+
+std::vector<CachedColor> toCachedColors(const std::vector<ColorInfo>& colors)
+{
+    std::vector<CachedColor> cached;
+    cached.reserve(colors.size());
+    for (const auto& c : colors) {
+        cached.push_back({c.color[0], c.color[1], c.color[2], c.weight, c.hue, c.saturation, c.brightness});
+    }
+    return cached;
+}
+
+std::vector<CachedColor> toCachedPalette(const std::vector<PaletteColor>& palette)
+{
+    double total = 0;
+    for (const auto& color : palette) total += color.count;
+
+    std::vector<CachedColor> cached;
+    cached.reserve(palette.size());
+    for (const auto& color : palette) {
+        cached.push_back({color.color[0], color.color[1], color.color[2], total > 0 ? color.count / total : 0.0,
+                          color.hue, color.saturation, color.brightness});
+    }
+    return cached;
+}
+
+int colorsCacheKey(ALGORITHM algorithm, bool reduced)
+{
+    if (algorithm == PALETTE) return PALETTE_CACHE_KEY + PALETTE_COLORS; // from a thumbnail whatever the decode
+    return reduced ? REDUCED_COLORS_KEY + algorithm : algorithm;
+}
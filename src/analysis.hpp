@@ -0,0 +1,84 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "features.hpp"
+#include "workspace.hpp"
+
+// Pixel kernels shared by the wpu tools and wpu-bench, no file I/O or global tool state in here.
+// Their scratch Mats and vectors come from an ImageWorkspace, the calling thread's own unless one is passed.
+
+// grouper -a
+enum ALGORITHM {
+    KMEANS,
+    KMEANSOPT,
+    HISTOGRAM,
+    KMEANSFAST,
+    PALETTE // the wpu-palette clusters, shared with it through the feature cache
+};
+
+struct ColorInfo {
+    cv::Vec3b color;
+    double weight;
+    double saturation;
+    double brightness;
+    double hue;
+};
+
+// Predefined color groups with representative colors (HSV ranges)
+struct ColorGroup {
+    std::string name;
+    float hueMin, hueMax;
+    float satMin, satMax;
+    float brightMin, brightMax;
+    cv::Vec3b representativeColor;
+    int counter = 0;
+};
+
+extern std::vector<ColorGroup> colorGroups;
+
+void calculateColorProperties(ColorInfo& colorInfo);
+
+std::vector<ColorInfo> extractDominantColorsKmeans(const cv::Mat& image, int k = 5, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+std::vector<ColorInfo> extractDominantColorsKmeansOpt(const cv::Mat& image, int k = 5, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+std::vector<ColorInfo> extractDominantColorsHistogram(const cv::Mat& image, int k = 5, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+// same result from an image cv::cvtColor(COLOR_BGR2HSV) already converted
+std::vector<ColorInfo> extractDominantColorsHistogramOfHsv(const cv::Mat& hsv, int k = 5, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+std::vector<ColorInfo> extractDominantColorsFast(const cv::Mat& image, int k = 5, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+std::vector<ColorInfo> extractDominantColorsPalette(const cv::Mat& image, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+std::vector<ColorInfo> extractDominantColors(const cv::Mat& image, ALGORITHM algorithm, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+
+double calculateGroupScore(const std::vector<ColorInfo>& colors, const ColorGroup& group); // exact, from the HSV fields
+// Same result from per-axis HSV lookup tables, built from colorGroups on first use.
+int findBestGroup(const std::vector<ColorInfo>& colors, double& bestScore); // 0 (Miscellaneous) if nothing scores
+void rebuildGroupScores(); // after changing colorGroups (not while images are being grouped, the groups themselves are read)
+
+// 0 = white, 1 = black
+double computeDarkness(const cv::Mat& img, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+
+// wpu-palette
+struct PaletteColor {
+    cv::Vec3b color;
+    int count;
+    double saturation;
+    double brightness;
+    double hue;
+};
+
+// k-means cost grows with every pixel, bigger images are shrunk to this many before clustering
+constexpr int PALETTE_MAX_PIXELS = 256 * 256;
+constexpr int PALETTE_COLORS = 8; // default k, also what grouper -a 4 uses
+
+void calculateColorProperties(PaletteColor& colorInfo);
+// most dominant first, counts in pixels of image
+std::vector<PaletteColor> extractPalette(const cv::Mat& image, int k = PALETTE_COLORS, ImageWorkspace& workspace = ImageWorkspace::forThisThread());
+const char* paletteGroupName(const PaletteColor& color); // Vibrant, Dark, Light, Muted or Medium
+
+// Colors as the feature cache keeps them (FeatureRecord::colors)
+std::vector<ColorInfo> fromCachedColors(const std::vector<CachedColor>& cached);
+std::vector<CachedColor> toCachedColors(const std::vector<ColorInfo>& colors);
+std::vector<CachedColor> toCachedPalette(const std::vector<PaletteColor>& palette); // weight = share of the pixels
+// key of an algorithm's colors, reduced = from a --reduced decode (kept apart, they can differ).
+// -a 4 reads and writes the palettes of wpu-palette.
+int colorsCacheKey(ALGORITHM algorithm, bool reduced = false);
@@ -0,0 +1,460 @@
+#include <algorithm>
+#include <argparse/argparse.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <opencv2/opencv.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "analysis.hpp"
+#include "features.hpp"
+#include "globals.hpp"
+#include "imageio.hpp"
+#include "opencl.hpp"
+#include "utils.hpp"
+#include "workspace.hpp"
+
+// Allocation counters: every operator new of the process (ours, OpenCV's C++ code, std containers) and every
+// cv::Mat buffer. Codec internals that call malloc directly (libjpeg, libpng) aren't seen by either.
+static std::atomic<size_t> heapAllocations{0};
+static std::atomic<size_t> matAllocations{0};
+
+void* operator new(std::size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// Counts the Mat buffers OpenCV allocates, the memory itself comes from its own allocator
+class CountingMatAllocator : public cv::MatAllocator {
+  public:
+    explicit CountingMatAllocator(cv::MatAllocator* inner) : inner(inner) {}
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override
+    {
+        if (!data) matAllocations.fetch_add(1, std::memory_order_relaxed); // data = wrapping user memory
+        return inner->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+    {
+        return inner->allocate(data, accessFlags, usageFlags);
+    }
+    void deallocate(cv::UMatData* data) const override { inner->deallocate(data); }
+
+  private:
+    cv::MatAllocator* inner;
+};
+// One file of the corpus, decoded once up front so the pixel kernels are timed without the decode
+struct BenchImage {
+    std::string path;
+    size_t fileSize;
+    cv::Mat full;
+    cv::Mat grouper; // shrunk to 800x600 like wpu-grouper does
+};
+
+struct BenchKernel {
+    std::string name;
+    std::function<size_t(const BenchImage&)> run; // returns the bytes it went through
+    // instead of run: OPENCL_BATCH_SIZE images at a time (one device submission), their time split evenly
+    std::function<size_t(const std::vector<const BenchImage*>&)> runBatch = nullptr;
+};
+
+struct BenchResult {
+    std::string name;
+    size_t calls = 0;
+    double totalMs = 0.0;
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+    double imagesPerSec = 0.0;
+    double mbPerSec = 0.0;
+    double allocsPerImage = 0.0; // operator new calls
+    double matsPerImage = 0.0;   // cv::Mat buffers
+};
+
+// Deterministic wallpaper-ish images: gradient sky, a few blobs, noise.
+// Every image gets a different base hue and brightness so all kernels see varied input.
+std::vector<std::string> writeSyntheticCorpus(const std::string& folder, int count, int width, int height)
+{
+    std::filesystem::create_directories(folder);
+    std::mt19937 rng(1234);
+    std::vector<std::string> paths;
+
+    for (int n = 0; n < count; n++) {
+        cv::Mat hsv(height, width, CV_8UC3);
+        int hue = (n * 37) % 180;
+        int brightness = 40 + (n * 53) % 200;
+        for (int y = 0; y < height; y++) {
+            cv::Vec3b* row = hsv.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < width; x++) {
+                row[x] = cv::Vec3b((hue + x * 30 / width) % 180, 80 + y * 150 / height, std::min(255, brightness + (x + y) * 40 / (width + height)));
+            }
+        }
+
+        cv::Mat image;
+        cv::cvtColor(hsv, image, cv::COLOR_HSV2BGR);
+        for (int blob = 0; blob < 6; blob++) {
+            cv::Point center(rng() % width, rng() % height);
+            int radius = height / 16 + rng() % (height / 4);
+            cv::circle(image, center, radius, cv::Scalar(rng() % 256, rng() % 256, rng() % 256), cv::FILLED, cv::LINE_AA);
+        }
+
+        cv::Mat noise(image.size(), image.type());
+        cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(8));
+        image += noise;
+
+        // mostly JPEGs like a real wallpaper folder, every fourth one PNG
+        std::string path = folder + "/synthetic_" + std::to_string(n) + (n % 4 == 3 ? ".png" : ".jpg");
+        if (cv::imwrite(path, image)) paths.push_back(path);
+    }
+
+    return paths;
+}
+
+double percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty()) return 0.0;
+    size_t index = std::min(samples.size() - 1, (size_t)(p * (samples.size() - 1) + 0.5));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+BenchResult runKernel(const BenchKernel& kernel, const std::vector<BenchImage>& corpus, int repeat)
+{
+    BenchResult result;
+    result.name = kernel.name;
+
+    std::vector<double> latencies;
+    latencies.reserve(corpus.size() * repeat);
+    size_t bytes = 0;
+
+    std::vector<std::vector<const BenchImage*>> batches;
+    if (kernel.runBatch) {
+        for (size_t i = 0; i < corpus.size(); i += OPENCL_BATCH_SIZE) {
+            batches.emplace_back();
+            for (size_t j = i; j < std::min(corpus.size(), i + OPENCL_BATCH_SIZE); j++) batches.back().push_back(&corpus[j]);
+        }
+    }
+
+    // warm up caches, OpenCV's lazy init (and OpenCL kernel compiles) and the workspace buffers
+    if (kernel.runBatch) for (const auto& batch : batches) kernel.runBatch(batch);
+    else for (const auto& image : corpus) kernel.run(image);
+
+    size_t heapBefore = heapAllocations, matsBefore = matAllocations;
+    for (int r = 0; r < repeat; r++) {
+        if (kernel.runBatch) {
+            for (const auto& batch : batches) {
+                auto start = std::chrono::steady_clock::now();
+                bytes += kernel.runBatch(batch);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                latencies.insert(latencies.end(), batch.size(), ms / batch.size());
+            }
+            continue;
+        }
+        for (const auto& image : corpus) {
+            auto start = std::chrono::steady_clock::now();
+            bytes += kernel.run(image);
+            latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    result.calls = latencies.size();
+    result.allocsPerImage = (double)(heapAllocations - heapBefore) / result.calls;
+    result.matsPerImage = (double)(matAllocations - matsBefore) / result.calls;
+    for (double ms : latencies) result.totalMs += ms;
+    result.p50Ms = percentile(latencies, 0.50);
+    result.p99Ms = percentile(latencies, 0.99);
+    if (result.totalMs > 0) {
+        result.imagesPerSec = result.calls / (result.totalMs / 1000.0);
+        result.mbPerSec = bytes / (1024.0 * 1024.0) / (result.totalMs / 1000.0);
+    }
+    return result;
+}
+
+bool writeJson(const std::string& path, const std::string& corpusName, const std::vector<BenchImage>& corpus, int repeat,
+               const std::vector<BenchResult>& results)
+{
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+
+    out << std::fixed << std::setprecision(4);
+    out << "{\n";
+    out << "  \"version\": \"" << VERSION << "\",\n";
+    out << "  \"timestamp\": " << std::time(nullptr) << ",\n";
+    out << "  \"corpus\": \"" << jsonEscape(corpusName) << "\",\n";
+    out << "  \"images\": " << corpus.size() << ",\n";
+    out << "  \"repeat\": " << repeat << ",\n";
+    out << "  \"kernels\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"calls\": " << r.calls
+            << ", \"images_per_sec\": " << r.imagesPerSec << ", \"p50_ms\": " << r.p50Ms
+            << ", \"p99_ms\": " << r.p99Ms << ", \"mb_per_sec\": " << r.mbPerSec
+            << ", \"allocs_per_image\": " << r.allocsPerImage << ", \"mats_per_image\": " << r.matsPerImage << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+    return (bool)out;
+}
+
+int main(int argc, char* argv[])
+{
+    freopen("/dev/null", "w", stderr); // suppress errors
+
+    argparse::ArgumentParser program("bench", VERSION);
+    program.add_description("benchmark the analysis kernels of the wpu tools (single thread)");
+    program.add_argument("-i", "--input")
+        .help("folder with real images to use instead of the synthetic corpus");
+    program.add_argument("-n", "--count")
+        .default_value(24)
+        .metavar("N")
+        .scan<'i', int>()
+        .help("number of images in the corpus");
+    program.add_argument("-s", "--size")
+        .default_value(std::string("1920x1080"))
+        .metavar("WxH")
+        .help("size of the synthetic images");
+    program.add_argument("-r", "--repeat")
+        .default_value(3)
+        .metavar("N")
+        .scan<'i', int>()
+        .help("times every kernel goes over the corpus");
+    program.add_argument("-k", "--kernel")
+        .metavar("name")
+        .help("only run kernels whose name contains this");
+    program.add_argument("--io")
+        .default_value(std::string("imread"))
+        .metavar("backend")
+        .help("how the decode and validate kernels read files: imread, read, mmap or uring");
+    program.add_argument("--backend")
+        .default_value(std::string("cpu"))
+        .metavar("name")
+        .help("opencl also runs the darkness, shrink and full size histogram kernels on the GPU, batched like the tools do");
+    program.add_argument("-j", "--json")
+        .metavar("bench.json")
+        .help("also write the results as JSON");
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << program;
+        return 1;
+    }
+
+    IoBackend io;
+    if (!parseIoBackend(program.get<std::string>("--io"), io)) {
+        std::cout << "Invalid --io: " << program.get<std::string>("--io") << std::endl;
+        return 1;
+    }
+    setIoBackend(io);
+
+    AnalysisBackend backend;
+    if (!parseAnalysisBackend(program.get<std::string>("--backend"), backend)) {
+        std::cout << "Invalid --backend: " << program.get<std::string>("--backend") << std::endl;
+        return 1;
+    }
+    if (!setAnalysisBackend(backend)) {
+        std::cout << "OpenCL is not available (no device, or OpenCV was built without it)" << std::endl;
+        return 1;
+    }
+
+    CountingMatAllocator matAllocator(cv::Mat::getStdAllocator());
+    cv::Mat::setDefaultAllocator(&matAllocator);
+
+    int count = std::max(1, program.get<int>("--count"));
+    int repeat = std::max(1, program.get<int>("--repeat"));
+
+    std::vector<std::string> paths;
+    std::string corpusName;
+    std::string syntheticFolder;
+    if (auto input = program.present("--input")) {
+        getImages(paths, *input);
+        std::sort(paths.begin(), paths.end()); // same subset every run
+        if ((int)paths.size() > count) paths.resize(count);
+        corpusName = *input;
+    }
+    else {
+        int width = 0, height = 0;
+        std::string size = program.get<std::string>("--size");
+        if (sscanf(size.c_str(), "%dx%d", &width, &height) != 2 || width < 16 || height < 16) {
+            std::cout << "Invalid --size: " << size << std::endl;
+            return 1;
+        }
+        syntheticFolder = (std::filesystem::temp_directory_path() / ("wpu-bench-" + std::to_string(getpid()))).string();
+        std::cout << "Writing " << count << " synthetic " << size << " images to " << syntheticFolder << std::endl;
+        paths = writeSyntheticCorpus(syntheticFolder, count, width, height);
+        corpusName = "synthetic " + size;
+    }
+
+    std::vector<BenchImage> corpus;
+    for (const auto& path : paths) {
+        BenchImage image;
+        image.path = path;
+        image.full = loadImage(path, DecodeOptions());
+        if (image.full.empty()) continue;
+        image.fileSize = std::filesystem::file_size(path);
+        image.grouper = image.full;
+        if (image.full.cols > 800 || image.full.rows > 600) {
+            double scale = std::min(800.0 / image.full.cols, 600.0 / image.full.rows);
+            cv::resize(image.full, image.grouper, cv::Size(), scale, scale);
+        }
+        corpus.push_back(image);
+    }
+    if (corpus.empty()) {
+        std::cout << "No images could be loaded." << std::endl;
+        return 1;
+    }
+
+    auto pixelBytes = [](const cv::Mat& m) { return m.total() * m.elemSize(); };
+
+    // colors for the group score kernel, so it's timed without the extraction
+    std::vector<std::vector<ColorInfo>> groupColors;
+    for (const auto& image : corpus) groupColors.push_back(extractDominantColorsHistogram(image.grouper));
+    auto colorsOf = [&corpus, &groupColors](const BenchImage& image) -> const std::vector<ColorInfo>& {
+        return groupColors[&image - corpus.data()];
+    };
+
+    auto validate = [](int level) {
+        return [level](const BenchImage& image) {
+            int checked = level, width, height;
+            validateImageFile(image.path, checked, width, height);
+            return image.fileSize;
+        };
+    };
+
+    // decode and shrink like wpu-grouper, into the thread's workspace
+    auto loadForGrouper = [](const BenchImage& image) {
+        ImageWorkspace& workspace = ImageWorkspace::forThisThread();
+        cv::Mat decoded = loadImage(image.path, DecodeOptions(), workspace);
+        if (decoded.empty() || (decoded.cols <= 800 && decoded.rows <= 600)) return decoded;
+        double scale = std::min(800.0 / decoded.cols, 600.0 / decoded.rows);
+        cv::Size size = scaledSize(decoded, scale);
+        cv::Mat shrunk = ImageWorkspace::view(workspace.shrunk, size.height, size.width, decoded.type());
+        cv::resize(decoded, shrunk, cv::Size(), scale, scale);
+        return shrunk;
+    };
+
+    // the 800x600 copy wpu-grouper works on, into the thread's workspace like it does
+    auto shrinkForGrouper = [](const BenchImage& image) {
+        double scale = std::min(800.0 / image.full.cols, 600.0 / image.full.rows);
+        if (scale >= 1.0) return image.full;
+        cv::Size size = scaledSize(image.full, scale);
+        cv::Mat shrunk = ImageWorkspace::view(ImageWorkspace::forThisThread().shrunk, size.height, size.width, image.full.type());
+        cv::resize(image.full, shrunk, cv::Size(), scale, scale);
+        return shrunk;
+    };
+
+    // MB/s is file bytes for kernels that read the file, decoded pixel bytes for the others
+    std::vector<BenchKernel> kernels = {
+        {"decode", [](const BenchImage& image) {
+             loadImage(image.path, DecodeOptions(), ImageWorkspace::forThisThread());
+             return image.fileSize;
+         }},
+        {"darkness", [&](const BenchImage& image) { computeDarkness(image.full); return pixelBytes(image.full); }},
+        {"kmeans", [&](const BenchImage& image) { extractDominantColorsKmeans(image.grouper); return pixelBytes(image.grouper); }},
+        {"kmeans-opt", [&](const BenchImage& image) { extractDominantColorsKmeansOpt(image.grouper); return pixelBytes(image.grouper); }},
+        {"histogram", [&](const BenchImage& image) { extractDominantColorsHistogram(image.grouper); return pixelBytes(image.grouper); }},
+        {"histogram-full", [&](const BenchImage& image) { extractDominantColorsHistogram(image.full); return pixelBytes(image.full); }}, // what grouper -a 2 does
+        {"shrink", [&](const BenchImage& image) { shrinkForGrouper(image); return pixelBytes(image.full); }},
+        {"kmeans-fast", [&](const BenchImage& image) { extractDominantColorsFast(image.grouper); return pixelBytes(image.grouper); }},
+        {"group-score", [&](const BenchImage& image) {
+             double score;
+             findBestGroup(colorsOf(image), score);
+             return (size_t)0;
+         }},
+        {"validate-header", validate(VALIDATION_HEADER)},
+        {"validate-reduced", validate(VALIDATION_REDUCED)},
+        {"validate-full", validate(VALIDATION_FULL)},
+        {"palette", [&](const BenchImage& image) { extractPalette(image.grouper); return pixelBytes(image.grouper); }},
+        {"grouper", [&](const BenchImage& image) { // decode, shrink and kmeans, one wpu-grouper image
+             extractDominantColorsKmeans(loadForGrouper(image));
+             return image.fileSize;
+         }},
+    };
+
+    // the same stages on the device, each batch a single submission with its uploads and read backs included
+    std::vector<OpenclJob> jobs(OPENCL_BATCH_SIZE);
+    std::vector<cv::Mat> deviceOutputs(OPENCL_BATCH_SIZE); // reused from batch to batch
+    std::vector<double> deviceScores(OPENCL_BATCH_SIZE);
+    if (backend == AnalysisBackend::OPENCL) {
+        std::cout << "OpenCL device: " << openclDeviceName() << std::endl;
+        using Batch = std::vector<const BenchImage*>;
+        auto runJobs = [&](const Batch& batch, const std::function<void(OpenclJob&, size_t)>& setup) {
+            std::vector<OpenclJob*> pointers;
+            size_t bytes = 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                jobs[i] = OpenclJob();
+                jobs[i].image = &batch[i]->full;
+                setup(jobs[i], i);
+                pointers.push_back(&jobs[i]);
+                bytes += pixelBytes(batch[i]->full);
+            }
+            submitBatch(pointers);
+            return bytes;
+        };
+        kernels.push_back({"darkness-opencl", nullptr, [&, runJobs](const Batch& batch) {
+                               return runJobs(batch, [&](OpenclJob& job, size_t i) { job.darkness = &deviceScores[i]; });
+                           }});
+        kernels.push_back({"shrink-opencl", nullptr, [&, runJobs](const Batch& batch) {
+                               return runJobs(batch, [&](OpenclJob& job, size_t i) {
+                                   job.scale = std::min(1.0, std::min(800.0 / job.image->cols, 600.0 / job.image->rows));
+                                   job.shrunk = &deviceOutputs[i];
+                               });
+                           }});
+        kernels.push_back({"histogram-full-opencl", nullptr, [&, runJobs](const Batch& batch) {
+                               size_t bytes = runJobs(batch, [&](OpenclJob& job, size_t i) { job.hsv = &deviceOutputs[i]; });
+                               for (size_t i = 0; i < batch.size(); i++) extractDominantColorsHistogramOfHsv(deviceOutputs[i]);
+                               return bytes;
+                           }});
+    }
+
+    std::string filter = program.present("--kernel").value_or("");
+
+    std::cout << "Corpus: " << corpusName << ", " << corpus.size() << " images, " << repeat << " passes" << std::endl;
+    std::cout << std::left << std::setw(18) << "kernel" << std::right << std::setw(12) << "images/s"
+              << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << std::setw(12) << "MB/s"
+              << std::setw(12) << "allocs/img" << std::setw(10) << "Mats/img" << std::endl;
+
+    std::vector<BenchResult> results;
+    for (const auto& kernel : kernels) {
+        if (!filter.empty() && kernel.name.find(filter) == std::string::npos) continue;
+
+        BenchResult r = runKernel(kernel, corpus, repeat);
+        std::cout << std::left << std::setw(18) << r.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << r.imagesPerSec << std::setw(12) << r.p50Ms << std::setw(12) << r.p99Ms
+                  << std::setw(12) << r.mbPerSec << std::setw(12) << r.allocsPerImage << std::setw(10) << r.matsPerImage << std::endl;
+        results.push_back(r);
+    }
+
+    if (!syntheticFolder.empty()) {
+        std::error_code ec;
+        std::filesystem::remove_all(syntheticFolder, ec);
+    }
+
+    if (auto json = program.present("--json")) {
+        if (!writeJson(*json, corpusName, corpus, repeat, results)) {
+            std::cout << "Could not write " << *json << std::endl;
+            return 1;
+        }
+        std::cout << "Results written to " << *json << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "control.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// the daemon may decode a file for "score", the client waits that long for it
+constexpr int CONTROL_CLIENT_TIMEOUT_MS = 30000;
+
+std::string defaultControlSocket()
+{
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) return std::string(runtimeDir) + "/wpu.sock";
+    return "/tmp/wpu-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool socketAddress(const std::string& path, sockaddr_un& addr)
+{
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static void setTimeouts(int fd, int ms)
+{
+    timeval tv{};
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int connectTo(const std::string& path)
+{
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+ControlServer::ControlServer(std::string socketPath) : path(std::move(socketPath))
+{
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) {
+        std::cerr << "Error: socket path is empty or too long: " << path << std::endl;
+        return;
+    }
+
+    int other = connectTo(path);
+    if (other >= 0) {
+        close(other);
+        std::cerr << "Error: another daemon is listening on " << path << ", not taking requests" << std::endl;
+        path.clear(); // not ours to remove
+        return;
+    }
+    unlink(path.c_str()); // left behind by one that didn't shut down cleanly
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "Error: socket failed: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    // only this user may connect, -d runs with umask 0. Nobody can connect before listen(),
+    // so the mode bind() left for a moment doesn't matter (umask would change it for every thread).
+    bool bound = bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    if (bound && chmod(path.c_str(), 0600) != 0) {
+        unlink(path.c_str());
+        bound = false;
+    }
+    if (!bound || listen(fd, 16) != 0) {
+        std::cerr << "Error: could not listen on " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        fd = -1;
+        path.clear();
+    }
+}
+
+ControlServer::~ControlServer()
+{
+    for (const auto& [clientFd, client] : clients) close(clientFd);
+    if (fd < 0) return;
+    close(fd);
+    unlink(path.c_str());
+}
+
+void ControlServer::acceptClients(int epollFd)
+{
+    if (fd < 0) return;
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = clients.begin(); it != clients.end();) {
+        if (now - it->second.connected <= std::chrono::milliseconds(CONTROL_TIMEOUT_MS)) {
+            ++it;
+            continue;
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, it->first, nullptr);
+        close(it->first);
+        it = clients.erase(it);
+    }
+
+    while (true) {
+        int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return; // EAGAIN: nobody else waiting
+        }
+        if (clients.size() >= CONTROL_MAX_CLIENTS) {
+            auto oldest = std::min_element(clients.begin(), clients.end(),
+                                           [](const auto& a, const auto& b) { return a.second.connected < b.second.connected; });
+            drop(oldest->first, epollFd);
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = client;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event) != 0) {
+            close(client);
+            continue;
+        }
+        clients[client].connected = now;
+    }
+}
+
+void ControlServer::drop(int clientFd, int epollFd)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, nullptr);
+    close(clientFd);
+    clients.erase(clientFd);
+}
+
+bool ControlServer::readClient(int clientFd, int epollFd, ControlRequest& request)
+{
+    request = ControlRequest();
+    auto it = clients.find(clientFd);
+    if (it == clients.end()) return false;
+    std::string& line = it->second.line;
+
+    char buffer[512];
+    while (line.find('\n') == std::string::npos && line.size() < CONTROL_MAX_REQUEST) {
+        ssize_t n = read(clientFd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return false; // the rest comes with the next EPOLLIN
+        if (n <= 0) break; // hung up, what came so far is the request
+        line.append(buffer, n);
+    }
+
+    line = line.substr(0, line.find('\n'));
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) {
+        drop(clientFd, epollFd);
+        return false;
+    }
+
+    size_t space = line.find(' ');
+    request.command = line.substr(0, space);
+    request.argument = space == std::string::npos ? "" : line.substr(space + 1);
+    request.fd = clientFd;
+    clients.erase(it);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, nullptr);
+
+    // the answer may come from another thread and is written in one go, blocking with a timeout
+    fcntl(clientFd, F_SETFL, fcntl(clientFd, F_GETFL) & ~O_NONBLOCK);
+    setTimeouts(clientFd, CONTROL_TIMEOUT_MS);
+    return true;
+}
+
+void controlReply(int fd, bool ok, const std::string& body)
+{
+    std::string answer = ok ? "ok\n" + body : "error " + body;
+    if (!answer.empty() && answer.back() != '\n') answer += '\n';
+
+    // MSG_NOSIGNAL: a client that already left must not take the daemon down with SIGPIPE
+    for (size_t done = 0; done < answer.size();) {
+        ssize_t n = send(fd, answer.data() + done, answer.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+}
+
+bool controlRequest(const std::string& socketPath, const std::string& request, std::string& reply)
+{
+    reply.clear();
+    int fd = connectTo(socketPath);
+    if (fd < 0) {
+        reply = "no daemon on " + socketPath + " (start wpu-darkscore-select -l or -d)";
+        return false;
+    }
+    setTimeouts(fd, CONTROL_CLIENT_TIMEOUT_MS);
+
+    std::string line = request + "\n";
+    bool sent = send(fd, line.data(), line.size(), MSG_NOSIGNAL) == (ssize_t)line.size();
+
+    std::string answer;
+    char buffer[4096];
+    while (sent) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        answer.append(buffer, n);
+    }
+    close(fd);
+
+    if (answer.rfind("ok\n", 0) == 0) {
+        reply = answer.substr(3);
+        return true;
+    }
+    if (answer.rfind("error ", 0) == 0) reply = answer.substr(6);
+    else reply = "no answer from " + socketPath;
+    while (!reply.empty() && reply.back() == '\n') reply.pop_back();
+    return false;
+}
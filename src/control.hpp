@@ -0,0 +1,65 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+// Control socket of wpu-darkscore-select -l/-d, the `wpu` client talks to it.
+// One request per connection: the client sends a line ("next", "score <file>", "reload", "status", "stats"),
+// the daemon answers and closes. The first line of an answer is "ok" or "error <why>", the rest is the body.
+
+// $XDG_RUNTIME_DIR/wpu.sock, /tmp/wpu-<uid>.sock without it
+std::string defaultControlSocket();
+
+struct ControlRequest {
+    int fd = -1; // answer with controlReply, which closes it
+    std::string command;
+    std::string argument; // rest of the line
+};
+
+class ControlServer {
+  public:
+    ControlServer() = default; // no socket, ok() is false
+    // Takes over a stale socket file, not one another daemon still listens on
+    explicit ControlServer(std::string path);
+    ~ControlServer(); // removes the socket file
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    bool ok() const { return fd >= 0; }
+    int listenFd() const { return fd; } // readable = a client is waiting
+    const std::string& socketPath() const { return path; }
+
+    // Accepts every waiting client and adds it (non-blocking) to epollFd, nothing waits for a request line.
+    // Clients that didn't send one within CONTROL_TIMEOUT_MS are dropped here.
+    void acceptClients(int epollFd);
+    bool isClient(int clientFd) const { return clients.count(clientFd) > 0; }
+    // clientFd got readable: true once its request line is complete, the fd then leaves epollFd and
+    // belongs to request. false while the line isn't there yet, or if the client left without one.
+    bool readClient(int clientFd, int epollFd, ControlRequest& request);
+
+  private:
+    struct Client {
+        std::string line;
+        std::chrono::steady_clock::time_point connected;
+    };
+    void drop(int clientFd, int epollFd);
+
+    std::string path;
+    int fd = -1;
+    std::unordered_map<int, Client> clients; // connected, request line not complete yet
+};
+
+void controlReply(int fd, bool ok, const std::string& body);
+
+// Client side: sends request, reply = body of the answer (or the daemon's error).
+// false if nobody answered or the answer was an error.
+bool controlRequest(const std::string& socketPath, const std::string& request, std::string& reply);
+
+// a client that connects and then doesn't send its line is dropped after this, one that doesn't read its answer
+// can hold a reply for this long
+constexpr int CONTROL_TIMEOUT_MS = 5000;
+// connected clients still sending their line, the oldest is dropped for a new one
+constexpr size_t CONTROL_MAX_CLIENTS = 64;
+// longest request line
+constexpr size_t CONTROL_MAX_REQUEST = 4096;
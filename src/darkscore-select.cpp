@@ -4,37 +4,47 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include <random>
 #include <signal.h>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "analysis.hpp"
+#include "control.hpp"
+#include "imageio.hpp"
+#include "prefetch.hpp"
+#include "scoreindex.hpp"
 #include "utils.hpp"
 
-// Global flag to interrupt sleep
+// Global flags for the reload thread, the event loop sets them
 std::atomic<bool> g_running{true};
-std::atomic<bool> g_sleeping{false};
-std::mutex g_sleep_mutex;
-std::condition_variable g_sleep_cv;
+std::atomic<bool> g_reload{false};
+std::atomic<int> g_reloads{0}; // done, for "stats"
+std::mutex g_reload_mutex;
+std::condition_variable g_reload_cv;
 
-void handle_signal(int sig)
-{
-    if (sig == SIGRTMIN + 10) {
-        std::cout << "Received SIGRTMIN+10! Triggering wallpaper change...\n";
-        g_sleeping = false;
-        g_sleep_cv.notify_all();
-    }
-}
+constexpr int LOOP_SLEEP_MS = 1000 * 60 * 1; // 1 min
+constexpr int LOOP_RETRY_MS = 2000;          // after a failed change
 
 void daemonize()
 {
@@ -56,7 +66,7 @@ void daemonize()
     }
 
     // Catch, ignore, or handle signals here if needed
-    signal(SIGCHLD, SIG_IGN);
+    // (SIGCHLD stays default, the command runner reaps its children and wants their exit status)
     signal(SIGHUP, SIG_IGN);
 
     // Fork again to prevent reacquiring a terminal
@@ -84,22 +94,8 @@ void daemonize()
     }
 }
 
-// Map darkness score (0=bright, 1=dark)
-// bucket 0-5 (0=darkest, 5=brightest)
-int getDarknessBucket(double score)
-{
-    if (score > 0.9) return 0; // very dark
-    if (score > 0.8) return 1; // dark
-    if (score > 0.6) return 2; // mid-dark
-    if (score > 0.4) return 3; // mid-bright
-    if (score > 0.2) return 4; // bright
-    if (score > 0.0) return 5; // very bright
-    return 5;
-}
-
-// function now returns dark wallpapers during the day aswell
-// but during the night you won't see bright wallpapers
-int getTargetBucketForHour(int hour)
+// brightest bucket allowed at that hour
+int getMaxBucketForHour(int hour)
 {
     int bucket = 0;
     // clang-format off
@@ -114,8 +110,13 @@ int getTargetBucketForHour(int hour)
     else if (hour >= 5)  bucket = 1; // dark
     else if (hour >= 0)  bucket = 0; // very dark
     // clang-format on
+    return bucket;
+}
 
-
+// function now returns dark wallpapers during the day aswell
+// but during the night you won't see bright wallpapers
+int getTargetBucket(int maxBucket)
+{
     // very dark      = very dark
     // dark           = very dark, dark
     // mid-dark       = very dark, dark, mid-dark
@@ -124,25 +125,52 @@ int getTargetBucketForHour(int hour)
     // very bright    = very dark, dark, mid-dark, mid-bright, bright, very bright
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dist(0, static_cast<int>(bucket));
+    std::uniform_int_distribution<> dist(0, maxBucket);
     return dist(gen);
 }
 
-struct DarkScoreResult {
-    std::string filePath;
-    double score;
-};
+int getTargetBucketForHour(int hour)
+{
+    return getTargetBucket(getMaxBucketForHour(hour));
+}
 
-std::vector<std::vector<DarkScoreResult>> loadBuckets(const std::string& inputPath)
+// Start of the next hour with a different max bucket, mktime takes care of the day wrap and DST
+std::time_t nextBucketBoundary(std::time_t now)
 {
-    std::vector<std::vector<DarkScoreResult>> buckets(6);
+    std::tm local;
+    localtime_r(&now, &local);
+    const int current = getMaxBucketForHour(local.tm_hour);
+
+    for (int ahead = 1; ahead <= 24; ahead++) {
+        std::tm t = local;
+        t.tm_hour += ahead;
+        t.tm_min = 0;
+        t.tm_sec = 0;
+        t.tm_isdst = -1;
+        std::time_t at = std::mktime(&t);
+        if (at > now && getMaxBucketForHour(t.tm_hour) != current) return at;
+    }
+    return now + 24 * 3600;
+}
+
+// Binary indexes (wpu-darkscore --index) are mmapped as they are,
+// CSV files are parsed into the same layout in memory
+bool loadBuckets(const std::string& inputPath, ScoreIndex& index)
+{
+    if (ScoreIndex::isIndexFile(inputPath)) {
+        if (index.open(inputPath)) return true;
+        std::cerr << "Error: Invalid or outdated index " << inputPath << " (rerun wpu-darkscore --index)" << std::endl;
+        return false;
+    }
 
     std::ifstream file(inputPath);
     if (!file.is_open()) {
         std::cerr << "Error: Could not open file " << inputPath << std::endl;
-        return buckets;
+        return false;
     }
 
+    std::vector<DarkScoreResult> results;
+
     std::string line;
     if (getline(file, line)) {} // skip header
 
@@ -159,34 +187,81 @@ std::vector<std::vector<DarkScoreResult>> loadBuckets(const std::string& inputPa
             continue;
         }
 
-        int b = getDarknessBucket(image.score);
-        buckets[b].push_back(image);
+        results.push_back(image);
     }
 
-    return buckets;
+    return index.assign(ScoreIndex::build(results));
 }
 
+// Where a BucketIterator is in its current bucket, taken under the iterator lock so a reload can carry it over
+struct BucketPosition {
+    std::shared_ptr<const ScoreIndex> index;
+    int lastUsedBucket = -1;
+    std::vector<uint32_t> shown; // already shown in this pass of lastUsedBucket
+    uint64_t generation = 0;
+};
+
 // State tracker for sequential iteration through buckets
 struct BucketIterator {
-    std::vector<std::vector<DarkScoreResult>> shuffledBuckets;
+    std::shared_ptr<const ScoreIndex> index; // shared, a reload maps the new file next to it and swaps
+    std::vector<std::vector<uint32_t>> shuffledBuckets; // entry numbers into the index
     std::vector<size_t> currentIndices; // Current position in each bucket
     int lastUsedBucket;
     std::mt19937 rng;
+    uint64_t generation = 0; // bumped by every getNext
 
-    BucketIterator(const std::vector<std::vector<DarkScoreResult>>& buckets)
-        : shuffledBuckets(buckets), currentIndices(6, 0), lastUsedBucket(-1)
+    BucketIterator(std::shared_ptr<const ScoreIndex> index)
+        : index(std::move(index)), shuffledBuckets(DARKNESS_BUCKETS), currentIndices(DARKNESS_BUCKETS, 0), lastUsedBucket(-1)
     {
         std::random_device rd;
         rng.seed(rd());
 
         // Shuffle all buckets initially
-        for (auto& bucket : shuffledBuckets) {
+        for (int b = 0; b < DARKNESS_BUCKETS; b++) {
+            auto& bucket = shuffledBuckets[b];
+            bucket.resize(this->index->bucketSize(b));
+            for (uint32_t i = 0; i < bucket.size(); i++) bucket[i] = this->index->bucketBegin(b) + i;
             std::shuffle(bucket.begin(), bucket.end(), rng);
         }
     }
 
-    DarkScoreResult getNext(int targetBucket)
+    // Continues where previous left off: wallpapers it already showed in the current pass stay shown,
+    // new ones join the rest of the pass
+    BucketIterator(std::shared_ptr<const ScoreIndex> index, const BucketPosition& previous)
+        : BucketIterator(std::move(index))
     {
+        lastUsedBucket = previous.lastUsedBucket;
+        if (lastUsedBucket < 0 || previous.shown.empty()) return;
+
+        std::unordered_set<std::string_view> shownPaths;
+        shownPaths.reserve(previous.shown.size());
+        for (uint32_t entry : previous.shown) shownPaths.insert(previous.index->path(entry));
+
+        auto& bucket = shuffledBuckets[lastUsedBucket];
+        auto rest = std::partition(bucket.begin(), bucket.end(), [&](uint32_t entry) { return shownPaths.count(this->index->path(entry)) > 0; });
+        currentIndices[lastUsedBucket] = rest - bucket.begin();
+        if (currentIndices[lastUsedBucket] >= bucket.size()) {
+            currentIndices[lastUsedBucket] = 0; // everything was shown, next pass
+            std::shuffle(bucket.begin(), bucket.end(), rng);
+        }
+    }
+
+    BucketPosition position() const
+    {
+        BucketPosition pos;
+        pos.index = index;
+        pos.lastUsedBucket = lastUsedBucket;
+        pos.generation = generation;
+        if (lastUsedBucket >= 0) {
+            const auto& bucket = shuffledBuckets[lastUsedBucket];
+            pos.shown.assign(bucket.begin(), bucket.begin() + currentIndices[lastUsedBucket]);
+        }
+        return pos;
+    }
+
+    ScoreEntry getNext(int targetBucket) // valid while index is
+    {
+        generation++;
         // Find the actual bucket to use (with fallback logic)
         int chosenBucket = targetBucket;
         int offset = 0;
@@ -222,7 +297,7 @@ struct BucketIterator {
 
         // Get current wallpaper from bucket
         size_t& currentIdx = currentIndices[chosenBucket];
-        const auto& result = shuffledBuckets[chosenBucket][currentIdx];
+        ScoreEntry result = index->entry(shuffledBuckets[chosenBucket][currentIdx]);
 
         // Advance index, wrap around and reshuffle if we've gone through all
         currentIdx++;
@@ -239,51 +314,411 @@ struct BucketIterator {
     }
 };
 
-void printBucketInfo(const std::vector<std::vector<DarkScoreResult>>& buckets)
+// Reloads inputPath when asked to (SIGRTMIN+11) or, with pollSec > 0, when the file changed on disk.
+// The new buckets are built here, the event loop only waits for the pointer swap.
+void reloadLoop(const std::string& inputPath, int pollSec, std::unique_ptr<BucketIterator>& iterator, std::mutex& iteratorMutex)
+{
+    auto fileKey = [&inputPath]() {
+        struct stat st;
+        if (stat(inputPath.c_str(), &st) != 0) return std::string();
+        return std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+    };
+
+    std::string lastKey = fileKey();
+    while (g_running) {
+        {
+            std::unique_lock<std::mutex> lock(g_reload_mutex);
+            auto wake = [] { return !g_running || g_reload; };
+            if (pollSec > 0) g_reload_cv.wait_for(lock, std::chrono::seconds(pollSec), wake);
+            else g_reload_cv.wait(lock, wake);
+        }
+        if (!g_running) break;
+
+        bool due = g_reload.exchange(false);
+        if (!due && pollSec > 0) {
+            std::string key = fileKey();
+            due = !key.empty() && key != lastKey;
+        }
+        if (!due) continue;
+        lastKey = fileKey();
+
+        auto index = std::make_shared<ScoreIndex>();
+        if (!loadBuckets(inputPath, *index) || index->empty()) {
+            std::cerr << "Reload failed, keeping the current wallpapers" << std::endl;
+            continue;
+        }
+
+        // a wallpaper change in between moves the position, then the carry over is redone
+        for (int attempt = 0; attempt < 3; attempt++) {
+            BucketPosition position;
+            {
+                std::lock_guard<std::mutex> lock(iteratorMutex);
+                position = iterator->position();
+            }
+            auto next = std::make_unique<BucketIterator>(index, position);
+
+            std::lock_guard<std::mutex> lock(iteratorMutex);
+            if (iterator->generation != position.generation && attempt < 2) continue;
+            next->rng = iterator->rng;
+            iterator.swap(next); // the old index is unmapped when the last iterator using it is gone
+            break;
+        }
+        g_reloads++;
+        std::cout << "Reloaded " << index->size() << " wallpapers from " << inputPath << std::endl;
+    }
+}
+
+void printBucketInfo(const ScoreIndex& index)
 {
     std::cout << "Map darkness score (0=bright, 1=dark) → bucket 0-5 (0=darkest, 5=brightest)" << std::endl;
-    for (size_t i = 0; i < buckets.size(); i++) {
-        std::cout << "bucket " << i << " has " << buckets[i].size() << " images" << std::endl;
+    for (int i = 0; i < DARKNESS_BUCKETS; i++) {
+        std::cout << "bucket " << i << " has " << index.bucketSize(i) << " images" << std::endl;
     }
 }
 
-void executeWallpaperChange(const std::string& execStr, const DarkScoreResult& chosen, int hour, int bucket)
+// runner = apply in the background (loop/daemon), nullptr = wait for the command
+// file = what the command gets instead of chosen.filePath (the prefetched copy)
+void executeWallpaperChange(const std::string& execStr, const ScoreEntry& chosen, int bucket, CommandRunner* runner = nullptr,
+                            const std::string& file = "")
 {
     std::time_t now = std::time(nullptr);
-    std::cout << "[" << trim(std::string(std::ctime(&now))) << "] ";
-    std::cout << "Hour: " << hour
+    std::tm local;
+    char stamp[32];
+    localtime_r(&now, &local);
+    std::cout << "[" << trim(asctime_r(&local, stamp)) << "] ";
+    std::cout << "Hour: " << local.tm_hour
               << " | Bucket: " << bucket
               << " | Selected: " << chosen.filePath
               << " | Score: " << chosen.score << std::endl;
 
     if (!execStr.empty()) {
-        executeCommand(execStr, chosen.filePath);
+        std::string target = file.empty() ? std::string(chosen.filePath) : file;
+        if (runner) runner->run(execStr, target);
+        else executeCommand(execStr, target);
     }
 }
 
-// Check if user pressed a key
-bool checkKeyPress()
+static bool armTimer(int fd, const itimerspec& spec, int flags = 0)
+{
+    if (timerfd_settime(fd, flags, &spec, nullptr) == 0) return true;
+    std::cerr << "Error: timerfd_settime failed: " << strerror(errno) << std::endl;
+    return false;
+}
+
+static bool armTimerIn(int fd, int ms)
+{
+    itimerspec spec{};
+    ms = std::max(ms, 1); // a zero it_value would disarm it
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (long)(ms % 1000) * 1000000;
+    return armTimer(fd, spec);
+}
+
+// CANCEL_ON_SET: a clock change (NTP step, timezone switch by hand) wakes the loop up to re-evaluate
+static bool armTimerAt(int fd, std::time_t at)
 {
-    char c;
-    int n = read(STDIN_FILENO, &c, 1);
-    return n > 0;
+    itimerspec spec{};
+    spec.it_value.tv_sec = at;
+    return armTimer(fd, spec, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET);
 }
 
-// Sleep with ability to skip on keypress or signal
-void interruptibleSleep(int sleepMs, bool checkKeys = true)
+// Loop (-l) and daemon (-d) mode. One epoll set holds everything that leads to a wallpaper change:
+// the -s interval, the next bucket boundary, SIGRTMIN+10/+11 via a signalfd (blocked in main before any
+// thread exists), the control socket (`wpu next`, `wpu status`, ...) and, interactively, stdin.
+// Between changes the process doesn't run at all.
+// The wallpaper after the current one is picked right away so the prefetcher has the whole interval for it.
+int runEventLoop(const std::string& execStr, int sleepMs, bool interactive, const sigset_t& signals,
+                 std::unique_ptr<BucketIterator>& iterator, std::mutex& iteratorMutex, CommandRunner& runner, Prefetcher& prefetcher,
+                 ControlServer& control, const std::string& inputPath)
 {
-    if (checkKeys) {
-        std::cout << "Sleeping for " << (sleepMs / 1000) << "s (press any key or send signal to skip)..." << std::endl;
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int changeFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int boundaryFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    auto closeAll = [&]() {
+        for (int fd : {epollFd, signalFd, changeFd, boundaryFd}) {
+            if (fd >= 0) close(fd);
+        }
+    };
+    if (epollFd < 0 || signalFd < 0 || changeFd < 0 || boundaryFd < 0) {
+        std::cerr << "Error: could not set up the event loop: " << strerror(errno) << std::endl;
+        closeAll();
+        return 1;
     }
 
-    g_sleeping = true;
-    {
-        std::unique_lock<std::mutex> lock(g_sleep_mutex);
-        g_sleep_cv.wait_for(lock, std::chrono::milliseconds(sleepMs), [&] { return !g_sleeping; });
+    auto watch = [epollFd](int fd) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+    };
+    watch(signalFd);
+    watch(changeFd);
+    watch(boundaryFd);
+    if (control.ok()) watch(control.listenFd());
+    // a regular file or /dev/null can't be polled (EPERM), no key presses then
+    bool readStdin = interactive && watch(STDIN_FILENO);
+
+    std::time_t now = std::time(nullptr);
+    std::tm local;
+    localtime_r(&now, &local);
+    int maxBucket = getMaxBucketForHour(local.tm_hour);
+    if (!armTimerAt(boundaryFd, nextBucketBoundary(now))) {
+        closeAll();
+        return 1;
     }
-}
 
-constexpr int LOOP_SLEEP_MS = 1000 * 60 * 1; // 1 min
+    struct Pick {
+        ScoreEntry chosen; // points into index
+        int targetBucket = -1;
+        int maxBucket = -1;
+        std::shared_ptr<const ScoreIndex> index; // a reload since the pick makes it stale
+    };
+    auto pickNext = [&]() {
+        Pick pick;
+        pick.maxBucket = maxBucket;
+        pick.targetBucket = getTargetBucket(maxBucket);
+        std::lock_guard<std::mutex> lock(iteratorMutex);
+        pick.chosen = iterator->getNext(pick.targetBucket);
+        pick.index = iterator->index;
+        return pick;
+    };
+    Pick next;
+
+    bool changeNow = true;
+    int status = 0;
+
+    // what the control socket reports
+    DarkScoreResult shown; // a copy, it outlives reloads
+    int shownBucket = -1;
+    int changes = 0;
+    int requests = 0;
+    auto started = std::chrono::steady_clock::now();
+    auto nextChangeAt = started;
+    std::vector<int> waitingForNext; // `wpu next` clients, answered once the change is done
+
+    ThreadPool scorer(1); // "score" of a file that isn't in the index decodes it, off the loop
+    auto currentIndex = [&]() {
+        std::lock_guard<std::mutex> lock(iteratorMutex);
+        return iterator->index;
+    };
+    // "score" lookups, built on the first one after a (re)load
+    std::shared_ptr<const ScoreIndex> pathsIndex;
+    std::unordered_map<std::string_view, uint32_t> entryOfPath;
+    auto handleRequest = [&](const ControlRequest& request) {
+        requests++;
+        std::ostringstream body;
+        if (request.command == "next") {
+            waitingForNext.push_back(request.fd);
+            changeNow = true;
+        }
+        else if (request.command == "reload") {
+            {
+                std::lock_guard<std::mutex> lock(g_reload_mutex);
+                g_reload = true;
+            }
+            g_reload_cv.notify_all();
+            controlReply(request.fd, true, "reloading " + inputPath);
+        }
+        else if (request.command == "status") {
+            auto left = std::chrono::duration_cast<std::chrono::seconds>(nextChangeAt - std::chrono::steady_clock::now()).count();
+            body << "pid: " << getpid() << "\n"
+                 << "input: " << inputPath << "\n"
+                 << "wallpapers: " << currentIndex()->size() << "\n"
+                 << "max bucket: " << maxBucket << "\n";
+            if (shownBucket >= 0) {
+                body << "current: " << shown.filePath << "\n"
+                     << "score: " << shown.score << "\n"
+                     << "bucket: " << shownBucket << "\n";
+            }
+            if (next.targetBucket >= 0) body << "next: " << next.chosen.filePath << "\n";
+            body << "next change in: " << std::max<long long>(0, left) << "s\n";
+            controlReply(request.fd, true, body.str());
+        }
+        else if (request.command == "stats") {
+            body << "uptime: " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count() << "s\n"
+                 << "changes: " << changes << "\n"
+                 << "reloads: " << g_reloads << "\n"
+                 << "requests: " << requests << "\n";
+            {
+                std::lock_guard<std::mutex> lock(iteratorMutex);
+                for (int b = 0; b < DARKNESS_BUCKETS; b++) {
+                    body << "bucket " << b << ": " << iterator->shuffledBuckets[b].size() << " images, "
+                         << iterator->currentIndices[b] << " shown this pass\n";
+                }
+            }
+            controlReply(request.fd, true, body.str());
+        }
+        else if (request.command == "score") {
+            if (request.argument.empty()) {
+                controlReply(request.fd, false, "score needs a file");
+                return;
+            }
+            auto index = currentIndex();
+            if (index != pathsIndex) {
+                // once per loaded index, the views point into it and pathsIndex keeps it alive
+                entryOfPath.clear();
+                entryOfPath.reserve(index->size());
+                for (uint32_t i = 0; i < index->size(); i++) entryOfPath.emplace(index->path(i), i);
+                pathsIndex = index;
+            }
+            auto it = entryOfPath.find(request.argument);
+            if (it != entryOfPath.end()) {
+                body << "score: " << index->score(it->second) << "\n"
+                     << "bucket: " << getDarknessBucket(index->score(it->second)) << "\n"
+                     << "from: index\n";
+                controlReply(request.fd, true, body.str());
+                return;
+            }
+            scorer.submit([fd = request.fd, path = request.argument](int) {
+                cv::Mat image;
+                try {
+                    image = loadImage(path, DecodeOptions());
+                }
+                catch (...) {
+                }
+                if (image.empty()) {
+                    controlReply(fd, false, "could not open " + path);
+                    return;
+                }
+                double score = computeDarkness(image);
+                std::ostringstream body;
+                body << "score: " << score << "\n"
+                     << "bucket: " << getDarknessBucket(score) << "\n"
+                     << "from: decoded\n";
+                controlReply(fd, true, body.str());
+            });
+        }
+        else if (request.command == "regroup") {
+            // color groups live in wpu-grouper's feature cache, this daemon only knows darkness
+            controlReply(request.fd, false, "regroup is done by wpu-grouper --regroup");
+        }
+        else {
+            controlReply(request.fd, false, "unknown request: " + request.command + " (next, score <file>, reload, status, stats)");
+        }
+    };
+
+    while (g_running) {
+        if (changeNow) {
+            changeNow = false;
+            int delayMs = sleepMs;
+            std::string changeError;
+            try {
+                bool stale = next.targetBucket < 0 || next.maxBucket != maxBucket;
+                if (!stale) {
+                    std::lock_guard<std::mutex> lock(iteratorMutex);
+                    stale = next.index != iterator->index;
+                }
+                Pick current = stale ? pickNext() : std::move(next);
+                next = Pick();
+                std::string path(current.chosen.filePath);
+                executeWallpaperChange(execStr, current.chosen, current.targetBucket, &runner, prefetcher.take(path));
+                shown = {std::move(path), current.chosen.score};
+                shownBucket = getDarknessBucket(current.chosen.score);
+                changes++;
+
+                next = pickNext();
+                prefetcher.prepare(std::string(next.chosen.filePath));
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error in loop: " << e.what() << std::endl;
+                changeError = e.what();
+                delayMs = LOOP_RETRY_MS;
+            }
+            for (int fd : waitingForNext) {
+                if (changeError.empty()) controlReply(fd, true, shown.filePath);
+                else controlReply(fd, false, changeError);
+            }
+            waitingForNext.clear();
+
+            nextChangeAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+            if (!armTimerIn(changeFd, delayMs)) {
+                status = 1;
+                break;
+            }
+            if (readStdin) {
+                std::cout << "Sleeping for " << (sleepMs / 1000) << "s (press enter or send signal to skip, q to quit)..." << std::endl;
+            }
+        }
+
+        epoll_event events[8];
+        int ready = epoll_wait(epollFd, events, 8, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: epoll_wait failed: " << strerror(errno) << std::endl;
+            status = 1;
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            uint64_t expirations;
+
+            if (fd == changeFd) {
+                if (read(changeFd, &expirations, sizeof(expirations)) > 0) changeNow = true;
+            }
+            else if (fd == boundaryFd) {
+                // fails with ECANCELED after a clock change, re-evaluated the same way
+                (void)!read(boundaryFd, &expirations, sizeof(expirations));
+                now = std::time(nullptr);
+                localtime_r(&now, &local);
+                int bucket = getMaxBucketForHour(local.tm_hour);
+                if (bucket != maxBucket) {
+                    maxBucket = bucket;
+                    changeNow = true;
+                }
+                if (!armTimerAt(boundaryFd, nextBucketBoundary(now))) {
+                    g_running = false;
+                    status = 1;
+                }
+            }
+            else if (fd == signalFd) {
+                signalfd_siginfo info;
+                while (read(signalFd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                    int sig = (int)info.ssi_signo;
+                    if (sig == SIGRTMIN + 10) {
+                        std::cout << "Received SIGRTMIN+10! Triggering wallpaper change...\n";
+                        changeNow = true;
+                    }
+                    else if (sig == SIGRTMIN + 11) {
+                        // wpu-darkscore --watch rewrote the input, the reload thread picks it up
+                        {
+                            std::lock_guard<std::mutex> lock(g_reload_mutex);
+                            g_reload = true;
+                        }
+                        g_reload_cv.notify_all();
+                    }
+                    else {
+                        g_running = false; // SIGINT, SIGTERM
+                    }
+                }
+            }
+            else if (control.ok() && fd == control.listenFd()) {
+                control.acceptClients(epollFd);
+            }
+            else if (control.isClient(fd)) {
+                ControlRequest request;
+                if (control.readClient(fd, epollFd, request)) handleRequest(request);
+            }
+            else if (fd == STDIN_FILENO) {
+                char input[256];
+                ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                if (n <= 0) {
+                    // end of input, stays at the interval and signals from now on
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+                    readStdin = false;
+                }
+                else if (memchr(input, 'q', n)) g_running = false;
+                else changeNow = true;
+            }
+        }
+    }
+
+    for (int fd : waitingForNext) controlReply(fd, false, "stopped");
+    closeAll();
+    return status;
+}
 
 int main(int argc, char* argv[])
 {
@@ -319,20 +754,33 @@ int main(int argc, char* argv[])
        * if chosen bucket changes (hour changes)
 
     notes:
-        * You can change wallpaper on enter
+        * You can change wallpaper on enter (q + enter quits)
+        * the wallpaper also changes right away when the hour moves into another bucket
         * or by sending a signal (useful when running as a daemon (-d)) with:
-        pkill -RTMIN+10 -f wpu-darkscore-select)");
+        pkill -RTMIN+10 -f wpu-darkscore-select
+        * SIGRTMIN+11 reloads the input file (wpu-darkscore --watch sends it after every update),
+          it's also reloaded when its mtime changes (-p), wallpapers already shown stay shown
+        * with -l/-d the next wallpaper is picked ahead and read into the page cache while the current one is shown,
+          --prescale 2560x1440 also scales it down to the screen into a tmpfs copy that --exec gets instead
+        * with -l/-d it also listens on a Unix socket (--socket), `wpu next|score <file>|reload|status|stats`
+          talks to it without spawning anything or reloading the input)");
 
     program.add_argument("-i", "--input")
         .required()
-        .help("csv file that was made by bgcpl-darkscore")
-        .metavar("file.csv");
+        .help("csv file or binary index (--index) that was made by wpu-darkscore")
+        .metavar("file.csv|file.idx");
 
     program.add_argument("-e", "--exec")
         .help("pass image to a command and execute (e.g. plasma-apply-wallpaperimage)")
         .metavar("command")
         .default_value("");
 
+    program.add_argument("-T", "--exec-timeout")
+        .help("stop the --exec command if it's still running after this many seconds (0 = never)")
+        .metavar("sec")
+        .default_value(30)
+        .scan<'i', int>();
+
     program.add_argument("-d", "--daemon")
         .default_value(false)
         .implicit_value(true)
@@ -343,6 +791,24 @@ int main(int argc, char* argv[])
         .implicit_value(true)
         .help("loop logic for setting wallpapers");
 
+    program.add_argument("-p", "--poll")
+        .help("with -l/-d, reload the input when its mtime changed, checked every sec seconds (0 = only on SIGRTMIN+11)")
+        .metavar("sec")
+        .default_value(30)
+        .scan<'i', int>();
+
+    program.add_argument("--prescale")
+        .help("with -l/-d, scale the next wallpaper down to the screen ahead of time and pass the copy to --exec")
+        .metavar("WxH");
+
+    program.add_argument("--cache-dir")
+        .help("where --prescale keeps its copies (tmpfs) [default: $XDG_RUNTIME_DIR/wpu-darkscore-select]")
+        .metavar("dir");
+
+    program.add_argument("--socket")
+        .help("with -l/-d, control socket for the wpu client (\"\" = none) [default: $XDG_RUNTIME_DIR/wpu.sock]")
+        .metavar("path");
+
     program.add_argument("-s", "--sleep")
         .help("sleep ms for loop")
         .metavar("sleep_ms")
@@ -363,6 +829,18 @@ int main(int argc, char* argv[])
     bool isDaemon = program.get<bool>("daemon");
     bool isLoop = program.get<bool>("loop");
     int sleepMs = program.get<int>("sleep");
+    int pollSec = program.get<int>("poll");
+    int execTimeoutSec = program.get<int>("exec-timeout");
+    std::string cacheDir = program.present("cache-dir").value_or(defaultPrefetchDir());
+    std::string socketPath = program.present("socket").value_or(defaultControlSocket());
+
+    int prescaleWidth = 0, prescaleHeight = 0;
+    if (auto prescale = program.present("prescale")) {
+        if (!parseResolution(*prescale, prescaleWidth, prescaleHeight)) {
+            std::cout << "Invalid --prescale: " << *prescale << " (expected WxH, e.g. 2560x1440)" << std::endl;
+            return 1;
+        }
+    }
 
     try {
         inputPath = std::filesystem::canonical(inputPath).string();
@@ -372,12 +850,18 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Register handler for SIGRTMIN+10
-    struct sigaction sa{};
-    sa.sa_handler = handle_signal;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGRTMIN + 10, &sa, nullptr);
+    // SIGRTMIN+10/+11 are read from a signalfd in the event loop. Blocked before daemonizing and before any
+    // thread starts, so no thread ever takes them (they'd terminate the process by default)
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGRTMIN + 10);
+    sigaddset(&signals, SIGRTMIN + 11);
+    if (isLoop || isDaemon) {
+        // shut down cleanly, the terminal and a running --exec command are left in order
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+    }
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
     std::cout << "Running. PID: " << getpid() << "\n";
     std::cout << "Send signal with: pkill -RTMIN+10 -f darkscore-select\n";
 
@@ -387,71 +871,42 @@ int main(int argc, char* argv[])
     }
 
     // Load buckets once
-    auto buckets = loadBuckets(inputPath);
+    auto index = std::make_shared<ScoreIndex>();
+    if (!loadBuckets(inputPath, *index)) return 1;
 
-    // Check if any buckets have images
-    bool hasImages = false;
-    for (const auto& bucket : buckets) {
-        if (!bucket.empty()) {
-            hasImages = true;
-            break;
-        }
-    }
-
-    if (!hasImages) {
-        std::cerr << "Error: No valid images found in CSV file!" << std::endl;
+    if (index->empty()) {
+        std::cerr << "Error: No valid images found in " << inputPath << "!" << std::endl;
         return 1;
     }
 
     if (!isDaemon) {
-        printBucketInfo(buckets);
+        printBucketInfo(*index);
     }
 
     // Main execution logic
     if (isLoop || isDaemon) {
         // Create bucket iterator for sequential iteration
-        BucketIterator iterator(buckets);
+        auto iterator = std::make_unique<BucketIterator>(std::move(index)); // owned by the iterator, so a reload can drop it
+        std::mutex iteratorMutex;
+        CommandRunner runner(execTimeoutSec * 1000); // a slow or hung command never holds up the loop
 
-        std::thread logicThread([&]() {
-            while (g_running) {
-                try {
-                    std::time_t now = std::time(nullptr);
-                    std::tm* local = std::localtime(&now);
-                    int hour = local->tm_hour;
-                    int targetBucket = getTargetBucketForHour(hour);
+        std::thread reloadThread(reloadLoop, std::cref(inputPath), pollSec, std::ref(iterator), std::ref(iteratorMutex));
 
-                    auto chosen = iterator.getNext(targetBucket);
-                    executeWallpaperChange(execStr, chosen, hour, targetBucket);
+        Prefetcher prefetcher(prescaleWidth, prescaleHeight, cacheDir);
 
-                    // Sleep with interruption support
-                    interruptibleSleep(sleepMs, isLoop && !isDaemon);
-                }
-                catch (const std::exception& e) {
-                    std::cerr << "Error in loop: " << e.what() << std::endl;
-                    std::this_thread::sleep_for(std::chrono::seconds(2)); // Wait before retrying
-                }
-            }
-        });
+        auto control = socketPath.empty() ? std::make_unique<ControlServer>() : std::make_unique<ControlServer>(socketPath);
+        if (control->ok()) std::cout << "Listening on " << control->socketPath() << " (wpu next, wpu status, ...)" << std::endl;
 
-        if (isDaemon) {
-            logicThread.join();
-        }
-        else {
-            while (g_running) {
-                char c;
-                if (checkKeyPress(&c)) {
-                    g_sleeping = false;
-                    g_sleep_cv.notify_all();
-                }
+        int status = runEventLoop(execStr, sleepMs, isLoop && !isDaemon, signals, iterator, iteratorMutex, runner, prefetcher,
+                                  *control, inputPath);
 
-                if (c == 'q') { break; }
-            }
+        {
+            std::lock_guard<std::mutex> lock(g_reload_mutex);
+            g_running = false;
         }
-
-        g_running = false;
-        g_sleeping = false;
-        g_sleep_cv.notify_all();
-        logicThread.join();
+        g_reload_cv.notify_all();
+        reloadThread.join();
+        return status;
     }
     else {
         // Single execution mode - just pick randomly for one-time use
@@ -465,36 +920,36 @@ int main(int argc, char* argv[])
             // Find the actual bucket to use (with fallback logic)
             int chosenBucket = targetBucket;
             int offset = 0;
-            while (buckets[chosenBucket].empty() && offset < 6) {
+            while (index->bucketSize(chosenBucket) == 0 && offset < 6) {
                 offset++;
                 int up = targetBucket + offset;
                 int down = targetBucket - offset;
-                if (up < 6 && !buckets[up].empty()) {
+                if (up < 6 && index->bucketSize(up) > 0) {
                     chosenBucket = up;
                     break;
                 }
-                if (down >= 0 && !buckets[down].empty()) {
+                if (down >= 0 && index->bucketSize(down) > 0) {
                     chosenBucket = down;
                     break;
                 }
             }
 
-            if (buckets[chosenBucket].empty()) {
+            if (index->bucketSize(chosenBucket) == 0) {
                 throw std::runtime_error("No wallpapers available in any brightness bucket!");
             }
 
             // Random selection for single execution
             std::random_device rd;
             std::mt19937 gen(rd());
-            std::uniform_int_distribution<> dist(0, static_cast<int>(buckets[chosenBucket].size()) - 1);
-            const auto& chosen = buckets[chosenBucket][dist(gen)];
+            std::uniform_int_distribution<> dist(0, static_cast<int>(index->bucketSize(chosenBucket)) - 1);
+            ScoreEntry chosen = index->entry(index->bucketBegin(chosenBucket) + dist(gen));
 
             std::cout << "Current hour: " << hour << std::endl;
             std::cout << "Target bucket: " << targetBucket << " (used " << chosenBucket << ")\n";
             std::cout << "Selected wallpaper: " << chosen.filePath << "\n";
             std::cout << "Darkness score: " << chosen.score << std::endl;
 
-            executeWallpaperChange(execStr, chosen, hour, chosenBucket);
+            executeWallpaperChange(execStr, chosen, chosenBucket);
         }
         catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
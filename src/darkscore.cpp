@@ -2,191 +2,380 @@
 #include <argparse/argparse.hpp>
 #include <atomic>
 #include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <opencv2/opencv.hpp>
+#include <random>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "analysis.hpp"
 #include "debug.hpp"
+#include "features.hpp"
 #include "globals.hpp"
+#include "imageio.hpp"
+#include "opencl.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
+#include "scoreindex.hpp"
 #include "utils.hpp"
-
-struct DarkScoreResult {
-    std::string filePath;
-    double score;
-};
+#include "watch.hpp"
 
 std::vector<DarkScoreResult> results;
 std::mutex resultsMutex;
 
-double computeDarkness(const std::string& imagePath)
+// Box the image is reduced into with --reduced, mean luminance doesn't need more pixels
+constexpr int REDUCED_TARGET_SIZE = 480;
+
+// on the CPU, or batched with the other workers' images on the device with --backend opencl
+double scoreImage(const cv::Mat& img)
+{
+    ProfileScope profile(Stage::DARKNESS);
+    if (analysisBackend() != AnalysisBackend::OPENCL) return computeDarkness(img);
+
+    double score = -1.0;
+    OpenclJob job;
+    job.image = &img;
+    job.darkness = &score;
+    runOnDevice(job);
+    return score;
+}
+
+double computeDarkness(const std::string& imagePath, const DecodeOptions& decodeOptions)
 {
-    cv::Mat img = cv::imread(imagePath, cv::IMREAD_COLOR);
+    cv::Mat img = loadImage(imagePath, decodeOptions, ImageWorkspace::forThisThread());
     if (img.empty()) {
         std::cout << "Warning: could not open " << imagePath << std::endl;
         return -1.0;
     }
-    cv::Mat gray;
-    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-    cv::Scalar meanVal = cv::mean(gray);
-    double avg_brightness = meanVal[0];
-    return 1.0 - (avg_brightness / 255.0);
+    return scoreImage(img);
+}
+
+// --sample: the score is estimated from a 1/8 scale grayscale decode (for JPEGs that's just the DCT DC terms)
+// and a stratified sample of its pixels, the full decode is only done when the estimate is too close to a bucket bound.
+constexpr int SAMPLE_TARGET_SIZE = 64;   // small enough that every JPEG gets the 1/8 decode
+constexpr int SAMPLE_GRID = 16;          // strata per side
+constexpr int SAMPLE_PER_STRATUM = 4;    // pixels drawn from every stratum
+// 99.99% confidence: over a library of 100k images a 95% interval would send thousands of near-bound ones astray
+constexpr double SAMPLE_Z = 3.89;
+// The 1/8 scale decode rounds every pixel of the DC-only reconstruction (up to half a level) and gives libjpeg's Y
+// instead of cvtColor's gray of the decoded BGR (half a level again). Clipping at black and white isn't bounded,
+// which is why the buckets are very likely, not guaranteed, the same as a full decode's.
+constexpr double SAMPLE_DECODE_ERROR = 1.0 / 255.0;
+
+struct DarknessEstimate {
+    double score;
+    double interval; // half width of the confidence interval, never 0: every estimate comes from the small decode
+};
+
+DarknessEstimate estimateDarkness(const cv::Mat& img)
+{
+    ProfileScope profile(Stage::DARKNESS);
+    cv::Mat gray = img;
+    if (img.channels() != 1) {
+        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    }
+
+    int cellW = gray.cols / SAMPLE_GRID, cellH = gray.rows / SAMPLE_GRID;
+    if (cellW * cellH <= SAMPLE_PER_STRATUM) {
+        // as cheap to look at every pixel, but still the small decode: its rounding applies
+        return {computeDarkness(gray), SAMPLE_DECODE_ERROR};
+    }
+
+    // equal sized strata, estimate = mean of stratum means, variance = sum of s_h^2 / (n_h * H^2)
+    std::mt19937 rng(gray.rows * 31 + gray.cols);
+    double sum = 0.0, variance = 0.0;
+    const int strata = SAMPLE_GRID * SAMPLE_GRID;
+    for (int sy = 0; sy < SAMPLE_GRID; sy++) {
+        for (int sx = 0; sx < SAMPLE_GRID; sx++) {
+            double stratumSum = 0.0, stratumSq = 0.0;
+            for (int n = 0; n < SAMPLE_PER_STRATUM; n++) {
+                int y = sy * cellH + rng() % cellH;
+                int x = sx * cellW + rng() % cellW;
+                double v = gray.ptr<uchar>(y)[x];
+                stratumSum += v;
+                stratumSq += v * v;
+            }
+            double mean = stratumSum / SAMPLE_PER_STRATUM;
+            double s2 = (stratumSq - SAMPLE_PER_STRATUM * mean * mean) / (SAMPLE_PER_STRATUM - 1);
+            sum += mean;
+            variance += std::max(0.0, s2) / SAMPLE_PER_STRATUM;
+        }
+    }
+
+    double mean = sum / strata;
+    double stddev = std::sqrt(variance) / strata;
+    return {1.0 - mean / 255.0, SAMPLE_Z * stddev / 255.0 + SAMPLE_DECODE_ERROR};
+}
+
+bool nearBucketBound(const DarknessEstimate& estimate)
+{
+    for (double bound : DARKNESS_BUCKET_BOUNDS) {
+        if (std::abs(estimate.score - bound) <= estimate.interval) return true;
+    }
+    return false;
 }
 
-// Load existing results from CSV
-std::unordered_map<std::string, double> loadExistingResults(const std::string& csvPath)
+// One row of the output CSV. mtime/size say which version of the file the score belongs to,
+// so the next run only has to rescore files that changed.
+struct ScoreRow {
+    std::string filePath;
+    double score;
+    int64_t mtime = 0; // ns, 0 = unknown (CSV written before the columns existed)
+    uint64_t size = 0;
+};
+
+// Load existing results from CSV, in file order
+std::vector<ScoreRow> loadExistingResults(const std::string& csvPath)
 {
-    std::unordered_map<std::string, double> cache;
+    std::vector<ScoreRow> rows;
     std::ifstream inFile(csvPath);
 
     if (!inFile.is_open()) {
-        return cache;
+        return rows;
     }
 
     std::string line;
-    // Skip header
     std::getline(inFile, line);
+    bool hasFileKey = line.find("mtime") != std::string::npos; // image,darkness[,mtime,size]
 
     while (std::getline(inFile, line)) {
         if (line.empty()) continue;
 
-        size_t delimPos = line.find(CSV_DELIM);
-        if (delimPos != std::string::npos) {
-            std::string imagePath = line.substr(0, delimPos);
-            std::string scoreStr = line.substr(delimPos + 1);
-
-            try {
-                double score = std::stod(scoreStr);
-                cache[imagePath] = score;
+        try {
+            ScoreRow row;
+            if (hasFileKey) {
+                // split from the right so paths are free to contain the delimiter
+                size_t sizePos = line.rfind(CSV_DELIM);
+                size_t mtimePos = sizePos == 0 || sizePos == std::string::npos ? std::string::npos : line.rfind(CSV_DELIM, sizePos - 1);
+                size_t scorePos = mtimePos == 0 || mtimePos == std::string::npos ? std::string::npos : line.rfind(CSV_DELIM, mtimePos - 1);
+                if (scorePos == std::string::npos) continue;
+                row.filePath = line.substr(0, scorePos);
+                row.score = std::stod(line.substr(scorePos + 1, mtimePos - scorePos - 1));
+                row.mtime = std::stoll(line.substr(mtimePos + 1, sizePos - mtimePos - 1));
+                row.size = std::stoull(line.substr(sizePos + 1));
             }
-            catch (const std::exception& e) {
-                // Skip invalid lines
-                continue;
+            else {
+                size_t delimPos = line.find(CSV_DELIM);
+                if (delimPos == std::string::npos) continue;
+                row.filePath = line.substr(0, delimPos);
+                row.score = std::stod(line.substr(delimPos + 1));
             }
+            rows.push_back(std::move(row));
+        }
+        catch (const std::exception& e) {
+            // Skip invalid lines
+            continue;
         }
     }
 
-    inFile.close();
-    return cache;
+    return rows;
 }
 
-void processImages(std::vector<std::string>& images)
+// Writes to a temp file and renames it over csvPath, so a reader never sees a half written file
+bool writeResults(const std::string& csvPath, const std::vector<ScoreRow>& rows, bool verbose)
 {
-    auto startTime = std::chrono::high_resolution_clock::now();
+    std::string tmpPath = csvPath + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out.is_open()) return false;
 
-    int numThreads = std::thread::hardware_concurrency();
-    if (numThreads == 0) numThreads = 4;
+        out << "image,darkness,mtime,size\n";
+        out << std::fixed << std::setprecision(6);
+        if (verbose) std::cout << std::fixed << std::setprecision(6);
 
-    std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+        for (const auto& row : rows) {
+            if (verbose) std::cout << row.filePath << " => " << row.score << std::endl;
+            out << row.filePath << CSV_DELIM << row.score << CSV_DELIM << row.mtime << CSV_DELIM << row.size << "\n";
+        }
 
-    size_t totalImages = images.size();
-    size_t chunkSize = (totalImages + numThreads - 1) / numThreads;
-    std::atomic<int> processedImages{0};
-
-    std::vector<std::thread> threads;
-    threads.reserve(numThreads);
-    std::atomic<bool> running = true;
-
-    std::thread printThread([&running, &processedImages, &totalImages]() {
-        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-        std::chrono::steady_clock::time_point prev_time = start_time;
-        size_t prev_processed = 0;
-
-        std::vector<double> speed_samples;
-        const size_t max_samples = 10;
-        float top_speed = 0.0f;
-
-        while (running) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(300));
-            {
-                size_t current = processedImages;
-                auto now = std::chrono::steady_clock::now();
-                std::chrono::duration<double> elapsed_time = now - start_time;
-                std::chrono::duration<double> time_delta = now - prev_time;
-
-                double instant_speed = 0.0;
-                if (time_delta.count() > 0) {
-                    instant_speed = (current - prev_processed) / time_delta.count();
-                }
+        out.flush();
+        if (!out) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
 
-                if (current > prev_processed) {
-                    speed_samples.push_back(instant_speed);
-                    if (speed_samples.size() > max_samples) {
-                        speed_samples.erase(speed_samples.begin());
-                    }
-                }
+    if (std::rename(tmpPath.c_str(), csvPath.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
 
-                double avg_speed = 0.0;
-                if (!speed_samples.empty()) {
-                    double sum = 0.0;
-                    for (double speed : speed_samples) {
-                        sum += speed;
-                    }
-                    avg_speed = sum / speed_samples.size();
-                }
+struct ListedImage {
+    std::string path;
+    int64_t mtime;
+    uint64_t size;
+};
 
-                prev_time = now;
-                prev_processed = current;
+// Every image under inputPath with its mtime and size, stat'ed on the scanning threads
+std::vector<ListedImage> listImages(const std::string& inputPath)
+{
+    std::vector<ListedImage> listing;
+    std::string root = inputPath;
+    try {
+        root = std::filesystem::canonical(inputPath).string();
+    }
+    catch (const std::filesystem::filesystem_error&) {
+        return listing;
+    }
 
-                float p = static_cast<float>(current) / static_cast<float>(totalImages);
+    FeatureRecord key;
+    if (std::filesystem::is_regular_file(root)) {
+        if (statFeatureKey(root, key)) listing.push_back({root, key.mtime, key.size});
+        return listing;
+    }
 
-                std::string eta_str = "";
-                if (avg_speed > 0 && current < totalImages) {
-                    double remaining_time = (totalImages - current) / avg_speed;
-                    int eta_minutes = static_cast<int>(remaining_time / 60);
-                    int eta_seconds = static_cast<int>(remaining_time) % 60;
-                    eta_str = " ETA: " + std::to_string(eta_minutes) + "m " + std::to_string(eta_seconds) + "s";
-                }
+    std::cout << "Scanning folder: " << root << std::endl;
+    std::mutex listingMutex;
+    scanTree(root, SCAN_THREADS, [&](const std::string& path, int) {
+        FeatureRecord fileKey;
+        if (!statFeatureKey(path, fileKey)) return;
+        std::lock_guard<std::mutex> lock(listingMutex);
+        listing.push_back({path, fileKey.mtime, fileKey.size});
+    });
+    std::sort(listing.begin(), listing.end(), [](const ListedImage& a, const ListedImage& b) { return a.path < b.path; });
+    std::cout << "Found " << listing.size() << " image files." << std::endl;
+    return listing;
+}
 
-                if (avg_speed > top_speed) top_speed = avg_speed;
+void processImages(std::vector<std::string>& images, const DecodeOptions& decodeOptions, FeatureCache* cache, int requestedThreads,
+                   const PipelineConfig* pipeline, bool sample)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-                Cursor::cr();
-                std::cout << "==: " << current << "/" << totalImages << " "
-                          << std::fixed << std::setprecision(1)
-                          << p * 100 << "% (avg: " << std::setprecision(1) << avg_speed << " i/s)" << " (top: " << top_speed << " i/s)"
-                          << eta_str << "               ";
-                std::cout.flush();
-            }
+    int numThreads = resolveThreadCount(requestedThreads);
+
+    if (pipeline) {
+        std::cout << "Using pipeline with " << pipeline->readers << " readers, " << resolveThreadCount(pipeline->decoders)
+                  << " decoders and " << resolveThreadCount(pipeline->analyzers) << " analyzers." << std::endl;
+    }
+    else {
+        std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+    }
+
+    size_t totalImages = images.size();
+    Progress progress("darkscore");
+    progress.total = totalImages;
+    std::atomic<size_t>& processedImages = progress.done;
+    progress.start();
+
+    std::vector<FeatureRecord> records(cache ? totalImages : 0);
+
+    // --reduced scores are cached apart from full decode ones
+    const bool reduced = decodeOptions.reduced;
+    auto storeResult = [&processedImages, &images, &records, cache, reduced](size_t i, double score, bool fromCache) {
+        DarkScoreResult result;
+        result.filePath = images[i];
+        result.score = score;
+        if (cache && !fromCache && score >= 0) {
+            records[i].darknessOf(reduced) = score;
+            cache->store(images[i], records[i]);
         }
-        std::cout << std::endl;
-    });
+        {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            results.push_back(result);
+        }
+        ++processedImages;
+    };
 
-    auto processImageThread = [&processedImages, &images](size_t start, size_t end, int threadId) {
-        UNUSED(threadId);
-        for (size_t i = start; i < end; ++i) {
-            DarkScoreResult result;
-            result.filePath = images[i];
-            result.score = computeDarkness(images[i]);
-            {
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.push_back(result);
-            }
-            ++processedImages;
+    // true if the score came from the feature cache and the image needs no decoding
+    auto scoreFromCache = [&images, &records, &storeResult, cache, reduced](size_t i) {
+        if (!cache || !cache->lookup(images[i], records[i]) || records[i].darknessOf(reduced) < 0) return false;
+        storeResult(i, records[i].darknessOf(reduced), true);
+        return true;
+    };
+
+    DecodeOptions sampleOptions;
+    sampleOptions.reduced = true;
+    sampleOptions.grayscale = true;
+    sampleOptions.targetWidth = SAMPLE_TARGET_SIZE;
+    sampleOptions.targetHeight = SAMPLE_TARGET_SIZE;
+
+    std::atomic<int> sampledCount{0};
+    double intervalSum = 0.0, intervalMax = 0.0;
+    std::vector<size_t> refine; // too close to a bound, decoded in full once every sample's ticket is back
+
+    // --sample: keep the estimate unless it could land in the wrong bucket
+    auto scoreSampled = [&](size_t i, const cv::Mat& image) {
+        DarknessEstimate estimate = estimateDarkness(image);
+        {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            intervalSum += estimate.interval;
+            intervalMax = std::max(intervalMax, estimate.interval);
+        }
+        ++sampledCount;
+
+        if (nearBucketBound(estimate)) {
+            // not here: the sample's DecodeTicket is still held, waiting for a full size one as well could deadlock
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            refine.push_back(i);
+        }
+        else {
+            // estimates stay out of the feature cache, other tools and full runs expect full decode scores there
+            storeResult(i, estimate.score, true);
         }
     };
 
-    for (int t = 0; t < numThreads; ++t) {
-        size_t start = t * chunkSize;
-        size_t end = std::min(start + chunkSize, totalImages);
-        if (start >= totalImages) break;
-        threads.emplace_back(processImageThread, start, end, t);
+    if (pipeline) {
+        PipelineStages stages;
+        stages.wantsDecode = [&scoreFromCache](size_t i, int) { return !scoreFromCache(i); };
+        stages.analyze = [&images, &storeResult, &scoreSampled, sample](size_t i, cv::Mat& image, int) {
+            if (image.empty()) {
+                std::cout << "Warning: could not open " << images[i] << std::endl;
+                storeResult(i, -1.0, false);
+                return;
+            }
+            if (sample) {
+                scoreSampled(i, image);
+                return;
+            }
+            storeResult(i, scoreImage(image), false);
+        };
+        runImagePipeline(images, *pipeline, sample ? sampleOptions : decodeOptions, stages);
     }
+    else {
+        parallelFor(totalImages, numThreads, [&](size_t i, int) {
+            if (scoreFromCache(i)) return;
+            if (!sample) {
+                DecodeTicket ticket(images[i], decodeOptions);
+                storeResult(i, computeDarkness(images[i], decodeOptions), false);
+                return;
+            }
 
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
+            DecodeTicket ticket(images[i], sampleOptions);
+            cv::Mat image = loadImage(images[i], sampleOptions);
+            if (image.empty()) {
+                std::cout << "Warning: could not open " << images[i] << std::endl;
+                storeResult(i, -1.0, false);
+                return;
+            }
+            scoreSampled(i, image);
+        });
     }
 
-    running = false;
-    printThread.join();
+    // the full decodes --sample asked for, each under a --max-mem share sized for the full image
+    parallelFor(refine.size(), numThreads, [&](size_t k, int) {
+        size_t i = refine[k];
+        DecodeTicket ticket(images[i], decodeOptions);
+        storeResult(i, computeDarkness(images[i], decodeOptions), false);
+    });
+
+    progress.stop();
 
     auto endTime = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
@@ -195,6 +384,264 @@ void processImages(std::vector<std::string>& images)
     std::cout << "Average: " << std::fixed << std::setprecision(2)
               << (double)duration.count() / images.size() << "ms per image" << std::endl;
     std::cout << "Total files processed: " << results.size() << std::endl;
+    if (sampledCount > 0) {
+        std::cout << "Sampled: " << sampledCount << " (99.99% interval avg: +-" << std::setprecision(4)
+                  << intervalSum / sampledCount << ", max: +-" << intervalMax << "), "
+                  << refine.size() << " near a bucket bound got a full decode" << std::endl;
+    }
+}
+
+struct ScoreSettings {
+    std::string outputPath;
+    std::string indexPath; // empty = no --index
+    DecodeOptions decodeOptions;
+    std::string cachePath;
+    bool useCache = true;
+    int threads = 0;
+    const PipelineConfig* pipeline = nullptr;
+    bool sample = false;
+    bool sortDescending = false;
+    bool sortAscending = false;
+    bool verbose = false;
+};
+
+// Diffs listing against existing: unchanged rows are kept as they are, new and changed files get scored,
+// rows of files that are gone are dropped. The CSV (and index) is only rewritten if anything changed.
+// existing holds the new rows afterwards. false if the output couldn't be written.
+bool updateScores(std::vector<ScoreRow>& existing, const std::vector<ListedImage>& listing, const ScoreSettings& settings, bool& changed)
+{
+    // the listing is the only thing that touches the disk
+    std::unordered_map<std::string, size_t> existingRow;
+    existingRow.reserve(existing.size());
+    for (size_t i = 0; i < existing.size(); i++) existingRow[existing[i].filePath] = i;
+
+    std::vector<char> keep(existing.size(), 0);
+    std::vector<std::string> imagesToProcess;
+    std::unordered_map<std::string, const ListedImage*> processedKeys;
+    int cached_count = 0;
+    int changed_count = 0;
+    int new_count = 0;
+    bool rowsUpdated = false; // kept rows that got their mtime/size filled in
+
+    for (const auto& image : listing) {
+        auto it = existingRow.find(image.path);
+        if (it != existingRow.end()) {
+            ScoreRow& row = existing[it->second];
+            if (row.mtime == 0) { // from a CSV without the file key, trust it once and record the key
+                row.mtime = image.mtime;
+                row.size = image.size;
+                rowsUpdated = true;
+            }
+            if (row.mtime == image.mtime && row.size == image.size) {
+                keep[it->second] = 1;
+                cached_count++;
+                continue;
+            }
+            changed_count++;
+        }
+        else {
+            new_count++;
+        }
+        imagesToProcess.push_back(image.path);
+        processedKeys[image.path] = &image;
+    }
+
+    std::vector<ScoreRow> rows;
+    rows.reserve(existing.size() + imagesToProcess.size());
+    for (size_t i = 0; i < existing.size(); i++) {
+        if (keep[i]) rows.push_back(std::move(existing[i]));
+    }
+    int removed_count = (int)(existing.size() - rows.size()) - changed_count;
+
+    std::cout << "Images summary:" << std::endl;
+    std::cout << "  Cached: " << cached_count << std::endl;
+    std::cout << "  Changed: " << changed_count << std::endl;
+    std::cout << "  New to process: " << new_count << std::endl;
+    std::cout << "  Removed (deleted files): " << removed_count << std::endl;
+    std::cout << "  Total: " << listing.size() << std::endl;
+
+    // Process only new and changed images
+    if (!imagesToProcess.empty()) {
+        std::cout << "\nProcessing " << imagesToProcess.size() << " new images..." << std::endl;
+        FeatureCache cache(settings.cachePath);
+        bool useCache = settings.useCache;
+        if (useCache && cache.load()) {
+            std::cout << "Loaded " << cache.size() << " cached features from " << cache.filePath() << std::endl;
+        }
+
+        results.clear();
+        processImages(imagesToProcess, settings.decodeOptions, useCache ? &cache : nullptr, settings.threads,
+                      settings.pipeline, settings.sample);
+
+        if (useCache && !cache.save()) {
+            std::cout << "Could not save feature cache to " << cache.filePath() << std::endl;
+        }
+    }
+    else {
+        std::cout << "\nNo new images to process!" << std::endl;
+    }
+
+    std::vector<ScoreRow> added;
+    for (const auto& result : results) {
+        if (result.score < 0) continue;
+        const ListedImage* image = processedKeys[result.filePath];
+        added.push_back({result.filePath, result.score, image->mtime, image->size});
+    }
+
+    // Sort if requested: the kept rows are already sorted from the last run,
+    // so only the new rows get sorted and merged in
+    bool sortDescending = settings.sortDescending;
+    bool sortAscending = settings.sortAscending;
+    bool reordered = false;
+    if (sortDescending || sortAscending) {
+        auto order = [sortAscending](const ScoreRow& a, const ScoreRow& b) { return sortAscending ? a.score < b.score : a.score > b.score; };
+        if (!std::is_sorted(rows.begin(), rows.end(), order)) {
+            std::stable_sort(rows.begin(), rows.end(), order);
+            reordered = true;
+        }
+        std::stable_sort(added.begin(), added.end(), order);
+        size_t middle = rows.size();
+        rows.insert(rows.end(), std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+        std::inplace_merge(rows.begin(), rows.begin() + middle, rows.end(), order);
+    }
+    else {
+        rows.insert(rows.end(), std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+    }
+
+    // Write results, only if anything changed
+    changed = !added.empty() || removed_count > 0 || changed_count > 0 || rowsUpdated || reordered || existing.empty();
+    if (changed) {
+        if (!writeResults(settings.outputPath, rows, settings.verbose)) {
+            std::cout << "Could not write " << settings.outputPath << std::endl;
+            return false;
+        }
+        std::cout << "\nResults written to " << settings.outputPath << std::endl;
+    }
+    else {
+        std::cout << "\nNothing changed, " << settings.outputPath << " is up to date" << std::endl;
+    }
+    std::cout << "Final summary:" << std::endl;
+    std::cout << "  Total entries in CSV: " << rows.size() << std::endl;
+    std::cout << "  New entries added: " << added.size() << std::endl;
+    std::cout << "  Entries removed: " << removed_count << std::endl;
+
+    if (!settings.indexPath.empty() && (changed || !std::filesystem::exists(settings.indexPath))) {
+        std::vector<DarkScoreResult> indexed;
+        indexed.reserve(rows.size());
+        for (const auto& row : rows) indexed.push_back({row.filePath, row.score});
+        if (!writeScoreIndex(settings.indexPath, indexed)) {
+            std::cout << "Could not write index " << settings.indexPath << std::endl;
+            return false;
+        }
+        std::cout << "Index written to " << settings.indexPath << std::endl;
+    }
+
+    existing = std::move(rows);
+    return true;
+
+}
+
+// true if pid blocks (signalfd) or catches sig. Anything else would die of SIGRTMIN+11, e.g. a build from before the reload.
+static bool handlesSignal(pid_t pid, int sig)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("SigBlk:", 0) != 0 && line.rfind("SigCgt:", 0) != 0) continue;
+        uint64_t mask = std::strtoull(line.c_str() + 7, nullptr, 16);
+        if (mask & (1ULL << (sig - 1))) return true;
+    }
+    return false;
+}
+
+// Sends SIGRTMIN+11 to every running wpu-darkscore-select that handles it so it reloads its buckets
+int notifyDarkscoreSelect()
+{
+    int notified = 0;
+    DIR* proc = opendir("/proc");
+    if (!proc) return 0;
+    while (dirent* entry = readdir(proc)) {
+        pid_t pid = atoi(entry->d_name);
+        if (pid <= 0 || pid == getpid()) continue;
+
+        std::ifstream cmdline("/proc/" + std::string(entry->d_name) + "/cmdline");
+        std::string argv0;
+        if (!std::getline(cmdline, argv0, '\0')) continue;
+        if (std::filesystem::path(argv0).filename() != "wpu-darkscore-select") continue;
+        if (!handlesSignal(pid, SIGRTMIN + 11)) continue;
+        if (kill(pid, SIGRTMIN + 11) == 0) notified++;
+    }
+    closedir(proc);
+    return notified;
+}
+
+// --watch: stay resident and score images as they land, the listing is kept up to date from the
+// inotify events so nothing gets rescanned unless the kernel dropped events
+bool watchScores(std::vector<ScoreRow>& rows, const std::string& inputPath, const ScoreSettings& settings, int debounceMs)
+{
+    std::string root;
+    try {
+        root = std::filesystem::canonical(inputPath).string();
+    }
+    catch (const std::filesystem::filesystem_error&) {
+        return false;
+    }
+    if (!std::filesystem::is_directory(root)) {
+        std::cout << "--watch needs a folder as input" << std::endl;
+        return false;
+    }
+
+    TreeWatcher watcher(root);
+    if (!watcher.ok()) {
+        std::cout << "Could not watch " << root << std::endl;
+        return false;
+    }
+    std::cout << "\nWatching " << root << " for new wallpapers (Ctrl+C to stop)..." << std::endl;
+
+    WatchBatch batch;
+    while (watcher.wait(batch, debounceMs)) {
+        std::vector<ListedImage> listing;
+        if (batch.rescan) {
+            std::cout << "\nMissed some events, rescanning " << root << std::endl;
+            listing = listImages(root);
+        }
+        else {
+            std::unordered_set<std::string> dropped(batch.changed.begin(), batch.changed.end());
+            std::vector<std::string> removedFolders;
+            for (const auto& path : batch.removed) {
+                if (!path.empty() && path.back() == '/') removedFolders.push_back(path);
+                else dropped.insert(path);
+            }
+
+            auto isDropped = [&](const std::string& path) {
+                if (dropped.count(path)) return true;
+                for (const auto& folder : removedFolders) {
+                    if (path.rfind(folder, 0) == 0) return true;
+                }
+                return false;
+            };
+
+            listing.reserve(rows.size() + batch.changed.size());
+            for (const auto& row : rows) {
+                if (!isDropped(row.filePath)) listing.push_back({row.filePath, row.mtime, row.size});
+            }
+            for (const auto& path : batch.changed) {
+                FeatureRecord key;
+                if (statFeatureKey(path, key)) listing.push_back({path, key.mtime, key.size});
+            }
+            std::cout << "\n" << batch.changed.size() << " new or changed, " << batch.removed.size() << " removed" << std::endl;
+        }
+
+        bool changed = false;
+        if (!updateScores(rows, listing, settings, changed)) return false;
+        if (changed) {
+            int notified = notifyDarkscoreSelect();
+            if (notified > 0) std::cout << "Told " << notified << " wpu-darkscore-select to reload" << std::endl;
+        }
+    }
+
+    std::cout << "Stopped watching " << root << std::endl;
+    return true;
 }
 
 int main(int argc, char* argv[])
@@ -210,6 +657,26 @@ int main(int argc, char* argv[])
         .required()
         .help("Path to output CSV file");
 
+    program.add_argument("-x", "--index")
+        .metavar("file.idx")
+        .help("also write a binary index for wpu-darkscore-select (grouped by bucket and mmapped, loads instantly)");
+
+    program.add_argument("-w", "--watch")
+        .default_value(false)
+        .implicit_value(true)
+        .help("stay running and score new or changed images as they appear (inotify), wpu-darkscore-select gets told to reload");
+
+    program.add_argument("--debounce")
+        .default_value(2000)
+        .metavar("ms")
+        .scan<'i', int>()
+        .help("with --watch, wait until nothing changed for this long before scoring a batch");
+
+    program.add_argument("--verbose")
+        .default_value(false)
+        .implicit_value(true)
+        .help("print every score");
+
     program.add_argument("-s", "-sd", "--sort", "--sortd")
         .default_value(false)
         .implicit_value(true)
@@ -220,6 +687,69 @@ int main(int argc, char* argv[])
         .implicit_value(true)
         .help("Sort output by darkness score ascending order");
 
+    program.add_argument("-R", "--reduced")
+        .default_value(false)
+        .implicit_value(true)
+        .help("decode large JPEGs at 1/2, 1/4 or 1/8 scale straight to grayscale");
+
+    program.add_argument("-S", "--sample")
+        .default_value(false)
+        .implicit_value(true)
+        .help("estimate the score from a 1/8 scale decode, full decode only near a bucket bound (very likely the same buckets, much faster)");
+
+    program.add_argument("-t", "--threads")
+        .default_value(0)
+        .metavar("N")
+        .scan<'i', int>()
+        .help("number of worker threads (0 = one per core)");
+
+    program.add_argument("--max-mem")
+        .metavar("size")
+        .help("cap the memory decoded images may take together, decodes wait for room (sizes come from the file headers)");
+
+    program.add_argument("--nice")
+        .default_value(false)
+        .implicit_value(true)
+        .help("run in the background: lowest CPU and I/O priority, new decodes pause while the rest of the system keeps every core busy");
+
+    program.add_argument("-P", "--pipeline")
+        .metavar("readers:decoders:analyzers[:queue]")
+        .help("overlap disk reads, decoding and analysis with separate thread pools (0 = one per core)");
+
+    program.add_argument("--profile")
+        .default_value(false)
+        .implicit_value(true)
+        .help("print how long every stage took and write a Chrome trace (chrome://tracing) to darkscore-trace.json");
+
+    program.add_argument("--progress")
+        .default_value(std::string("auto"))
+        .metavar("mode")
+        .help("how progress is shown: tty (redrawn in place), plain (a line every 10s), json (a JSON object per second) or none, auto = tty on a terminal, plain otherwise");
+
+    program.add_argument("--metrics")
+        .metavar("file.prom")
+        .help("also write progress as a Prometheus textfile (node_exporter textfile collector), replaced every 5s");
+
+    program.add_argument("--io")
+        .default_value(std::string("imread"))
+        .metavar("backend")
+        .help("how image files are read: imread, read, mmap (decode from the page cache) or uring (batched io_uring reads in the pipeline)");
+
+    program.add_argument("--backend")
+        .default_value(std::string("cpu"))
+        .metavar("name")
+        .help("where resizing, color conversion and the darkness mean run: cpu or opencl (cv::UMat on the GPU, several images per submission, the rest stays on the CPU)");
+
+    program.add_argument("--cache")
+        .default_value(FeatureCache::defaultPath())
+        .metavar("features.db")
+        .help("feature cache shared by all wpu tools (only changed images get decoded)");
+
+    program.add_argument("--no-cache")
+        .default_value(false)
+        .implicit_value(true)
+        .help("don't read or write the feature cache");
+
     try {
         program.parse_args(argc, argv);
     }
@@ -229,108 +759,108 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    std::string inputPath = program.get<std::string>("--input");
-    std::string outputPath = program.get<std::string>("--output");
-
-    // Load existing results from CSV
-    std::unordered_map<std::string, double> cachedResults = loadExistingResults(outputPath);
-
-    int cached_count = 0;
-    int removed_count = 0;
-    int new_count = 0;
-
-    if (!cachedResults.empty()) {
-        std::cout << "Loaded " << cachedResults.size() << " cached results from " << outputPath << std::endl;
-
-        // Remove entries for files that no longer exist
-        for (auto it = cachedResults.begin(); it != cachedResults.end();) {
-            if (!std::filesystem::exists(it->first)) {
-                it = cachedResults.erase(it);
-                removed_count++;
-            }
-            else {
-                ++it;
-            }
-        }
-
-        if (removed_count > 0) {
-            std::cout << "Removed " << removed_count << " entries for non-existent files" << std::endl;
-        }
+    IoBackend io;
+    if (!parseIoBackend(program.get<std::string>("--io"), io)) {
+        std::cout << "Invalid --io: " << program.get<std::string>("--io") << std::endl;
+        return 1;
     }
+    setIoBackend(io);
 
-    // Get all images from input
-    std::vector<std::string> allImages;
-    getImages(allImages, inputPath);
-    if (allImages.empty()) {
-        std::cout << "No valid images found." << std::endl;
+    AnalysisBackend backend;
+    if (!parseAnalysisBackend(program.get<std::string>("--backend"), backend)) {
+        std::cout << "Invalid --backend: " << program.get<std::string>("--backend") << std::endl;
         return 1;
     }
+    if (!setAnalysisBackend(backend, std::min(OPENCL_BATCH_SIZE, resolveThreadCount(program.get<int>("--threads"))))) {
+        std::cout << "OpenCL is not available (no device, or OpenCV was built without it)" << std::endl;
+        return 1;
+    }
+    if (backend == AnalysisBackend::OPENCL) std::cout << "OpenCL device: " << openclDeviceName() << std::endl;
 
-    // Separate images into cached and new
-    std::vector<std::string> imagesToProcess;
-    for (const auto& imgPath : allImages) {
-        std::string absPath = std::filesystem::canonical(imgPath);
-
-        if (cachedResults.find(absPath) != cachedResults.end()) {
-            // Already cached, add to results
-            DarkScoreResult result;
-            result.filePath = absPath;
-            result.score = cachedResults[absPath];
-            results.push_back(result);
-            cached_count++;
-        }
-        else {
-            // Need to process
-            imagesToProcess.push_back(imgPath);
-            new_count++;
+    ProgressSettings progressSettings;
+    if (!parseProgressMode(program.get<std::string>("progress"), progressSettings.mode)) {
+        std::cout << "Invalid --progress: " << program.get<std::string>("progress") << std::endl;
+        return 1;
+    }
+    progressSettings.metricsPath = program.present("metrics").value_or("");
+    setProgressSettings(progressSettings);
+
+    DecodeLimits limits;
+    if (auto maxMem = program.present("--max-mem")) {
+        if (!parseByteSize(*maxMem, limits.maxBytes) || limits.maxBytes == 0) {
+            std::cout << "Invalid --max-mem: " << *maxMem << std::endl;
+            return 1;
         }
     }
+    if (program.get<bool>("--nice")) {
+        limits.yieldUnderLoad = true;
+        if (!enterIdlePriority()) std::cout << "Could not lower every priority, --nice is only partly in effect" << std::endl;
+    }
+    setDecodeLimits(limits);
 
-    std::cout << "Images summary:" << std::endl;
-    std::cout << "  Cached: " << cached_count << std::endl;
-    std::cout << "  New to process: " << new_count << std::endl;
-    std::cout << "  Removed (deleted files): " << removed_count << std::endl;
-    std::cout << "  Total: " << (cached_count + new_count) << std::endl;
+    bool profile = program.get<bool>("--profile");
+    if (profile) Profile::enable();
 
-    // Process only new images
-    if (!imagesToProcess.empty()) {
-        std::cout << "\nProcessing " << imagesToProcess.size() << " new images..." << std::endl;
-        processImages(imagesToProcess);
-    }
-    else {
-        std::cout << "\nNo new images to process!" << std::endl;
-    }
+    std::string inputPath = program.get<std::string>("--input");
+    std::string outputPath = program.get<std::string>("--output");
 
-    // Sort if requested
-    if (program.get<bool>("--sort") || program.get<bool>("--sortd")) {
-        std::sort(results.begin(), results.end(), [](auto& a, auto& b) { return a.score > b.score; });
+    PipelineConfig pipeline;
+    bool usePipeline = false;
+    if (auto spec = program.present("--pipeline")) {
+        if (!parsePipelineSpec(*spec, pipeline)) {
+            std::cout << "Invalid --pipeline spec: " << *spec << std::endl;
+            return 1;
+        }
+        usePipeline = true;
     }
 
-    if (program.get<bool>("--sorta")) {
-        std::sort(results.begin(), results.end(), [](auto& a, auto& b) { return a.score < b.score; });
-    }
+    DecodeOptions decodeOptions;
+    decodeOptions.reduced = program.get<bool>("--reduced");
+    decodeOptions.grayscale = decodeOptions.reduced; // full mode keeps the BGR2GRAY conversion
+    decodeOptions.targetWidth = REDUCED_TARGET_SIZE;
+    decodeOptions.targetHeight = REDUCED_TARGET_SIZE;
 
-    // Write results
-    if (!outputPath.empty()) {
-        std::ofstream out(outputPath);
-        out << "image,darkness\n";
+    // Load existing results from CSV
+    std::vector<ScoreRow> existing = loadExistingResults(outputPath);
+    if (!existing.empty()) {
+        std::cout << "Loaded " << existing.size() << " cached results from " << outputPath << std::endl;
+    }
 
-        std::cout << std::fixed << std::setprecision(6);
-        out << std::fixed << std::setprecision(6);
+    // Get all images from input
+    std::vector<ListedImage> listing;
+    {
+        ProfileScope scan(Stage::SCAN);
+        listing = listImages(inputPath);
+    }
+    if (listing.empty()) {
+        std::cout << "No valid images found." << std::endl;
+        return 1;
+    }
 
-        for (const auto& result : results) {
-            if (result.score >= 0) {
-                std::cout << result.filePath << " => " << result.score << std::endl;
-                out << result.filePath << CSV_DELIM << result.score << "\n";
-            }
-        }
+    ScoreSettings settings;
+    settings.outputPath = outputPath;
+    settings.indexPath = program.present("--index").value_or("");
+    settings.decodeOptions = decodeOptions;
+    settings.cachePath = program.get<std::string>("--cache");
+    settings.useCache = !program.get<bool>("--no-cache");
+    settings.threads = program.get<int>("--threads");
+    settings.pipeline = usePipeline ? &pipeline : nullptr;
+    settings.sample = program.get<bool>("--sample");
+    settings.sortDescending = program.get<bool>("--sort") || program.get<bool>("--sortd");
+    settings.sortAscending = program.get<bool>("--sorta");
+    settings.verbose = program.get<bool>("--verbose");
+
+    bool changed = false;
+    if (!updateScores(existing, listing, settings, changed)) return 1;
+
+    if (program.get<bool>("--watch")) {
+        if (changed) notifyDarkscoreSelect();
+        if (!watchScores(existing, inputPath, settings, program.get<int>("--debounce"))) return 1;
+    }
 
-        out.close();
-        std::cout << "\nResults written to " << outputPath << std::endl;
-        std::cout << "Final summary:" << std::endl;
-        std::cout << "  Total entries in CSV: " << results.size() << std::endl;
-        std::cout << "  New entries added: " << new_count << std::endl;
-        std::cout << "  Entries removed: " << removed_count << std::endl;
+    if (profile) {
+        Profile::report(std::cout);
+        if (Profile::writeTrace("darkscore-trace.json")) std::cout << "\nTrace written to darkscore-trace.json" << std::endl;
     }
 
     return 0;
@@ -0,0 +1,115 @@
+#include "dedupe.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "profile.hpp"
+
+uint64_t dHash(const cv::Mat& image)
+{
+    ProfileScope profile(Stage::HASH);
+    cv::Mat gray, small;
+    if (image.channels() == 1) gray = image;
+    else cv::cvtColor(image, gray, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    cv::resize(gray, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+    uint64_t hash = 0;
+    for (int y = 0; y < 8; y++) {
+        const uchar* row = small.ptr<uchar>(y);
+        for (int x = 0; x < 8; x++) {
+            hash = (hash << 1) | (row[x] > row[x + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+void BKTree::insert(uint64_t hash, uint32_t id)
+{
+    if (nodes.empty()) {
+        nodes.push_back({hash, id, {}});
+        return;
+    }
+
+    uint32_t current = 0;
+    while (true) {
+        int distance = hammingDistance(hash, nodes[current].hash);
+        auto& children = nodes[current].children;
+        auto child = std::find_if(children.begin(), children.end(), [distance](const auto& c) { return c.first == distance; });
+        if (child == children.end()) {
+            children.emplace_back(distance, (uint32_t)nodes.size());
+            nodes.push_back({hash, id, {}}); // children is invalid from here on
+            return;
+        }
+        current = child->second;
+    }
+}
+
+void BKTree::query(uint64_t hash, int maxDistance, std::vector<uint32_t>& found) const
+{
+    if (nodes.empty()) return;
+
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        int distance = hammingDistance(hash, node.hash);
+        if (distance <= maxDistance) found.push_back(node.id);
+        for (const auto& [edge, child] : node.children) {
+            if (edge >= distance - maxDistance && edge <= distance + maxDistance) stack.push_back(child);
+        }
+    }
+}
+
+static uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+std::vector<std::vector<uint32_t>> findDuplicateClusters(const std::vector<uint64_t>& hashes, int maxDistance, const KeepOrder& better)
+{
+    std::vector<uint32_t> parent(hashes.size());
+    std::iota(parent.begin(), parent.end(), 0);
+
+    // every pair is found once: each hash only looks at the ones inserted before it
+    BKTree tree;
+    std::vector<uint32_t> found;
+    for (uint32_t i = 0; i < hashes.size(); i++) {
+        found.clear();
+        tree.query(hashes[i], maxDistance, found);
+        for (uint32_t j : found) parent[findRoot(parent, i)] = findRoot(parent, j);
+        tree.insert(hashes[i], i);
+    }
+
+    std::unordered_map<uint32_t, size_t> componentOf;
+    std::vector<std::vector<uint32_t>> components;
+    for (uint32_t i = 0; i < hashes.size(); i++) {
+        uint32_t root = findRoot(parent, i);
+        auto [it, added] = componentOf.emplace(root, components.size());
+        if (added) components.emplace_back();
+        components[it->second].push_back(i);
+    }
+
+    // a connected component is only a candidate: the best copy left keeps everything near itself, then the next one
+    std::vector<std::vector<uint32_t>> clusters;
+    for (auto& component : components) {
+        if (component.size() < 2) continue;
+        std::stable_sort(component.begin(), component.end(), better);
+
+        std::vector<uint32_t> left = component;
+        while (left.size() >= 2) {
+            uint64_t kept = hashes[left[0]];
+            std::vector<uint32_t> cluster, rest;
+            for (uint32_t i : left) (hammingDistance(hashes[i], kept) <= maxDistance ? cluster : rest).push_back(i);
+            if (cluster.size() >= 2) clusters.push_back(std::move(cluster));
+            left = std::move(rest);
+        }
+    }
+    return clusters;
+}
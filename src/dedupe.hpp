@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// wpu-validator --dedupe: perceptual hashes of the pixels the validator decodes anyway.
+// dHash: the image shrunk to 9x8 gray, one bit per pixel that is brighter than its right neighbour.
+// It doesn't care about resolution or re-encoding, so 1080p, 1440p and 4K of one wallpaper end up a few bits apart.
+uint64_t dHash(const cv::Mat& image);
+
+inline int hammingDistance(uint64_t a, uint64_t b) { return __builtin_popcountll(a ^ b); }
+
+// BK-tree over hamming distance: a lookup only visits children whose edge is within
+// maxDistance of the distance to their parent (triangle inequality), instead of every hash.
+class BKTree {
+  public:
+    void insert(uint64_t hash, uint32_t id);
+
+    // ids of every hash within maxDistance
+    void query(uint64_t hash, int maxDistance, std::vector<uint32_t>& found) const;
+
+    size_t size() const { return nodes.size(); }
+
+  private:
+    struct Node {
+        uint64_t hash;
+        uint32_t id;
+        std::vector<std::pair<int, uint32_t>> children; // distance -> node
+    };
+    std::vector<Node> nodes;
+};
+
+// better(a, b): hashes[a] is the copy to keep rather than hashes[b]
+using KeepOrder = std::function<bool(uint32_t a, uint32_t b)>;
+
+// Groups of duplicates, every one with 2+ entries: the copy to keep first, then every other copy within
+// maxDistance of that one (in KeepOrder). Near hashes are only chained through neighbours to find candidates,
+// a copy too far from the kept one goes to another group instead, so a slow drift never ends up in one group.
+std::vector<std::vector<uint32_t>> findDuplicateClusters(const std::vector<uint64_t>& hashes, int maxDistance, const KeepOrder& better);
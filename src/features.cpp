@@ -0,0 +1,349 @@
+#include "features.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "globals.hpp"
+#include "profile.hpp"
+
+static const std::string FEATURES_MAGIC = "wpu-features ";
+constexpr int FEATURES_VERSION = 5;
+
+// Columns after the path for every file format version, so older caches stay readable
+static const std::vector<std::vector<std::string>> FEATURE_COLUMNS = {
+    {},
+    {"mtime", "size", "inode", "darkness", "valid", "width", "height", "colors"},
+    {"mtime", "size", "inode", "darkness", "valid", "validLevel", "width", "height", "colors"},
+    {"mtime", "size", "inode", "darkness", "valid", "validLevel", "width", "height", "dhash", "colors"},
+    {"mtime", "size", "inode", "darkness", "reducedDarkness", "valid", "validLevel", "width", "height", "dhash", "colors"},
+    {"mtime", "size", "inode", "darkness", "reducedDarkness", "valid", "validLevel", "width", "height", "dhash", "colors"}, // + HSV per color
+};
+
+bool statFeatureKey(const std::string& path, FeatureRecord& record)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+
+    record.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    record.size = st.st_size;
+    record.inode = st.st_ino;
+    return true;
+}
+
+std::string FeatureCache::defaultPath()
+{
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) return std::string(xdg) + "/wpu/features.db";
+
+    const char* home = std::getenv("HOME");
+    if (home && *home) return std::string(home) + "/.cache/wpu/features.db";
+
+    return "wpu-features.db";
+}
+
+FeatureCache::FeatureCache(const std::string& path) : path(path) {}
+
+// shortest text that reads back as the same double, so cached HSV groups exactly like fresh HSV
+static void appendDouble(std::string& out, double value)
+{
+    char buf[32];
+    for (int precision = 6; precision <= 17; precision++) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, value);
+        if (std::strtod(buf, nullptr) == value) break;
+    }
+    out += buf;
+}
+
+// colors: "alg:b,g,r,w,h,s,v;b,g,r,w,h,s,v/alg:..." (h,s,v only if stored)
+static std::string encodeColors(const std::map<int, std::vector<CachedColor>>& colors)
+{
+    std::string out;
+    char buf[32];
+    for (const auto& [algorithm, list] : colors) {
+        if (!out.empty()) out += '/';
+        out += std::to_string(algorithm) + ':';
+        for (size_t i = 0; i < list.size(); i++) {
+            const auto& c = list[i];
+            snprintf(buf, sizeof(buf), "%s%d,%d,%d,", i ? ";" : "", c.b, c.g, c.r);
+            out += buf;
+            appendDouble(out, c.weight);
+            if (c.hue < 0) continue;
+            for (double value : {c.hue, c.saturation, c.brightness}) {
+                out += ',';
+                appendDouble(out, value);
+            }
+        }
+    }
+    return out;
+}
+
+static std::string encodeHash(uint64_t hash)
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return buf;
+}
+
+static void decodeColors(const std::string& field, std::map<int, std::vector<CachedColor>>& colors)
+{
+    size_t pos = 0;
+    while (pos < field.size()) {
+        size_t end = field.find('/', pos);
+        if (end == std::string::npos) end = field.size();
+
+        std::string entry = field.substr(pos, end - pos);
+        size_t colon = entry.find(':');
+        if (colon != std::string::npos) {
+            int algorithm = std::atoi(entry.c_str());
+            auto& list = colors[algorithm];
+            const char* p = entry.c_str() + colon + 1;
+            while (*p) {
+                int b, g, r, n = 0;
+                double w;
+                if (sscanf(p, "%d,%d,%d,%lf%n", &b, &g, &r, &w, &n) != 4) break;
+                CachedColor color{(uint8_t)b, (uint8_t)g, (uint8_t)r, w};
+                p += n;
+                double h, s, v;
+                if (*p == ',' && sscanf(p, ",%lf,%lf,%lf%n", &h, &s, &v, &n) == 3) {
+                    color.hue = h;
+                    color.saturation = s;
+                    color.brightness = v;
+                    p += n;
+                }
+                list.push_back(color);
+                if (*p == ';') p++;
+            }
+        }
+        pos = end + 1;
+    }
+}
+
+// Reads a cache file into records. The file's format version, -1 if it can't be opened, 0 if it isn't one.
+static int readFeatureFile(const std::string& path, std::unordered_map<std::string, FeatureRecord>& records)
+{
+    std::ifstream in(path);
+    if (!in.is_open()) return -1;
+
+    std::string line;
+    int version = 0;
+    if (std::getline(in, line) && line.rfind(FEATURES_MAGIC, 0) == 0) {
+        version = std::atoi(line.c_str() + FEATURES_MAGIC.size());
+    }
+    if (version < 1 || version > FEATURES_VERSION) return 0;
+
+    const auto& columns = FEATURE_COLUMNS[version];
+    auto column = [&columns](const char* name) {
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i] == name) return (int)i;
+        }
+        return -1;
+    };
+    const int mtimeCol = column("mtime"), sizeCol = column("size"), inodeCol = column("inode");
+    const int darknessCol = column("darkness"), validCol = column("valid"), validLevelCol = column("validLevel");
+    const int widthCol = column("width"), heightCol = column("height"), colorsCol = column("colors");
+    const int dhashCol = column("dhash"), reducedDarknessCol = column("reducedDarkness");
+
+    std::vector<std::string> fields(columns.size());
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+
+        // split from the right so paths are free to contain the delimiter
+        size_t end = line.size();
+        bool ok = true;
+        for (int i = (int)columns.size() - 1; i >= 0; i--) {
+            size_t p = end == 0 ? std::string::npos : line.rfind(CSV_DELIM, end - 1);
+            if (p == std::string::npos) {
+                ok = false;
+                break;
+            }
+            fields[i] = line.substr(p + 1, end - p - 1);
+            end = p;
+        }
+        if (!ok) continue;
+
+        try {
+            FeatureRecord record;
+            record.mtime = std::stoll(fields[mtimeCol]);
+            record.size = std::stoull(fields[sizeCol]);
+            record.inode = std::stoull(fields[inodeCol]);
+            record.darkness = std::stod(fields[darknessCol]);
+            if (reducedDarknessCol >= 0) record.reducedDarkness = std::stod(fields[reducedDarknessCol]);
+            record.valid = std::stoi(fields[validCol]);
+            if (validLevelCol >= 0) record.validLevel = std::stoi(fields[validLevelCol]);
+            else if (record.valid >= 0) record.validLevel = VALIDATION_FULL; // v1 only had full decodes
+            record.width = std::stoi(fields[widthCol]);
+            record.height = std::stoi(fields[heightCol]);
+            if (dhashCol >= 0 && !fields[dhashCol].empty()) { // empty = not hashed
+                record.dhash = std::stoull(fields[dhashCol], nullptr, 16);
+                record.hasDhash = true;
+            }
+            decodeColors(fields[colorsCol], record.colors);
+            if (version < 5) {
+                record.colors.erase(HISTOGRAM_COLORS_KEY);
+                record.colors.erase(REDUCED_COLORS_KEY + HISTOGRAM_COLORS_KEY);
+            }
+            records[line.substr(0, end)] = std::move(record);
+        }
+        catch (const std::exception&) {
+            continue; // skip invalid lines
+        }
+    }
+    return version;
+}
+
+bool FeatureCache::load()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    int version = readFeatureFile(path, records);
+    if (version < 0) return false;
+    if (version == 0) {
+        std::cout << "Ignoring feature cache with unknown format: " << path << std::endl;
+        return false;
+    }
+
+    dirty = version != FEATURES_VERSION; // rewrite in the current format
+    return true;
+}
+
+// Both records describe the same file version: what only theirs knows is added to ours
+static void mergeRecord(FeatureRecord& ours, const FeatureRecord& theirs)
+{
+    if (ours.mtime != theirs.mtime || ours.size != theirs.size || ours.inode != theirs.inode) return;
+
+    if (ours.darkness < 0) ours.darkness = theirs.darkness;
+    if (ours.reducedDarkness < 0) ours.reducedDarkness = theirs.reducedDarkness;
+    if (theirs.validLevel > ours.validLevel) {
+        ours.valid = theirs.valid;
+        ours.validLevel = theirs.validLevel;
+    }
+    if (ours.width == 0) {
+        ours.width = theirs.width;
+        ours.height = theirs.height;
+    }
+    if (!ours.hasDhash && theirs.hasDhash) {
+        ours.dhash = theirs.dhash;
+        ours.hasDhash = true;
+    }
+    for (const auto& [key, list] : theirs.colors) ours.colors.emplace(key, list); // keeps ours where both have them
+}
+
+bool FeatureCache::save()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!dirty) return true;
+
+    try {
+        std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        if (!parent.empty()) std::filesystem::create_directories(parent);
+    }
+    catch (const std::filesystem::filesystem_error& ex) {
+        std::cerr << "Error creating cache folder: " << ex.what() << std::endl;
+        return false;
+    }
+
+    // other wpu tools may have saved since our load: under the lock their entries are read back and merged,
+    // what this run stored wins, everything else is taken from the file
+    int lockFd = open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd < 0) {
+        std::cerr << "Error: Could not lock feature cache " << path << std::endl;
+        return false;
+    }
+    flock(lockFd, LOCK_EX); // released by close
+    struct LockGuard {
+        int fd;
+        ~LockGuard() { close(fd); }
+    } fileLock{lockFd};
+
+    std::unordered_map<std::string, FeatureRecord> onDisk;
+    readFeatureFile(path, onDisk);
+    for (auto& [file, record] : onDisk) {
+        auto it = records.find(file);
+        if (it == records.end()) {
+            records.emplace(file, std::move(record));
+        }
+        else if (stored.count(file)) {
+            mergeRecord(it->second, record);
+        }
+        else {
+            it->second = std::move(record);
+        }
+    }
+
+    std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "Error: Could not write feature cache " << tmpPath << std::endl;
+            return false;
+        }
+
+        out << FEATURES_MAGIC << FEATURES_VERSION << "\n";
+        for (const auto& [file, r] : records) {
+            out << file << CSV_DELIM << r.mtime << CSV_DELIM << r.size << CSV_DELIM << r.inode
+                << CSV_DELIM << r.darkness << CSV_DELIM << r.reducedDarkness << CSV_DELIM << r.valid << CSV_DELIM << r.validLevel
+                << CSV_DELIM << r.width << CSV_DELIM << r.height
+                << CSV_DELIM << (r.hasDhash ? encodeHash(r.dhash) : "")
+                << CSV_DELIM << encodeColors(r.colors) << "\n";
+        }
+
+        out.flush();
+        if (!out) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    dirty = false;
+    stored.clear();
+    return true;
+}
+
+bool FeatureCache::lookup(const std::string& file, FeatureRecord& record)
+{
+    ProfileScope profile(Stage::CACHE);
+    record = FeatureRecord();
+    if (!statFeatureKey(file, record)) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = records.find(file);
+    if (it == records.end()) return false;
+
+    const FeatureRecord& cached = it->second;
+    if (cached.mtime != record.mtime || cached.size != record.size || cached.inode != record.inode) {
+        return false;
+    }
+
+    record = cached;
+    return true;
+}
+
+void FeatureCache::store(const std::string& file, const FeatureRecord& record)
+{
+    if (record.inode == 0) return; // never stat'ed
+
+    std::lock_guard<std::mutex> lock(mutex);
+    records[file] = record;
+    stored.insert(file);
+    dirty = true;
+}
+
+size_t FeatureCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return records.size();
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// How thoroughly wpu-validator checked a file (--level)
+enum ValidationLevel {
+    VALIDATION_HEADER = 0,  // magic bytes and container structure
+    VALIDATION_REDUCED = 1, // reduced resolution decode
+    VALIDATION_FULL = 2,    // full decode
+};
+
+struct CachedColor {
+    uint8_t b, g, r;
+    double weight;
+    // HSV the color was grouped by (hue 0-360, the rest 0-1), hue < 0 = not stored (caches before format 5).
+    // Kept because it isn't always the HSV of b, g, r: -a 2 colors are histogram bin centers.
+    double hue = -1.0, saturation = 0.0, brightness = 0.0;
+};
+
+// Everything the wpu tools know about one file.
+// A record is only trusted while mtime, size and inode still match the file on disk.
+struct FeatureRecord {
+    int64_t mtime = 0; // ns
+    uint64_t size = 0;
+    uint64_t inode = 0;
+
+    double darkness = -1.0;        // < 0 = not computed
+    double reducedDarkness = -1.0; // the same from a wpu-darkscore --reduced decode, which scores a little differently
+    int valid = -1;         // -1 = not checked, 0 = corrupt, 1 = valid
+    int validLevel = -1;    // ValidationLevel the verdict came from
+    int width = 0;
+    int height = 0;
+    bool hasDhash = false; // wpu-validator --dedupe
+    uint64_t dhash = 0;
+    std::map<int, std::vector<CachedColor>> colors; // dominant colors per grouper algorithm, wpu-palette at PALETTE_CACHE_KEY + k
+
+    double& darknessOf(bool reduced) { return reduced ? reducedDarkness : darkness; }
+};
+
+// wpu-palette palettes share FeatureRecord::colors with the grouper, above the algorithm numbers
+constexpr int PALETTE_CACHE_KEY = 100;
+// grouper --reduced colors are kept at this + algorithm, apart from the full decode ones
+constexpr int REDUCED_COLORS_KEY = 1000;
+// -a 2 (histogram) colors, dropped from caches before format 5: their BGR came from a wrong bin conversion
+constexpr int HISTOGRAM_COLORS_KEY = 2;
+
+bool statFeatureKey(const std::string& path, FeatureRecord& record);
+
+// On-disk feature store shared by grouper, darkscore and validator (~/.cache/wpu/features.db).
+// Keyed by canonical path, thread safe.
+class FeatureCache {
+  public:
+    static std::string defaultPath();
+
+    explicit FeatureCache(const std::string& path = defaultPath());
+
+    bool load();
+    // Merges in what other processes saved since load() (under a lock on path.lock),
+    // then writes to a temp file and renames it over the old one
+    bool save();
+
+    // Stats the file and fills record with the cached features if the file is unchanged.
+    // On a miss record holds only the fresh file identity, fill it in and store() it.
+    bool lookup(const std::string& path, FeatureRecord& record);
+    void store(const std::string& path, const FeatureRecord& record);
+
+    size_t size() const;
+    const std::string& filePath() const { return path; }
+
+  private:
+    std::string path;
+    std::unordered_map<std::string, FeatureRecord> records;
+    std::unordered_set<std::string> stored; // store()d since the last save, these win over the file
+    mutable std::mutex mutex;
+    bool dirty = false;
+};
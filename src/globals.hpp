@@ -3,3 +3,7 @@
 #define VERSION "1.1.0" 
 
 constexpr char CSV_DELIM = '|';
+
+// darkness score lower bounds of the darkscore-select buckets (very dark .. bright), everything else is very bright
+constexpr double DARKNESS_BUCKET_BOUNDS[] = {0.9, 0.8, 0.6, 0.4, 0.2};
+constexpr int DARKNESS_BUCKETS = sizeof(DARKNESS_BUCKET_BOUNDS) / sizeof(DARKNESS_BUCKET_BOUNDS[0]) + 1;
@@ -1,7 +1,13 @@
 #include <algorithm>
 #include <argparse/argparse.hpp>
 #include <atomic>
+#include <cerrno>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
 #include <csignal>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
@@ -9,30 +15,33 @@
 #include <map>
 #include <mutex>
 #include <opencv2/opencv.hpp>
+#include <sstream>
 #include <string>
+#include <sys/stat.h>
 #include <thread>
+#include <unistd.h>
 #include <vector>
 
+#include "analysis.hpp"
+#include "features.hpp"
 #include "globals.hpp"
+#include "imageio.hpp"
+#include "opencl.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
 #include "utils.hpp"
-
-enum ALGORITHM {
-    KMEANS,
-    KMEANSOPT,
-    HISTOGRAM
-};
+#include "watch.hpp"
 
 enum ACTION { NONE,
               MOVE,
-              COPY };
-
-struct ColorInfo {
-    cv::Vec3b color;
-    double weight;
-    double saturation;
-    double brightness;
-    double hue;
-};
+              COPY,
+              LINK,
+              SYMLINK,
+              REFLINK };
+
+enum PLACE_RESULT { PLACED,
+                    UP_TO_DATE,
+                    FAILED };
 
 struct ImageInfo {
     std::string path;
@@ -45,331 +54,148 @@ struct ImageInfo {
 
 std::vector<ImageInfo> images;
 
-// Predefined color groups with representative colors (HSV ranges)
-struct ColorGroup {
-    std::string name;
-    float hueMin, hueMax;
-    float satMin, satMax;
-    float brightMin, brightMax;
-    cv::Vec3b representativeColor;
-    int counter = 0;
-};
-
-std::vector<ColorGroup> colorGroups = {
-    {"Miscellaneous", 0, 0, 0.0f, 0.0f, 0.0f, 0.0f, cv::Vec3b(0, 0, 0)},
-    {"Blue_Cool", 200, 260, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(255, 100, 50)},
-    {"Red_Warm", 340, 20, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(50, 50, 255)},
-    {"Green_Nature", 80, 140, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(50, 255, 100)},
-    {"Orange_Sunset", 20, 50, 0.4f, 1.0f, 0.4f, 1.0f, cv::Vec3b(50, 165, 255)},
-    {"Purple_Mystical", 260, 300, 0.3f, 1.0f, 0.3f, 1.0f, cv::Vec3b(255, 50, 200)},
-    {"Yellow_Bright", 50, 80, 0.4f, 1.0f, 0.5f, 1.0f, cv::Vec3b(50, 255, 255)},
-    {"Pink_Soft", 300, 340, 0.3f, 1.0f, 0.4f, 1.0f, cv::Vec3b(200, 100, 255)},
-    {"Cyan_Tech", 160, 200, 0.4f, 1.0f, 0.4f, 1.0f, cv::Vec3b(255, 200, 100)},
-    {"Dark_Moody", 0, 360, 0.0f, 1.0f, 0.0f, 0.25f, cv::Vec3b(40, 40, 40)},
-    {"Light_Minimal", 0, 360, 0.0f, 0.3f, 0.8f, 1.0f, cv::Vec3b(240, 240, 240)},
-    {"Monochrome", 0, 360, 0.0f, 0.15f, 0.25f, 0.8f, cv::Vec3b(128, 128, 128)},
-    {"Earth_Tones", 25, 45, 0.2f, 0.7f, 0.3f, 0.7f, cv::Vec3b(100, 150, 200)}};
-
 std::mutex coutMutex;
 std::mutex processMutex;
 
-void calculateColorProperties(ColorInfo& colorInfo)
-{
-    cv::Mat bgrPixel(1, 1, CV_8UC3, cv::Scalar(colorInfo.color[0], colorInfo.color[1], colorInfo.color[2]));
-    cv::Mat hsvPixel;
-    cv::cvtColor(bgrPixel, hsvPixel, cv::COLOR_BGR2HSV);
-
-    cv::Vec3b hsv = hsvPixel.at<cv::Vec3b>(0, 0);
-    colorInfo.hue = hsv[0] * 2.0;
-    colorInfo.saturation = hsv[1] / 255.0;
-    colorInfo.brightness = hsv[2] / 255.0;
-}
-
-std::vector<ColorInfo> extractDominantColorsHistogram(const cv::Mat& image, int k = 5)
+void assignImageToGroup(ImageInfo& imageInfo)
 {
-    cv::Mat hsv;
-    cv::cvtColor(image, hsv, cv::COLOR_BGR2HSV);
-
-    // Create histogram
-    int hbins = 36, sbins = 16, vbins = 16; // Reasonable resolution
-    int histSize[] = {hbins, sbins, vbins};
-    float hranges[] = {0, 180};
-    float sranges[] = {0, 256};
-    float vranges[] = {0, 256};
-    const float* ranges[] = {hranges, sranges, vranges};
-    int channels[] = {0, 1, 2};
-
-    cv::Mat hist;
-    cv::calcHist(&hsv, 1, channels, cv::Mat(), hist, 3, histSize, ranges);
-
-    // Find dominant colors by finding histogram peaks
-    std::vector<ColorInfo> colors;
-    std::vector<std::tuple<int, int, int, float>> peaks;
-
-    // Extract all non-zero histogram bins
-    for (int h = 0; h < hbins; h++) {
-        for (int s = 0; s < sbins; s++) {
-            for (int v = 0; v < vbins; v++) {
-                float count = hist.at<float>(h, s, v);
-                if (count > 0) {
-                    peaks.emplace_back(h, s, v, count);
-                }
-            }
-        }
-    }
-
-    // Sort by count (descending)
-    std::sort(peaks.begin(), peaks.end(),
-              [](const auto& a, const auto& b) {
-                  return std::get<3>(a) > std::get<3>(b);
-              });
-
-    // Take top k peaks
-    int totalPixels = image.rows * image.cols;
-    int numColors = std::min(k, static_cast<int>(peaks.size()));
-
-    for (int i = 0; i < numColors; i++) {
-        auto [h_idx, s_idx, v_idx, count] = peaks[i];
-
-        // Convert histogram indices back to HSV values
-        float hue = (h_idx + 0.5f) * 180.0f / hbins;
-        float sat = (s_idx + 0.5f) * 256.0f / sbins;
-        float val = (v_idx + 0.5f) * 256.0f / vbins;
-
-        // Convert HSV to BGR
-        cv::Mat hsvPixel(1, 1, CV_32FC3, cv::Scalar(hue, sat, val));
-        cv::Mat bgrPixel;
-        cv::cvtColor(hsvPixel, bgrPixel, cv::COLOR_HSV2BGR);
-
-        cv::Vec3f bgr = bgrPixel.at<cv::Vec3f>(0, 0);
+    ProfileScope profile(Stage::GROUP);
+    double bestScore = 0.0;
+    int bestGroupId = findBestGroup(imageInfo.dominantColors, bestScore);
+    std::string bestGroupName = colorGroups[bestGroupId].name;
 
-        ColorInfo colorInfo;
-        colorInfo.color = cv::Vec3b(
-            static_cast<uchar>(std::clamp(bgr[0], 0.0f, 255.0f)),
-            static_cast<uchar>(std::clamp(bgr[1], 0.0f, 255.0f)),
-            static_cast<uchar>(std::clamp(bgr[2], 0.0f, 255.0f)));
-        colorInfo.weight = count / totalPixels;
-        colorInfo.hue = hue * 2.0; // Convert to 0-360 range
-        colorInfo.saturation = sat / 255.0;
-        colorInfo.brightness = val / 255.0;
+    imageInfo.assignedGroupId = bestGroupId;
+    imageInfo.assignedGroup = bestGroupName;
+    imageInfo.groupScore = bestScore;
 
-        colors.push_back(colorInfo);
+    // If no group has a good score, assign to miscellaneous
+    if (bestScore < 0.3) {
+        bestGroupId = 0;
+        imageInfo.assignedGroupId = bestGroupId;
+        imageInfo.assignedGroup = colorGroups[bestGroupId].name;
     }
 
-    return colors;
+    {
+        std::lock_guard<std::mutex> lock(processMutex);
+        colorGroups[bestGroupId].counter++;
+    }
 }
 
-std::vector<ColorInfo> extractDominantColorsKmeansOpt(const cv::Mat& image, int k = 5)
+// true if the image was grouped from cached colors and needs no decoding
+bool groupFromCache(ImageInfo& imageInfo, int cacheKey, FeatureRecord& record, FeatureCache* cache)
 {
-    // Reduce image size for faster processing
-    cv::Mat smallImage;
-    int maxDim = 150; // Much smaller than 800x600
-    if (image.rows > maxDim || image.cols > maxDim) {
-        double scale = std::min((double)maxDim / image.rows, (double)maxDim / image.cols);
-        cv::resize(image, smallImage, cv::Size(), scale, scale);
-    }
-    else {
-        smallImage = image;
-    }
-
-    // Direct conversion to float data without reshaping
-    int totalPixels = smallImage.rows * smallImage.cols;
-    cv::Mat data(totalPixels, 3, CV_32F);
-
-    // Manually copy pixel data to avoid reshape overhead
-    const cv::Vec3b* srcPtr = smallImage.ptr<cv::Vec3b>();
-    float* dstPtr = data.ptr<float>();
-
-    for (int i = 0; i < totalPixels; i++) {
-        dstPtr[i * 3 + 0] = srcPtr[i][0]; // B
-        dstPtr[i * 3 + 1] = srcPtr[i][1]; // G
-        dstPtr[i * 3 + 2] = srcPtr[i][2]; // R
-    }
+    if (!cache || !cache->lookup(imageInfo.path, record)) return false;
 
-    cv::Mat labels, centers;
-    cv::kmeans(data, k, labels,
-               cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 1.0), // Reduced iterations
-               1, cv::KMEANS_PP_CENTERS, centers);                                         // Reduced attempts
-
-    std::vector<int> counts(k, 0);
-    for (int i = 0; i < labels.rows; i++) {
-        counts[labels.at<int>(i)]++;
-    }
-
-    std::vector<ColorInfo> colors;
-
-    for (int i = 0; i < k; i++) {
-        ColorInfo colorInfo;
-        colorInfo.color = cv::Vec3b(
-            static_cast<uchar>(std::clamp(centers.at<float>(i, 0), 0.0f, 255.0f)),
-            static_cast<uchar>(std::clamp(centers.at<float>(i, 1), 0.0f, 255.0f)),
-            static_cast<uchar>(std::clamp(centers.at<float>(i, 2), 0.0f, 255.0f)));
-        colorInfo.weight = (double)counts[i] / totalPixels;
-        calculateColorProperties(colorInfo);
-        colors.push_back(colorInfo);
-    }
+    auto it = record.colors.find(cacheKey);
+    if (it == record.colors.end() || it->second.empty()) return false;
 
-    std::sort(colors.begin(), colors.end(),
-              [](const ColorInfo& a, const ColorInfo& b) {
-                  return a.weight > b.weight;
-              });
-
-    return colors;
+    imageInfo.dominantColors = fromCachedColors(it->second);
+    assignImageToGroup(imageInfo);
+    return true;
 }
-std::vector<ColorInfo> extractDominantColorsKmeans(const cv::Mat& image, int k = 5)
-{
-    cv::Mat data = image.reshape(1, image.rows * image.cols);
-    data.convertTo(data, CV_32F);
-
-    cv::Mat labels, centers;
-    cv::kmeans(data, k, labels,
-               cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 20, 1.0),
-               3, cv::KMEANS_PP_CENTERS, centers);
-
-    std::vector<int> counts(k, 0);
-    for (int i = 0; i < labels.rows; i++) {
-        counts[labels.at<int>(i)]++;
-    }
 
-    std::vector<ColorInfo> colors;
-    int totalPixels = image.rows * image.cols;
-
-    for (int i = 0; i < k; i++) {
-        ColorInfo colorInfo;
-        colorInfo.color = cv::Vec3b(
-            static_cast<uchar>(centers.at<float>(i, 0)),
-            static_cast<uchar>(centers.at<float>(i, 1)),
-            static_cast<uchar>(centers.at<float>(i, 2)));
-        colorInfo.weight = (double)counts[i] / totalPixels;
-        calculateColorProperties(colorInfo);
-        colors.push_back(colorInfo);
+// cache the colors analyzeImage found and assign the group
+bool storeColors(ImageInfo& imageInfo, int cacheKey, FeatureRecord& record, FeatureCache* cache)
+{
+    if (cache) {
+        record.colors[cacheKey] = toCachedColors(imageInfo.dominantColors);
+        cache->store(imageInfo.path, record);
     }
 
-    std::sort(colors.begin(), colors.end(),
-              [](const ColorInfo& a, const ColorInfo& b) {
-                  return a.weight > b.weight;
-              });
-
-    return colors;
+    assignImageToGroup(imageInfo);
+    return true;
 }
 
-double calculateGroupScore(const std::vector<ColorInfo>& colors, const ColorGroup& group)
+// resize, extract the dominant colors, cache them (under cacheKey, see colorsCacheKey) and assign the group
+bool analyzeImage(ImageInfo& imageInfo, cv::Mat& image, ALGORITHM algorithm, int cacheKey, FeatureRecord& record, FeatureCache* cache,
+                  int threadId)
 {
-    double score = 0.0;
-    double totalWeight = 0.0;
-
-    for (const auto& color : colors) {
-        double colorScore = 0.0;
+    if (image.empty()) {
+        std::lock_guard<std::mutex> lock(coutMutex);
+        std::cerr << "[Thread " << threadId << "] Could not load: " << imageInfo.path << std::endl;
+        return false;
+    }
 
-        // Check hue match (handle wraparound for red)
-        bool hueMatch = false;
-        if (group.hueMin > group.hueMax) { // wraparound case (red)
-            hueMatch = (color.hue >= group.hueMin || color.hue <= group.hueMax);
-        }
-        else {
-            hueMatch = (color.hue >= group.hueMin && color.hue <= group.hueMax);
+    // --backend opencl: shrink (or convert to HSV for the histogram) on the device, batched with the other workers
+    if (analysisBackend() == AnalysisBackend::OPENCL && image.channels() == 3) {
+        ImageWorkspace& workspace = ImageWorkspace::forThisThread();
+        cv::Mat converted;
+        OpenclJob job;
+        job.image = &image;
+        if (algorithm == HISTOGRAM) {
+            converted = ImageWorkspace::view(workspace.hsv, image.rows, image.cols, CV_8UC3);
+            job.hsv = &converted;
         }
-
-        if (hueMatch &&
-            color.saturation >= group.satMin && color.saturation <= group.satMax &&
-            color.brightness >= group.brightMin && color.brightness <= group.brightMax) {
-            colorScore = 1.0;
+        else if (image.cols > 800 || image.rows > 600) {
+            job.scale = std::min(800.0 / image.cols, 600.0 / image.rows);
+            cv::Size size = scaledSize(image, job.scale);
+            converted = ImageWorkspace::view(workspace.shrunk, size.height, size.width, image.type());
+            job.shrunk = &converted;
         }
-        else {
-            // Partial scoring for near matches
-            double hueDist = 0.0;
-            if (group.hueMin > group.hueMax) {
-                hueDist = std::min({std::abs(color.hue - group.hueMin),
-                                    std::abs(color.hue - group.hueMax),
-                                    std::abs(color.hue - (group.hueMin - 360)),
-                                    std::abs(color.hue - (group.hueMax + 360))}) /
-                          180.0;
-            }
-            else {
-                hueDist = std::min(std::abs(color.hue - group.hueMin),
-                                   std::abs(color.hue - group.hueMax)) /
-                          180.0;
+        if (job.hsv || job.shrunk) {
+            {
+                ProfileScope profile(Stage::RESIZE);
+                runOnDevice(job);
             }
-
-            double satDist = std::max(0.0, std::max(group.satMin - color.saturation,
-                                                    color.saturation - group.satMax));
-            double brightDist = std::max(0.0, std::max(group.brightMin - color.brightness,
-                                                       color.brightness - group.brightMax));
-
-            colorScore = std::max(0.0, 1.0 - (hueDist + satDist + brightDist) / 3.0);
+            ProfileScope profile(Stage::COLORS);
+            imageInfo.dominantColors = job.hsv ? extractDominantColorsHistogramOfHsv(converted) : extractDominantColors(converted, algorithm);
+            return storeColors(imageInfo, cacheKey, record, cache);
         }
-
-        score += colorScore * color.weight;
-        totalWeight += color.weight;
     }
 
-    return totalWeight > 0 ? score / totalWeight : 0.0;
-}
-
-void assignImageToGroup(ImageInfo& imageInfo)
-{
-    double bestScore = 0.0;
-    int bestGroupId = 0;
-    std::string bestGroupName = colorGroups[bestGroupId].name;
-
-    for (size_t i = 1; i < colorGroups.size(); i++) {
-        double score = calculateGroupScore(imageInfo.dominantColors, colorGroups[i]);
-        if (score > bestScore) {
-            bestScore = score;
-            bestGroupId = i;
-            bestGroupName = colorGroups[i].name;
-        }
-    }
-
-    imageInfo.assignedGroupId = bestGroupId;
-    imageInfo.assignedGroup = bestGroupName;
-    imageInfo.groupScore = bestScore;
-
-    // If no group has a good score, assign to miscellaneous
-    if (bestScore < 0.3) {
-        bestGroupId = 0;
-        imageInfo.assignedGroupId = bestGroupId;
-        imageInfo.assignedGroup = colorGroups[bestGroupId].name;
+    // the histogram is a single pass over the pixels, shrinking first would cost about as much
+    if (algorithm != HISTOGRAM && (image.cols > 800 || image.rows > 600)) {
+        ProfileScope profile(Stage::RESIZE);
+        double scale = std::min(800.0 / image.cols, 600.0 / image.rows);
+        cv::Size size = scaledSize(image, scale);
+        cv::Mat shrunk = ImageWorkspace::view(ImageWorkspace::forThisThread().shrunk, size.height, size.width, image.type());
+        cv::resize(image, shrunk, cv::Size(), scale, scale);
+        image = shrunk;
     }
 
     {
-        colorGroups[bestGroupId].counter++;
-        std::lock_guard<std::mutex> lock(processMutex);
+        ProfileScope profile(Stage::COLORS);
+        imageInfo.dominantColors = extractDominantColors(image, algorithm);
     }
+
+    return storeColors(imageInfo, cacheKey, record, cache);
 }
 
-size_t scanFolderMakeStructs(const std::string& folderPath)
+size_t scanFolderMakeStructs(const std::string& inputFolder)
 {
-    std::cout << "Scanning folder: " << folderPath << std::endl;
+    ProfileScope profile(Stage::SCAN);
+    std::cout << "Scanning folder: " << inputFolder << std::endl;
 
-    if (!fs_exists(folderPath)) {
-        std::cerr << "Error scanning folder: " << folderPath << std::endl;
+    if (!fs_exists(inputFolder)) {
+        std::cerr << "Error scanning folder: " << inputFolder << std::endl;
         return 0;
     }
 
+    std::vector<std::string> paths;
     try {
-        size_t files = 0;
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(folderPath)) {
-            if (entry.is_regular_file() && isSupportedFormat(entry.path().filename().string())) {
-                files++;
-            }
-        }
-        images.reserve(files);
-
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(folderPath)) {
-            if (entry.is_regular_file() && isSupportedFormat(entry.path().filename().string())) {
-                ImageInfo imgInfo;
-                imgInfo.path = entry.path().string();
-                imgInfo.filename = entry.path().filename().string();
-                images.push_back(imgInfo);
-            }
-        }
+        // canonical root, so paths can be used as feature cache keys
+        std::string folderPath = std::filesystem::canonical(inputFolder).string();
+
+        std::mutex pathsMutex;
+        scanTree(folderPath, SCAN_THREADS, [&](const std::string& path, int) {
+            std::lock_guard<std::mutex> lock(pathsMutex);
+            paths.push_back(path);
+        });
     }
     catch (const std::filesystem::filesystem_error& ex) {
         std::cerr << "Error scanning folder: " << ex.what() << std::endl;
         return 0;
     }
 
+    std::sort(paths.begin(), paths.end()); // same order every run
+    images.reserve(paths.size());
+    for (auto& path : paths) {
+        ImageInfo imgInfo;
+        imgInfo.filename = std::filesystem::path(path).filename().string();
+        imgInfo.path = std::move(path);
+        images.push_back(std::move(imgInfo));
+    }
+
     int totalCount = images.size();
     std::cout << "Found " << totalCount << " image files." << std::endl;
 
@@ -380,147 +206,176 @@ size_t scanFolderMakeStructs(const std::string& folderPath)
     return totalCount;
 }
 
-void processImages(const std::string& inputFolder, ALGORITHM algorithm)
+// groups.conf: one group per line, name|hueMin|hueMax|satMin|satMax|brightMin|brightMax
+// hue 0-360 (wraps around when min > max), saturation and brightness 0-1, # starts a comment.
+// Miscellaneous is always group 0 and catches images no group scores for.
+std::string defaultGroupsPath()
 {
-    auto startTime = std::chrono::high_resolution_clock::now();
+    const char* xdg = std::getenv("XDG_CONFIG_HOME");
+    if (xdg && *xdg) return std::string(xdg) + "/wpu/groups.conf";
 
-    size_t count = scanFolderMakeStructs(inputFolder);
-    if (!(count > 0)) { exit(1); }
+    const char* home = std::getenv("HOME");
+    if (home && *home) return std::string(home) + "/.config/wpu/groups.conf";
 
-    int numThreads = std::thread::hardware_concurrency();
-    if (numThreads == 0) numThreads = 4; // Fallback in case detection fails
-
-    std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+    return "groups.conf";
+}
 
-    size_t totalImages = images.size();
-    size_t chunkSize = (totalImages + numThreads - 1) / numThreads;
-    std::atomic<int> processedImages{0};
+bool loadColorGroups(const std::string& path, std::vector<ColorGroup>& groups)
+{
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cout << "Could not open groups file: " << path << std::endl;
+        return false;
+    }
 
-    std::vector<std::thread> threads;
-    threads.reserve(numThreads);
-    std::atomic<bool> running = true;
+    groups.clear();
+    groups.push_back(colorGroups[0]); // Miscellaneous
 
-    Cursor::hide();
-    Cursor::termClear();
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); lineNumber++) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
 
-    std::thread printThread([&running, &processedImages, &totalImages]() {
-        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-        std::chrono::steady_clock::time_point prev_time = start_time;
-        size_t prev_processed = 0;
+        auto fail = [&](const std::string& message) {
+            std::cout << path << ":" << lineNumber << ": " << message << std::endl;
+            return false;
+        };
 
-        // Moving average for i/s calculation
-        std::vector<double> speed_samples;
-        const size_t max_samples = 10; // Average over last 10 samples
-        float top_speed = 0.0f;
+        std::vector<std::string> fields = csv_split(line, CSV_DELIM);
+        if (fields.size() != 7) return fail("expected name|hueMin|hueMax|satMin|satMax|brightMin|brightMax");
 
-        while (running) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(300));
-            {
-                std::lock_guard<std::mutex> lock(coutMutex);
-                Cursor::reset();
+        ColorGroup group;
+        group.name = trim(fields[0]);
+        if (group.name.empty() || group.name.find('/') != std::string::npos || group.name == "." || group.name == "..") {
+            return fail("group names become folder names, \"" + group.name + "\" can't be one");
+        }
+        if (group.name == colorGroups[0].name) return fail(group.name + " is built in");
+        for (const auto& other : groups) {
+            if (other.name == group.name) return fail("duplicate group " + group.name);
+        }
 
-                for (size_t i = 0; i < colorGroups.size(); i++) {
-                    std::cout << colorGroups[i].name << "\t:\t" << colorGroups[i].counter << std::endl;
-                }
+        float values[6];
+        try {
+            for (int i = 0; i < 6; i++) {
+                size_t used = 0;
+                std::string field = trim(fields[i + 1]);
+                values[i] = std::stof(field, &used);
+                if (used != field.size()) throw std::invalid_argument(field);
+            }
+        }
+        catch (const std::exception&) {
+            return fail("not a number");
+        }
 
-                size_t current = processedImages;
-                auto now = std::chrono::steady_clock::now();
-                std::chrono::duration<double> elapsed_time = now - start_time;
-                std::chrono::duration<double> time_delta = now - prev_time;
+        group.hueMin = values[0];
+        group.hueMax = values[1];
+        group.satMin = values[2];
+        group.satMax = values[3];
+        group.brightMin = values[4];
+        group.brightMax = values[5];
+        if (group.hueMin < 0 || group.hueMin > 360 || group.hueMax < 0 || group.hueMax > 360) return fail("hue has to be within 0-360");
+        for (int i = 2; i < 6; i++) {
+            if (values[i] < 0 || values[i] > 1) return fail("saturation and brightness have to be within 0-1");
+        }
+        if (group.satMin > group.satMax || group.brightMin > group.brightMax) return fail("min is above max");
 
-                // Calculate instantaneous speed
-                double instant_speed = 0.0;
-                if (time_delta.count() > 0) {
-                    instant_speed = (current - prev_processed) / time_delta.count();
-                }
+        groups.push_back(group);
+    }
 
-                // Add to moving average (only if we processed some images)
-                if (current > prev_processed) {
-                    speed_samples.push_back(instant_speed);
-                    if (speed_samples.size() > max_samples) {
-                        speed_samples.erase(speed_samples.begin());
-                    }
-                }
+    if (groups.size() < 2) {
+        std::cout << "No groups in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
 
-                // Calculate averaged speed
-                double avg_speed = 0.0;
-                if (!speed_samples.empty()) {
-                    double sum = 0.0;
-                    for (double speed : speed_samples) {
-                        sum += speed;
-                    }
-                    avg_speed = sum / speed_samples.size();
-                }
+void printColorGroups(std::ostream& out)
+{
+    out << "# name|hueMin|hueMax|satMin|satMax|brightMin|brightMax\n";
+    out << "# hue 0-360 (wraps around when min > max), saturation and brightness 0-1\n";
+    for (size_t i = 1; i < colorGroups.size(); i++) {
+        const ColorGroup& g = colorGroups[i];
+        out << g.name << CSV_DELIM << g.hueMin << CSV_DELIM << g.hueMax << CSV_DELIM << g.satMin << CSV_DELIM << g.satMax
+            << CSV_DELIM << g.brightMin << CSV_DELIM << g.brightMax << "\n";
+    }
+}
 
-                prev_time = now;
-                prev_processed = current;
+// regroup = only images with cached colors are grouped, nothing is decoded
+void processImages(const std::string& inputFolder, ALGORITHM algorithm, const DecodeOptions& decodeOptions, FeatureCache* cache, int requestedThreads,
+                   const PipelineConfig* pipeline, bool regroup)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-                std::cout << std::endl;
-                float p = static_cast<float>(current) / static_cast<float>(totalImages);
+    size_t count = scanFolderMakeStructs(inputFolder);
+    if (!(count > 0)) { exit(1); }
 
-                // Calculate ETA
-                std::string eta_str = "";
-                if (avg_speed > 0 && current < totalImages) {
-                    double remaining_time = (totalImages - current) / avg_speed;
-                    int eta_minutes = static_cast<int>(remaining_time / 60);
-                    int eta_seconds = static_cast<int>(remaining_time) % 60;
-                    eta_str = " ETA: " + std::to_string(eta_minutes) + "m " + std::to_string(eta_seconds) + "s";
-                }
+    int numThreads = resolveThreadCount(requestedThreads);
 
-                if (avg_speed > top_speed) top_speed = avg_speed;
+    if (regroup) {
+        std::cout << "Regrouping cached colors with " << numThreads << " threads, nothing is decoded." << std::endl;
+    }
+    else if (pipeline) {
+        std::cout << "Using pipeline with " << pipeline->readers << " readers, " << resolveThreadCount(pipeline->decoders)
+                  << " decoders and " << resolveThreadCount(pipeline->analyzers) << " analyzers." << std::endl;
+    }
+    else {
+        std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+    }
 
-                std::cout << "==: " << current << "/" << totalImages << "  "
-                          << std::fixed << std::setprecision(1)
-                          << p * 100 << "% (avg: " << std::setprecision(1) << avg_speed << " i/s)" << " (top: " << top_speed << " i/s)"
-                          << eta_str << "               " << std::endl;
-            }
+    size_t totalImages = images.size();
+    Progress progress("grouper");
+    progress.total = totalImages;
+    std::atomic<size_t>& processedImages = progress.done;
+    std::atomic<int> uncachedImages{0};
+
+    // the group counters above the progress line
+    progress.setTtyHeader([]() {
+        for (size_t i = 0; i < colorGroups.size(); i++) {
+            std::cout << colorGroups[i].name << "\t:\t" << colorGroups[i].counter << std::endl;
         }
-        std::cout << std::endl;
-    });
+    }, &coutMutex);
+    progress.start();
 
-    auto processImageThread = [&processedImages, &algorithm](size_t start, size_t end, int threadId) {
-        for (size_t i = start; i < end; ++i) {
-            auto& imageInfo = images[i];
+    std::vector<FeatureRecord> records(totalImages);
 
-            cv::Mat image = cv::imread(imageInfo.path);
-            if (image.empty()) {
-                std::lock_guard<std::mutex> lock(coutMutex);
-                std::cerr << "[Thread " << threadId << "] Could not load: " << imageInfo.path << std::endl;
-                continue;
-            }
-
-            if (image.cols > 800 || image.rows > 600) {
-                double scale = std::min(800.0 / image.cols, 600.0 / image.rows);
-                cv::resize(image, image, cv::Size(), scale, scale);
-            }
-
-            switch (algorithm) {
-                case KMEANS:    imageInfo.dominantColors = extractDominantColorsKmeans(image); break;
-                case KMEANSOPT: imageInfo.dominantColors = extractDominantColorsKmeansOpt(image); break;
-                case HISTOGRAM: imageInfo.dominantColors = extractDominantColorsHistogram(image); break;
-            }
+    const int cacheKey = colorsCacheKey(algorithm, decodeOptions.reduced);
+    auto cached = [&processedImages, cacheKey, &records, cache](size_t i) {
+        if (!groupFromCache(images[i], cacheKey, records[i], cache)) return false;
+        processedImages++;
+        return true;
+    };
 
-            assignImageToGroup(imageInfo);
-            processedImages++;
-        }
+    auto analyze = [&processedImages, &algorithm, cacheKey, &records, cache](size_t i, cv::Mat& image, int threadId) {
+        if (analyzeImage(images[i], image, algorithm, cacheKey, records[i], cache, threadId)) processedImages++;
     };
 
-    for (int t = 0; t < numThreads; ++t) {
-        size_t start = t * chunkSize;
-        size_t end = std::min(start + chunkSize, totalImages);
-        if (start >= totalImages) break;
-        threads.emplace_back(processImageThread, start, end, t);
+    if (regroup) {
+        parallelFor(totalImages, numThreads, [&](size_t i, int) {
+            if (cached(i)) return;
+            uncachedImages++;
+            processedImages++;
+        });
     }
-
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
+    else if (pipeline) {
+        std::vector<std::string> paths;
+        paths.reserve(totalImages);
+        for (const auto& imageInfo : images) paths.push_back(imageInfo.path);
+
+        PipelineStages stages;
+        stages.wantsDecode = [&cached](size_t i, int) { return !cached(i); };
+        stages.analyze = analyze;
+        runImagePipeline(paths, *pipeline, decodeOptions, stages);
+    }
+    else {
+        parallelFor(totalImages, numThreads, [&](size_t i, int threadId) {
+            if (cached(i)) return;
+            DecodeTicket ticket(images[i].path, decodeOptions);
+            cv::Mat image = loadImage(images[i].path, decodeOptions, ImageWorkspace::forThisThread());
+            analyze(i, image, threadId);
+        });
     }
 
-    // stop print thread
-    running = false;
-    printThread.join();
+    progress.stop();
 
     auto endTime = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
@@ -528,15 +383,120 @@ void processImages(const std::string& inputFolder, ALGORITHM algorithm)
     std::cout << "\nCompleted in " << duration.count() << "ms" << std::endl;
     std::cout << "Average: " << std::fixed << std::setprecision(2)
               << (double)duration.count() / images.size() << "ms per image" << std::endl;
+    if (uncachedImages > 0) {
+        std::cout << uncachedImages << " images have no cached colors for this algorithm and were left out, "
+                  << "group once without --regroup to add them" << std::endl;
+    }
+}
+
+static const char* placedVerb(ACTION action)
+{
+    switch (action) {
+        case MOVE: return "Moved";
+        case LINK: return "Linked";
+        case SYMLINK: return "Symlinked";
+        default: return "Copied";
+    }
+}
+
+// link()/symlink() don't replace, so they go to a temp name that is renamed over destPath
+static bool replaceWithLink(const std::string& source, const std::string& destPath, bool symbolic, std::string& error)
+{
+    std::string tmpPath = tempPathFor(destPath);
+    int result = symbolic ? symlink(source.c_str(), tmpPath.c_str()) : link(source.c_str(), tmpPath.c_str());
+    if (result != 0) {
+        error = errno == EXDEV ? "input and output are on different filesystems, use --reflink or --copy" : strerror(errno);
+        return false;
+    }
+    if (rename(tmpPath.c_str(), destPath.c_str()) != 0) {
+        error = strerror(errno);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
 }
 
-void createGroupFoldersMoveOrCopyFiles(const std::string& outputPath, ACTION action)
+// Anything already in place (same file, link or size + mtime) is left alone, so an unchanged library costs a stat per image.
+// message gets the line to print
+PLACE_RESULT placeImage(const ImageInfo& image, const std::string& destPath, ACTION action, std::string& message)
 {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+
+    struct stat src, dst;
+    bool haveDest = lstat(destPath.c_str(), &dst) == 0;
+    if (action != NONE && action != MOVE && stat(image.path.c_str(), &src) != 0) {
+        out << "  Error reading " << image.filename << ": " << strerror(errno);
+        message = out.str();
+        return FAILED;
+    }
+
+    std::string source = image.path;
+    bool upToDate = false;
+    switch (action) {
+        case NONE:
+        case MOVE: break;
+        case LINK: upToDate = haveDest && dst.st_dev == src.st_dev && dst.st_ino == src.st_ino; break;
+        case SYMLINK:
+            {
+                std::error_code ec;
+                source = std::filesystem::absolute(image.path, ec).string();
+                if (haveDest && S_ISLNK(dst.st_mode)) {
+                    std::vector<char> target(dst.st_size + 2);
+                    ssize_t n = readlink(destPath.c_str(), target.data(), target.size());
+                    upToDate = n > 0 && source == std::string(target.data(), n);
+                }
+                break;
+            }
+        case COPY:
+        case REFLINK:
+            upToDate = haveDest && S_ISREG(dst.st_mode) && dst.st_size == src.st_size &&
+                       dst.st_mtim.tv_sec == src.st_mtim.tv_sec && dst.st_mtim.tv_nsec == src.st_mtim.tv_nsec;
+            break;
+    }
+    if (upToDate) {
+        out << "  Up to date: " << image.filename;
+        message = out.str();
+        return UP_TO_DATE;
+    }
+
+    std::string error;
+    bool ok = true;
+    switch (action) {
+        case NONE: break;
+        case MOVE:
+            {
+                try {
+                    std::filesystem::rename(image.path, destPath);
+                }
+                catch (const std::filesystem::filesystem_error& ex) {
+                    error = ex.what();
+                    ok = false;
+                }
+                break;
+            }
+        case COPY: ok = copyFileFast(image.path, destPath, false, error); break;
+        case REFLINK: ok = copyFileFast(image.path, destPath, true, error); break;
+        case LINK: ok = replaceWithLink(source, destPath, false, error); break;
+        case SYMLINK: ok = replaceWithLink(source, destPath, true, error); break;
+    }
+
+    if (!ok) {
+        out << "  Error placing " << image.filename << ": " << error;
+        message = out.str();
+        return FAILED;
+    }
+    out << "  " << placedVerb(action) << ": " << image.filename << " (score: " << image.groupScore << ")";
+    message = out.str();
+    return PLACED;
+}
+
+void createGroupFoldersMoveOrCopyFiles(const std::string& outputPath, ACTION action, int requestedThreads)
+{
+    std::map<std::string, std::vector<ImageInfo*>> groupedImages;
     try {
         std::filesystem::create_directories(outputPath);
 
-        std::map<std::string, std::vector<ImageInfo*>> groupedImages;
-
         // Group images by assigned category
         for (auto& image : images) {
             if (!image.assignedGroup.empty()) {
@@ -544,50 +504,109 @@ void createGroupFoldersMoveOrCopyFiles(const std::string& outputPath, ACTION act
             }
         }
 
-        // Create folders and copy/move images
         for (const auto& group : groupedImages) {
-            std::string groupPath = outputPath + "/" + group.first;
-            std::filesystem::create_directories(groupPath);
+            std::filesystem::create_directories(outputPath + "/" + group.first);
+        }
+    }
+    catch (const std::filesystem::filesystem_error& ex) {
+        std::cout << "Error creating output folders: " << ex.what() << std::endl;
+        return;
+    }
 
+    // all groups at once: one big group shouldn't leave the other threads idle
+    std::vector<std::pair<const std::string*, ImageInfo*>> placements;
+    for (const auto& group : groupedImages) {
+        for (auto* image : group.second) placements.emplace_back(&group.first, image);
+    }
+    std::vector<PLACE_RESULT> results(placements.size());
+    std::vector<std::string> messages(placements.size());
+    parallelFor(placements.size(), resolveThreadCount(requestedThreads), [&](size_t i, int) {
+        const auto& [group, image] = placements[i];
+        results[i] = placeImage(*image, outputPath + "/" + *group + "/" + image->filename, action, messages[i]);
+    });
+
+    // printed afterwards in group order, the same as a serial run
+    size_t counts[3] = {0, 0, 0};
+    const std::string* currentGroup = nullptr;
+    for (size_t i = 0; i < placements.size(); i++) {
+        if (placements[i].first != currentGroup) {
+            currentGroup = placements[i].first;
             std::cout << "\n"
-                      << group.first << " (" << group.second.size() << " images):" << std::endl;
-
-            for (const auto& image : group.second) {
-                std::string destPath = groupPath + "/" + image->filename;
-
-                switch (action) {
-                    case NONE: break;
-                    case COPY:
-                        {
-                            try {
-                                std::filesystem::copy_file(image->path, destPath, std::filesystem::copy_options::overwrite_existing);
-                                std::cout << "  Copied: " << image->filename << " (score: " << std::fixed << std::setprecision(2) << image->groupScore << ")" << std::endl;
-                            }
-                            catch (const std::filesystem::filesystem_error& ex) {
-                                std::cerr << "  Error copying " << image->filename << ": " << ex.what() << std::endl;
-                            }
-
-                            break;
-                        }
-                    case MOVE:
-                        {
-                            try {
-                                std::filesystem::rename(image->path, destPath);
-                                std::cout << "  Moved: " << image->filename << " (score: " << std::fixed << std::setprecision(2) << image->groupScore << ")" << std::endl;
-                            }
-                            catch (const std::filesystem::filesystem_error& ex) {
-                                std::cerr << "  Error moving " << image->filename << ": " << ex.what() << std::endl;
-                            }
-
-                            break;
-                        }
-                }
-            }
+                      << *currentGroup << " (" << groupedImages[*currentGroup].size() << " images):" << std::endl;
         }
+        std::cout << messages[i] << std::endl;
+        counts[results[i]]++;
+    }
+
+    std::cout << "\n"
+              << placedVerb(action) << " " << counts[PLACED] << ", " << counts[UP_TO_DATE] << " already up to date";
+    if (counts[FAILED] > 0) std::cout << ", " << counts[FAILED] << " failed";
+    std::cout << std::endl;
+}
+
+// --watch: group images as they land in the input folder, straight into their group folder
+int watchGroups(const std::string& inputFolder, const std::string& outputPath, ACTION action, ALGORITHM algorithm,
+                const DecodeOptions& decodeOptions, FeatureCache* cache, int requestedThreads, int debounceMs)
+{
+    std::string root, outputRoot;
+    try {
+        root = std::filesystem::canonical(inputFolder).string();
+        outputRoot = std::filesystem::weakly_canonical(outputPath).string() + "/";
     }
     catch (const std::filesystem::filesystem_error& ex) {
-        std::cerr << "Error creating output folders: " << ex.what() << std::endl;
+        std::cout << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+
+    TreeWatcher watcher(root);
+    if (!watcher.ok()) {
+        std::cout << "Could not watch " << root << std::endl;
+        return 1;
     }
+    std::cout << "\nWatching " << root << " for new wallpapers (Ctrl+C to stop)..." << std::endl;
+
+    int numThreads = resolveThreadCount(requestedThreads);
+    const int cacheKey = colorsCacheKey(algorithm, decodeOptions.reduced);
+    WatchBatch batch;
+    while (watcher.wait(batch, debounceMs)) {
+        if (batch.rescan) std::cout << "Missed some events, run wpu-grouper again to pick up everything" << std::endl;
+
+        std::vector<ImageInfo> added;
+        for (const auto& path : batch.changed) {
+            if (path.rfind(outputRoot, 0) == 0) continue; // our own copies when the output is inside the input
+            ImageInfo imageInfo;
+            imageInfo.path = path;
+            imageInfo.filename = std::filesystem::path(path).filename().string();
+            added.push_back(std::move(imageInfo));
+        }
+        if (added.empty()) continue;
+
+        std::vector<FeatureRecord> records(added.size());
+        parallelFor(added.size(), numThreads, [&](size_t i, int threadId) {
+            if (groupFromCache(added[i], cacheKey, records[i], cache)) return;
+            DecodeTicket ticket(added[i].path, decodeOptions);
+            cv::Mat image = loadImage(added[i].path, decodeOptions, ImageWorkspace::forThisThread());
+            analyzeImage(added[i], image, algorithm, cacheKey, records[i], cache, threadId);
+        });
+
+        for (const auto& imageInfo : added) {
+            if (imageInfo.assignedGroup.empty()) continue;
+            std::string groupPath = outputPath + "/" + imageInfo.assignedGroup;
+            std::error_code ec;
+            std::filesystem::create_directories(groupPath, ec);
+            std::string message;
+            placeImage(imageInfo, groupPath + "/" + imageInfo.filename, action, message);
+            std::cout << imageInfo.assignedGroup << ":\n"
+                      << message << std::endl;
+        }
+
+        if (cache && !cache->save()) {
+            std::cout << "Could not save feature cache to " << cache->filePath() << std::endl;
+        }
+    }
+
+    std::cout << "Stopped watching " << root << std::endl;
+    return 0;
 }
 
 void generateReport(const std::string& reportPath = "grouping_report.txt")
@@ -639,11 +658,90 @@ void printSummary()
     }
 }
 
+// Mean distance from every reference color to the closest color of the other palette, weighted by reference weight
+double paletteDistance(const std::vector<ColorInfo>& reference, const std::vector<ColorInfo>& other)
+{
+    double total = 0.0, weights = 0.0;
+    for (const auto& ref : reference) {
+        double best = DBL_MAX;
+        for (const auto& c : other) {
+            double db = ref.color[0] - c.color[0], dg = ref.color[1] - c.color[1], dr = ref.color[2] - c.color[2];
+            best = std::min(best, std::sqrt(db * db + dg * dg + dr * dr));
+        }
+        if (other.empty()) best = 0.0;
+        total += best * ref.weight;
+        weights += ref.weight;
+    }
+    return weights > 0.0 ? total / weights : 0.0;
+}
+
+int runBenchmark(const std::string& inputFolder, int count, const DecodeOptions& decodeOptions)
+{
+    if (scanFolderMakeStructs(inputFolder) == 0) return 1;
+
+    // decode once, every algorithm gets the same pixels
+    std::vector<cv::Mat> decoded;
+    for (const auto& imageInfo : images) {
+        if ((int)decoded.size() >= count) break;
+        cv::Mat image = loadImage(imageInfo.path, decodeOptions);
+        if (image.empty()) continue;
+        if (image.cols > 800 || image.rows > 600) {
+            double scale = std::min(800.0 / image.cols, 600.0 / image.rows);
+            cv::resize(image, image, cv::Size(), scale, scale);
+        }
+        decoded.push_back(image);
+    }
+    if (decoded.empty()) {
+        std::cout << "No images could be loaded" << std::endl;
+        return 1;
+    }
+
+    const std::vector<std::pair<ALGORITHM, std::string>> algorithms = {
+        {KMEANS, "KMeans"}, {KMEANSOPT, "KMeansOptimized"}, {HISTOGRAM, "Histogram"}, {KMEANSFAST, "KMeansFast"}, {PALETTE, "Palette"}};
+
+    std::vector<std::vector<ColorInfo>> reference(decoded.size());
+    std::vector<int> referenceGroup(decoded.size());
+
+    std::cout << "Benchmarking " << decoded.size() << " images (single thread)" << std::endl;
+    std::cout << std::left << std::setw(18) << "algorithm" << std::right << std::setw(12) << "ms/image"
+              << std::setw(14) << "color dist" << std::setw(14) << "same group" << std::endl;
+
+    for (const auto& [algorithm, name] : algorithms) {
+        double distance = 0.0;
+        size_t sameGroup = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<ColorInfo>> results(decoded.size());
+        for (size_t i = 0; i < decoded.size(); i++) {
+            results[i] = extractDominantColors(decoded[i], algorithm);
+        }
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for (size_t i = 0; i < decoded.size(); i++) {
+            double score;
+            int group = findBestGroup(results[i], score);
+            if (score < 0.3) group = 0;
+            if (algorithm == KMEANS) {
+                reference[i] = results[i];
+                referenceGroup[i] = group;
+            }
+            distance += paletteDistance(reference[i], results[i]);
+            if (group == referenceGroup[i]) sameGroup++;
+        }
+
+        std::cout << std::left << std::setw(18) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << elapsed / decoded.size()
+                  << std::setw(14) << distance / decoded.size()
+                  << std::setw(13) << std::setprecision(1) << 100.0 * sameGroup / decoded.size() << "%" << std::endl;
+    }
+
+    return 0;
+}
+
 void handleCtrlC(int)
 {
     std::cout << std::endl
               << std::endl;
-    Cursor::show();
+    if (isatty(STDOUT_FILENO)) Cursor::show(); // hidden by the progress redraw
     exit(1);
 }
 
@@ -656,15 +754,14 @@ int main(int argc, char* argv[])
     program.add_description("group wallpapers by color palette");
     auto& options_required = program.add_group("Required");
     options_required.add_argument("-i", "--input")
-        .help("input folder")
-        .required();
+        .help("input folder"); // checked after --print-groups, which needs none
     program.add_argument("-r", "--report")
         .help("save report in a txt file")
         .default_value("")
         .metavar("report.txt");
     auto& options_optional = program.add_group("Optional");
     options_optional.add_argument("-o", "--output")
-        .help("output folder (if not speicifed files won't be moved/copied, must specify --copy or --move to do action)");
+        .help("output folder (if not speicifed files won't be moved/copied, must specify --copy, --move, --link, --symlink or --reflink to do action)");
     auto& mutex_group = options_optional.add_mutually_exclusive_group();
     mutex_group.add_argument("-c", "--copy")
         .help("copy files to output dir")
@@ -674,9 +771,92 @@ int main(int argc, char* argv[])
         .help("move files to output dir")
         .default_value(false)
         .implicit_value(true);
+    mutex_group.add_argument("-l", "--link")
+        .help("hardlink files into output dir (no extra space, same filesystem only)")
+        .default_value(false)
+        .implicit_value(true);
+    mutex_group.add_argument("-s", "--symlink")
+        .help("symlink files into output dir")
+        .default_value(false)
+        .implicit_value(true);
+    mutex_group.add_argument("--reflink")
+        .help("copy-on-write copies (btrfs, XFS), falls back to a normal copy")
+        .default_value(false)
+        .implicit_value(true);
     options_optional.add_argument("-a", "--algorithm")
-        .help("which algorithm to use when grouping images (KMeans = 0, KMeansOptimized = 1, Histogram = 2")
-        .metavar("0/1/2")
+        .help("which algorithm to use when grouping images (KMeans = 0, KMeansOptimized = 1, Histogram = 2, KMeansFast = 3, Palette = 4 (shares the wpu-palette cache))")
+        .metavar("0/1/2/3/4")
+        .default_value(0)
+        .scan<'i', int>();
+    options_optional.add_argument("-R", "--reduced")
+        .help("decode large JPEGs at 1/2, 1/4 or 1/8 scale (images are shrunk to 800x600 anyway)")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("-t", "--threads")
+        .help("number of worker threads (0 = one per core)")
+        .metavar("N")
+        .default_value(0)
+        .scan<'i', int>();
+    options_optional.add_argument("--max-mem")
+        .help("cap the memory decoded images may take together, decodes wait for room (sizes come from the file headers)")
+        .metavar("size");
+    options_optional.add_argument("--nice")
+        .help("run in the background: lowest CPU and I/O priority, new decodes pause while the rest of the system keeps every core busy")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("-P", "--pipeline")
+        .help("overlap disk reads, decoding and analysis with separate thread pools (0 = one per core)")
+        .metavar("readers:decoders:analyzers[:queue]");
+    options_optional.add_argument("--io")
+        .help("how image files are read: imread, read, mmap (decode from the page cache) or uring (batched io_uring reads in the pipeline)")
+        .metavar("backend")
+        .default_value(std::string("imread"));
+    options_optional.add_argument("--backend")
+        .help("where resizing, color conversion and the darkness mean run: cpu or opencl (cv::UMat on the GPU, several images per submission, the rest stays on the CPU)")
+        .metavar("name")
+        .default_value(std::string("cpu"));
+    options_optional.add_argument("--cache")
+        .help("feature cache shared by all wpu tools (only changed images get decoded)")
+        .metavar("features.db")
+        .default_value(FeatureCache::defaultPath());
+    options_optional.add_argument("--no-cache")
+        .help("don't read or write the feature cache")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("--profile")
+        .help("print how long every stage took and write a Chrome trace (chrome://tracing) to grouper-trace.json")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("--progress")
+        .help("how progress is shown: tty (redrawn in place), plain (a line every 10s), json (a JSON object per second) or none, auto = tty on a terminal, plain otherwise")
+        .default_value(std::string("auto"))
+        .metavar("mode");
+    options_optional.add_argument("--metrics")
+        .help("also write progress as a Prometheus textfile (node_exporter textfile collector), replaced every 5s")
+        .metavar("file.prom");
+    options_optional.add_argument("-w", "--watch")
+        .help("after grouping, stay running and group new images as they appear (inotify), needs an output mode like --copy")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("--debounce")
+        .help("with --watch, wait until nothing changed for this long before grouping a batch")
+        .metavar("ms")
+        .default_value(2000)
+        .scan<'i', int>();
+    options_optional.add_argument("-g", "--groups")
+        .help("color group definitions, one name|hueMin|hueMax|satMin|satMax|brightMin|brightMax per line [default: ~/.config/wpu/groups.conf if it exists, else built in]")
+        .metavar("groups.conf");
+    options_optional.add_argument("--print-groups")
+        .help("print the color groups in the --groups format (a starting point for your own) and exit")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("--regroup")
+        .help("only regroup the colors stored in the feature cache, nothing is decoded (try out new --groups in seconds)")
+        .default_value(false)
+        .implicit_value(true);
+    options_optional.add_argument("--benchmark")
+        .help("time every algorithm on the first N images of the input folder and compare them to KMeans, nothing is grouped")
+        .metavar("N")
         .default_value(0)
         .scan<'i', int>();
 
@@ -695,30 +875,150 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    std::string groupsPath = program.present("groups").value_or("");
+    if (groupsPath.empty() && fs_exists(defaultGroupsPath())) groupsPath = defaultGroupsPath();
+    if (!groupsPath.empty()) {
+        std::vector<ColorGroup> groups;
+        if (!loadColorGroups(groupsPath, groups)) return 1;
+        colorGroups = std::move(groups);
+        rebuildGroupScores();
+        std::cout << "Loaded " << colorGroups.size() - 1 << " color groups from " << groupsPath << std::endl;
+    }
+
+    if (program.get<bool>("print-groups")) {
+        printColorGroups(std::cout);
+        return 0;
+    }
+
+    if (!program.present("input")) {
+        std::cout << "Error: -i, --input: required." << std::endl;
+        std::cout << program;
+        return 1;
+    }
+
     ACTION action = NONE;
     if (program.get<bool>("copy")) { action = COPY; }
     else if (program.get<bool>("move")) {
         action = MOVE;
     }
+    else if (program.get<bool>("link")) {
+        action = LINK;
+    }
+    else if (program.get<bool>("symlink")) {
+        action = SYMLINK;
+    }
+    else if (program.get<bool>("reflink")) {
+        action = REFLINK;
+    }
 
     ALGORITHM algorithm = KMEANS;
     switch (program.get<int>("algorithm")) {
         case 0: algorithm = KMEANS; break;
         case 1: algorithm = KMEANSOPT; break;
         case 2: algorithm = HISTOGRAM; break;
+        case 3: algorithm = KMEANSFAST; break;
+        case 4: algorithm = PALETTE; break;
     }
 
+    DecodeOptions decodeOptions;
+    decodeOptions.reduced = program.get<bool>("reduced");
+    decodeOptions.targetWidth = 800;
+    decodeOptions.targetHeight = 600;
+
     std::string inputFolder = program.get<std::string>("input");
 
-    processImages(inputFolder, algorithm);
+    IoBackend io;
+    if (!parseIoBackend(program.get<std::string>("io"), io)) {
+        std::cout << "Invalid --io: " << program.get<std::string>("io") << std::endl;
+        return 1;
+    }
+    setIoBackend(io);
+
+    AnalysisBackend backend;
+    if (!parseAnalysisBackend(program.get<std::string>("backend"), backend)) {
+        std::cout << "Invalid --backend: " << program.get<std::string>("backend") << std::endl;
+        return 1;
+    }
+    if (!setAnalysisBackend(backend, std::min(OPENCL_BATCH_SIZE, resolveThreadCount(program.get<int>("threads"))))) {
+        std::cout << "OpenCL is not available (no device, or OpenCV was built without it)" << std::endl;
+        return 1;
+    }
+    if (backend == AnalysisBackend::OPENCL) std::cout << "OpenCL device: " << openclDeviceName() << std::endl;
+
+    ProgressSettings progressSettings;
+    if (!parseProgressMode(program.get<std::string>("progress"), progressSettings.mode)) {
+        std::cout << "Invalid --progress: " << program.get<std::string>("progress") << std::endl;
+        return 1;
+    }
+    progressSettings.metricsPath = program.present("metrics").value_or("");
+    setProgressSettings(progressSettings);
+
+    DecodeLimits limits;
+    if (auto maxMem = program.present("max-mem")) {
+        if (!parseByteSize(*maxMem, limits.maxBytes) || limits.maxBytes == 0) {
+            std::cout << "Invalid --max-mem: " << *maxMem << std::endl;
+            return 1;
+        }
+    }
+    if (program.get<bool>("nice")) {
+        limits.yieldUnderLoad = true;
+        if (!enterIdlePriority()) std::cout << "Could not lower every priority, --nice is only partly in effect" << std::endl;
+    }
+    setDecodeLimits(limits);
+
+    bool watch = program.get<bool>("watch");
+    if (watch && (action == NONE || !program.present("output"))) {
+        std::cout << "--watch needs --output and --copy, --move, --link, --symlink or --reflink" << std::endl;
+        return 1;
+    }
+
+    bool profile = program.get<bool>("profile");
+    if (profile) Profile::enable();
+
+    if (int count = program.get<int>("benchmark"); count > 0) {
+        return runBenchmark(inputFolder, count, decodeOptions);
+    }
+
+    FeatureCache cache(program.get<std::string>("cache"));
+    bool useCache = !program.get<bool>("no-cache");
+    bool regroup = program.get<bool>("regroup");
+    if (regroup && !useCache) {
+        std::cout << "--regroup works off the feature cache, it can't be combined with --no-cache" << std::endl;
+        return 1;
+    }
+    if (useCache && cache.load()) {
+        std::cout << "Loaded " << cache.size() << " cached entries from " << cache.filePath() << std::endl;
+    }
+
+    PipelineConfig pipeline;
+    bool usePipeline = false;
+    if (auto spec = program.present("pipeline")) {
+        if (!parsePipelineSpec(*spec, pipeline)) {
+            std::cout << "Invalid --pipeline spec: " << *spec << std::endl;
+            return 1;
+        }
+        usePipeline = true;
+    }
+
+    processImages(inputFolder, algorithm, decodeOptions, useCache ? &cache : nullptr, program.get<int>("threads"),
+                  usePipeline ? &pipeline : nullptr, regroup);
+
+    if (useCache && !cache.save()) {
+        std::cout << "Could not save feature cache to " << cache.filePath() << std::endl;
+    }
 
     // Show summary
     printSummary();
 
+    if (profile) {
+        Profile::report(std::cout);
+        if (Profile::writeTrace("grouper-trace.json")) std::cout << "\nTrace written to grouper-trace.json" << std::endl;
+    }
+
     if (action != NONE) {
         // Create grouped folders
         std::string outputFolder = program.get<std::string>("output");
-        createGroupFoldersMoveOrCopyFiles(outputFolder, action);
+        createGroupFoldersMoveOrCopyFiles(outputFolder, action, program.get<int>("threads"));
     }
 
     std::string reportFile = program.get<std::string>("report");
@@ -726,8 +1026,12 @@ int main(int argc, char* argv[])
         generateReport(reportFile);
     }
 
+    if (watch) {
+        return watchGroups(inputFolder, program.get<std::string>("output"), action, algorithm, decodeOptions,
+                           useCache ? &cache : nullptr, program.get<int>("threads"), program.get<int>("debounce"));
+    }
+
     std::cout << "\nDone!" << std::endl;
-    Cursor::show();
 
     return 0;
 }
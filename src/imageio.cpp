@@ -0,0 +1,692 @@
+#include "imageio.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "features.hpp"
+#include "iouring.hpp"
+#include "profile.hpp"
+#include "utils.hpp"
+#include "workspace.hpp"
+
+static uint16_t be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+static uint32_t be32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static uint32_t le24(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16); }
+static uint32_t le32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static bool parseJpegSize(const uint8_t* data, size_t size, int& width, int& height)
+{
+    size_t i = 2;
+    while (i + 1 < size) {
+        if (data[i] != 0xFF) return false;
+        while (i < size && data[i] == 0xFF) i++; // fill bytes
+        if (i >= size) return false;
+
+        uint8_t marker = data[i];
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i++;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) return false; // EOI/SOS before any frame header
+        if (i + 3 > size) return false;
+
+        uint16_t length = be16(data + i + 1);
+        bool isFrameHeader = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (isFrameHeader) {
+            if (i + 8 > size) return false;
+            height = be16(data + i + 4);
+            width = be16(data + i + 6);
+            return width > 0 && height > 0;
+        }
+        i += 1 + length;
+    }
+    return false;
+}
+
+static bool parseWebpSize(const uint8_t* data, size_t size, int& width, int& height)
+{
+    if (size < 30) return false;
+    const uint8_t* chunk = data + 12;
+    if (std::memcmp(chunk, "VP8 ", 4) == 0) {
+        if (data[23] != 0x9D || data[24] != 0x01 || data[25] != 0x2A) return false;
+        width = le16(data + 26) & 0x3FFF;
+        height = le16(data + 28) & 0x3FFF;
+    }
+    else if (std::memcmp(chunk, "VP8L", 4) == 0) {
+        if (data[20] != 0x2F) return false;
+        uint32_t bits = le32(data + 21);
+        width = (bits & 0x3FFF) + 1;
+        height = ((bits >> 14) & 0x3FFF) + 1;
+    }
+    else if (std::memcmp(chunk, "VP8X", 4) == 0) {
+        width = le24(data + 24) + 1;
+        height = le24(data + 27) + 1;
+    }
+    else {
+        return false;
+    }
+    return width > 0 && height > 0;
+}
+
+bool parseImageSize(const uint8_t* data, size_t size, int& width, int& height)
+{
+    width = 0;
+    height = 0;
+    if (size < 4) return false;
+
+    if (data[0] == 0xFF && data[1] == 0xD8) {
+        return parseJpegSize(data, size, width, height);
+    }
+    if (size >= 24 && std::memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0 && std::memcmp(data + 12, "IHDR", 4) == 0) {
+        width = be32(data + 16);
+        height = be32(data + 20);
+        return width > 0 && height > 0;
+    }
+    if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        return parseWebpSize(data, size, width, height);
+    }
+    if (size >= 10 && (std::memcmp(data, "GIF87a", 6) == 0 || std::memcmp(data, "GIF89a", 6) == 0)) {
+        width = le16(data + 6);
+        height = le16(data + 8);
+        return width > 0 && height > 0;
+    }
+    if (size >= 26 && data[0] == 'B' && data[1] == 'M') {
+        if (le32(data + 14) == 12) { // OS/2 BITMAPCOREHEADER
+            width = le16(data + 18);
+            height = le16(data + 20);
+        }
+        else {
+            width = (int32_t)le32(data + 18);
+            height = std::abs((int32_t)le32(data + 22));
+        }
+        return width > 0 && height > 0;
+    }
+    return false;
+}
+
+bool readImageSize(const std::string& path, int& width, int& height)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    // JPEG headers can sit behind large EXIF/ICC segments, so grow the window if needed
+    std::vector<uint8_t> header;
+    bool found = false;
+    for (size_t window = 64 * 1024; window <= 1024 * 1024 && !found; window *= 4) {
+        size_t have = header.size();
+        header.resize(window);
+        ssize_t n = pread(fd, header.data() + have, window - have, have);
+        if (n < 0) break;
+        header.resize(have + n);
+        found = parseImageSize(header.data(), header.size(), width, height);
+        if ((size_t)n < window - have) break; // whole file read
+    }
+
+    close(fd);
+    return found;
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static ImageStructure checkJpeg(const uint8_t* data, size_t size)
+{
+    // walk the marker segments up to the first scan
+    size_t i = 2;
+    bool frame = false;
+    while (true) {
+        if (i + 4 > size || data[i] != 0xFF) return ImageStructure::BROKEN;
+        while (i < size && data[i] == 0xFF) i++;
+        if (i + 3 > size) return ImageStructure::BROKEN;
+
+        uint8_t marker = data[i];
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i++;
+            continue;
+        }
+        if (marker == 0xD9) return ImageStructure::BROKEN; // EOI before any scan
+
+        size_t length = be16(data + i + 1);
+        if (length < 2 || i + 1 + length > size) return ImageStructure::BROKEN;
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) frame = true;
+
+        i += 1 + length;
+        if (marker == 0xDA) break;
+    }
+    if (!frame) return ImageStructure::BROKEN;
+
+    // byte stuffing means FF D9 can't appear inside entropy coded data, so the last
+    // FF D9 in the file is the real EOI (anything after it is harmless trailing junk)
+    for (size_t j = size - 1; j > i; j--) {
+        if (data[j] == 0xD9 && data[j - 1] == 0xFF) return ImageStructure::OK;
+    }
+    return ImageStructure::BROKEN;
+}
+
+static ImageStructure checkPng(const uint8_t* data, size_t size)
+{
+    size_t i = 8;
+    while (i + 12 <= size) {
+        uint32_t length = be32(data + i);
+        if (length > size - i - 12) return ImageStructure::BROKEN;
+
+        const uint8_t* type = data + i + 4;
+        uint32_t expected = be32(data + i + 8 + length);
+        if (crc32(type, length + 4) != expected) return ImageStructure::BROKEN;
+
+        if (std::memcmp(type, "IEND", 4) == 0) return ImageStructure::OK;
+        i += 12 + length;
+    }
+    return ImageStructure::BROKEN; // ran out of data before IEND
+}
+
+ImageStructure checkImageStructure(const uint8_t* data, size_t size, int& width, int& height)
+{
+    ProfileScope profile(Stage::STRUCTURE);
+    if (size < 8) return ImageStructure::BROKEN;
+
+    if (!parseImageSize(data, size, width, height)) {
+        // known magic with an unreadable header is broken, anything else (TIFF, ...) we can't judge
+        bool knownMagic = (data[0] == 0xFF && data[1] == 0xD8) || std::memcmp(data, "\x89PNG", 4) == 0 ||
+                          std::memcmp(data, "RIFF", 4) == 0 || std::memcmp(data, "GIF8", 4) == 0 ||
+                          (data[0] == 'B' && data[1] == 'M');
+        return knownMagic ? ImageStructure::BROKEN : ImageStructure::UNKNOWN;
+    }
+
+    if (data[0] == 0xFF && data[1] == 0xD8) {
+        return checkJpeg(data, size);
+    }
+    if (data[0] == 0x89) {
+        return checkPng(data, size);
+    }
+    if (data[0] == 'R') { // RIFF size counts everything after the 8 byte header
+        return (size_t)le32(data + 4) + 8 <= size ? ImageStructure::OK : ImageStructure::BROKEN;
+    }
+    if (data[0] == 'G') {
+        size_t end = size;
+        while (end > 0 && data[end - 1] == 0) end--; // some encoders pad after the trailer
+        return end > 13 && data[end - 1] == 0x3B ? ImageStructure::OK : ImageStructure::BROKEN;
+    }
+    if (data[0] == 'B') {
+        uint32_t fileSize = le32(data + 2);
+        uint32_t pixelOffset = le32(data + 10);
+        if (pixelOffset >= size) return ImageStructure::BROKEN;
+        return fileSize == 0 || fileSize <= size ? ImageStructure::OK : ImageStructure::BROKEN;
+    }
+    return ImageStructure::UNKNOWN;
+}
+
+int reducedScale(int width, int height, int targetWidth, int targetHeight)
+{
+    if (width <= 0 || height <= 0 || targetWidth <= 0 || targetHeight <= 0) return 1;
+
+    double ratio = std::max((double)width / targetWidth, (double)height / targetHeight);
+    for (int scale : {8, 4, 2}) {
+        if (scale <= ratio) return scale;
+    }
+    return 1;
+}
+
+int decodeFlags(const DecodeOptions& options, int width, int height)
+{
+    int scale = options.reduced ? reducedScale(width, height, options.targetWidth, options.targetHeight) : 1;
+
+    // clang-format off
+    if (options.grayscale) {
+        switch (scale) {
+            case 8:  return cv::IMREAD_REDUCED_GRAYSCALE_8;
+            case 4:  return cv::IMREAD_REDUCED_GRAYSCALE_4;
+            case 2:  return cv::IMREAD_REDUCED_GRAYSCALE_2;
+            default: return cv::IMREAD_GRAYSCALE;
+        }
+    }
+    switch (scale) {
+        case 8:  return cv::IMREAD_REDUCED_COLOR_8;
+        case 4:  return cv::IMREAD_REDUCED_COLOR_4;
+        case 2:  return cv::IMREAD_REDUCED_COLOR_2;
+        default: return cv::IMREAD_COLOR;
+    }
+    // clang-format on
+}
+
+static IoBackend selectedBackend = IoBackend::IMREAD;
+
+bool parseIoBackend(const std::string& name, IoBackend& backend)
+{
+    // clang-format off
+    if      (name == "imread") backend = IoBackend::IMREAD;
+    else if (name == "read")   backend = IoBackend::READ;
+    else if (name == "mmap")   backend = IoBackend::MMAP;
+    else if (name == "uring")  backend = IoBackend::URING;
+    else return false;
+    // clang-format on
+    return true;
+}
+
+void setIoBackend(IoBackend backend) { selectedBackend = backend; }
+IoBackend ioBackend() { return selectedBackend; }
+
+FileBuffer& FileBuffer::operator=(FileBuffer&& other) noexcept
+{
+    if (this == &other) return *this;
+    reset();
+    owned = std::move(other.owned);
+    mapped = other.mapped;
+    mappedSize = other.mappedSize;
+    other.mapped = nullptr;
+    other.mappedSize = 0;
+    return *this;
+}
+
+bool FileBuffer::map(const std::string& path)
+{
+    reset();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file referenced
+    if (addr == MAP_FAILED) return false;
+
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    madvise(addr, st.st_size, MADV_WILLNEED);
+    mapped = addr;
+    mappedSize = st.st_size;
+    return true;
+}
+
+void FileBuffer::reset()
+{
+    if (mapped) munmap(mapped, mappedSize);
+    mapped = nullptr;
+    mappedSize = 0;
+    owned.clear();
+}
+
+bool readFile(const std::string& path, FileBuffer& buffer)
+{
+    if (selectedBackend == IoBackend::MMAP) {
+        ProfileScope profile(Stage::READ);
+        return buffer.map(path);
+    }
+    buffer.reset();
+    return readFileBytes(path, buffer.bytes());
+}
+
+static DecodeLimits decodeLimits;
+static std::mutex budgetMutex;
+static std::condition_variable budgetFreed;
+static size_t budgetUsed = 0;
+static int ticketsHeld = 0;
+
+// decoded pixels plus one working copy of the same size (color conversion, float k-means data)
+constexpr size_t DECODE_COPIES = 2;
+// images whose header we can't read are counted as 4K
+constexpr int UNKNOWN_WIDTH = 3840;
+constexpr int UNKNOWN_HEIGHT = 2160;
+// --nice: how often a paused decode looks at the load again
+constexpr int LOAD_CHECK_MS = 1000;
+
+void setDecodeLimits(const DecodeLimits& limits) { decodeLimits = limits; }
+
+DecodeTicket::DecodeTicket(const std::string& path, const DecodeOptions& options)
+{
+    if (decodeLimits.maxBytes == 0 && !decodeLimits.yieldUnderLoad) return;
+    int width = 0, height = 0;
+    if (decodeLimits.maxBytes > 0) readImageSize(path, width, height);
+    acquire(width, height, options);
+}
+
+DecodeTicket::DecodeTicket(const uchar* data, size_t size, const DecodeOptions& options)
+{
+    if (decodeLimits.maxBytes == 0 && !decodeLimits.yieldUnderLoad) return;
+    int width = 0, height = 0;
+    if (decodeLimits.maxBytes > 0) parseImageSize(data, size, width, height);
+    acquire(width, height, options);
+}
+
+DecodeTicket& DecodeTicket::operator=(DecodeTicket&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        bytes = other.bytes;
+        held = other.held;
+        other.held = false;
+    }
+    return *this;
+}
+
+// load average minus the decodes we're running ourselves
+static double otherLoad()
+{
+    double load = 0.0;
+    if (getloadavg(&load, 1) != 1) return 0.0;
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    return load - ticketsHeld;
+}
+
+void DecodeTicket::acquire(int width, int height, const DecodeOptions& options)
+{
+    if (decodeLimits.yieldUnderLoad) {
+        int cores = resolveThreadCount(0);
+        while (otherLoad() >= cores) std::this_thread::sleep_for(std::chrono::milliseconds(LOAD_CHECK_MS));
+    }
+
+    if (decodeLimits.maxBytes > 0) {
+        if (width <= 0 || height <= 0) {
+            width = UNKNOWN_WIDTH;
+            height = UNKNOWN_HEIGHT;
+        }
+        int scale = options.reduced ? reducedScale(width, height, options.targetWidth, options.targetHeight) : 1;
+        size_t pixels = (size_t)(width / scale) * (height / scale);
+        bytes = pixels * (options.grayscale ? 1 : 3) * DECODE_COPIES;
+    }
+
+    std::unique_lock<std::mutex> lock(budgetMutex);
+    budgetFreed.wait(lock, [this] { return budgetUsed == 0 || budgetUsed + bytes <= decodeLimits.maxBytes || decodeLimits.maxBytes == 0; });
+    budgetUsed += bytes;
+    ticketsHeld++;
+    held = true;
+}
+
+void DecodeTicket::release()
+{
+    if (!held) return;
+    {
+        std::lock_guard<std::mutex> lock(budgetMutex);
+        budgetUsed -= bytes;
+        ticketsHeld--;
+    }
+    held = false;
+    budgetFreed.notify_all();
+}
+
+cv::Mat loadImage(const std::string& path, const DecodeOptions& options)
+{
+    ProfileScope profile(Stage::LOAD);
+    if (selectedBackend != IoBackend::IMREAD) {
+        FileBuffer buffer;
+        if (!readFile(path, buffer)) return cv::Mat();
+        return decodeImage(buffer.data(), buffer.size(), options);
+    }
+
+    int width = 0, height = 0;
+    if (options.reduced) {
+        readImageSize(path, width, height);
+    }
+    return cv::imread(path, decodeFlags(options, width, height));
+}
+
+// buffer = decode into it when the header says how big the result is, imdecode reallocates if that was wrong
+static cv::Mat decodeInto(const uchar* data, size_t size, const DecodeOptions& options, cv::Mat* buffer)
+{
+    if (size == 0) return cv::Mat();
+    ProfileScope profile(Stage::DECODE);
+
+    int width = 0, height = 0;
+    if (options.reduced || buffer) {
+        parseImageSize(data, size, width, height);
+    }
+
+    try {
+        const cv::Mat raw(1, (int)size, CV_8UC1, (void*)data); // imdecode only reads it
+        int flags = decodeFlags(options, width, height);
+        if (!buffer || width <= 0 || height <= 0) return cv::imdecode(raw, flags);
+
+        // libjpeg rounds reduced sizes up
+        int scale = options.reduced ? reducedScale(width, height, options.targetWidth, options.targetHeight) : 1;
+        cv::Mat dst = ImageWorkspace::view(*buffer, (height + scale - 1) / scale, (width + scale - 1) / scale,
+                                           options.grayscale ? CV_8UC1 : CV_8UC3);
+        return cv::imdecode(raw, flags, &dst);
+    }
+    catch (const cv::Exception&) {
+        return cv::Mat();
+    }
+}
+
+cv::Mat decodeImage(const uchar* data, size_t size, const DecodeOptions& options)
+{
+    return decodeInto(data, size, options, nullptr);
+}
+
+cv::Mat decodeImage(const std::vector<uchar>& bytes, const DecodeOptions& options)
+{
+    return decodeImage(bytes.data(), bytes.size(), options);
+}
+
+cv::Mat loadImage(const std::string& path, const DecodeOptions& options, ImageWorkspace& workspace)
+{
+    if (selectedBackend == IoBackend::IMREAD) return loadImage(path, options);
+
+    ProfileScope profile(Stage::LOAD);
+    if (!readFile(path, workspace.file)) return cv::Mat();
+    cv::Mat image = decodeInto(workspace.file.data(), workspace.file.size(), options, &workspace.decoded);
+    workspace.file.reset(); // unmaps, read() bytes keep their capacity
+    return image;
+}
+
+bool readFileBytes(const std::string& path, std::vector<uchar>& bytes)
+{
+    ProfileScope profile(Stage::READ);
+    bytes.clear();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    posix_fadvise(fd, 0, st.st_size, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+
+    bytes.resize(st.st_size);
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = read(fd, bytes.data() + done, bytes.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+
+    bytes.resize(done);
+    return done > 0;
+}
+
+bool parsePipelineSpec(const std::string& spec, PipelineConfig& config)
+{
+    int readers = 0, decoders = 0, analyzers = 0, depth = 0;
+    int fields = sscanf(spec.c_str(), "%d:%d:%d:%d", &readers, &decoders, &analyzers, &depth);
+    if (fields < 3 || readers < 1 || decoders < 0 || analyzers < 0) return false;
+
+    config.readers = readers;
+    config.decoders = decoders;
+    config.analyzers = analyzers;
+    if (fields == 4 && depth > 0) config.queueDepth = depth;
+    return true;
+}
+
+struct PipelineItem {
+    size_t index = 0;
+    FileBuffer bytes;
+    cv::Mat image;
+    DecodeTicket ticket; // --max-mem share, from the read until the image was analyzed
+};
+
+// files a pipeline reader has in flight at once with --io uring
+constexpr size_t URING_BATCH = 32;
+
+static void flushUringBatch(UringReader& uring, std::vector<size_t>& batch, std::vector<std::string>& batchPaths,
+                            std::vector<std::vector<uchar>>& batchBytes, BoundedQueue<PipelineItem>& readQueue,
+                            const DecodeOptions& options)
+{
+    {
+        ProfileScope profile(Stage::READ);
+        uring.readFiles(batchPaths, batchBytes);
+    }
+    for (size_t b = 0; b < batch.size(); b++) {
+        PipelineItem item;
+        item.index = batch[b];
+        item.bytes.bytes() = std::move(batchBytes[b]);
+        item.ticket = DecodeTicket(item.bytes.data(), item.bytes.size(), options);
+        readQueue.push(std::move(item));
+    }
+    batch.clear();
+    batchPaths.clear();
+}
+
+void runImagePipeline(const std::vector<std::string>& paths, const PipelineConfig& config,
+                      const DecodeOptions& options, const PipelineStages& stages)
+{
+    BoundedQueue<PipelineItem> readQueue(config.queueDepth);
+    BoundedQueue<PipelineItem> decodeQueue(config.queueDepth);
+    std::atomic<size_t> next{0};
+    std::atomic<int> readersLeft{config.readers};
+    std::atomic<int> decodersLeft{resolveThreadCount(config.decoders)};
+
+    auto reader = [&](int threadId) {
+        std::unique_ptr<UringReader> uring;
+        if (selectedBackend == IoBackend::URING) {
+            uring = std::make_unique<UringReader>(std::min<size_t>(config.queueDepth, URING_BATCH));
+            if (!uring->ok()) uring.reset();
+        }
+
+        std::vector<size_t> batch;
+        std::vector<std::string> batchPaths;
+        std::vector<std::vector<uchar>> batchBytes;
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            if (stages.wantsDecode && !stages.wantsDecode(i, threadId)) continue;
+
+            if (!uring) {
+                PipelineItem item;
+                item.index = i;
+                readFile(paths[i], item.bytes); // empty bytes = unreadable, analyze gets an empty Mat
+                item.ticket = DecodeTicket(item.bytes.data(), item.bytes.size(), options);
+                if (!readQueue.push(std::move(item))) break;
+                continue;
+            }
+
+            // io_uring: collect a batch, read it with one submit
+            batch.push_back(i);
+            batchPaths.push_back(paths[i]);
+            if (batch.size() < uring->capacity() && next < paths.size()) continue;
+
+            flushUringBatch(*uring, batch, batchPaths, batchBytes, readQueue, options);
+            if (!uring->ok()) uring.reset(); // the ring failed, plain reads from now on
+        }
+        if (uring && !batch.empty()) flushUringBatch(*uring, batch, batchPaths, batchBytes, readQueue, options);
+        if (--readersLeft == 0) readQueue.close();
+    };
+
+    auto decoder = [&](int) {
+        PipelineItem item;
+        while (readQueue.pop(item)) {
+            item.image = decodeImage(item.bytes.data(), item.bytes.size(), options);
+            item.bytes.reset(); // free the compressed copy before queueing
+            if (!decodeQueue.push(std::move(item))) break;
+        }
+        if (--decodersLeft == 0) decodeQueue.close();
+    };
+
+    auto analyzer = [&](int threadId) {
+        PipelineItem item;
+        while (decodeQueue.pop(item)) {
+            stages.analyze(item.index, item.image, threadId);
+            item.image.release();
+            item.ticket.release(); // not only once the next image arrives
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < config.readers; t++) threads.emplace_back(reader, t);
+    for (int t = 0, n = decodersLeft; t < n; t++) threads.emplace_back(decoder, t);
+    for (int t = 0, n = resolveThreadCount(config.analyzers); t < n; t++) threads.emplace_back(analyzer, t);
+
+    for (auto& thread : threads) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+// Box a --level 1 decode is reduced into, enough for libjpeg to walk every scan
+constexpr int VALIDATION_TARGET_SIZE = 256;
+
+DecodeOptions decodeOptionsForLevel(int level)
+{
+    DecodeOptions options;
+    options.reduced = level == VALIDATION_REDUCED;
+    options.targetWidth = VALIDATION_TARGET_SIZE;
+    options.targetHeight = VALIDATION_TARGET_SIZE;
+    return options;
+}
+
+bool validateImageFile(const std::string& path, int& level, int& width, int& height, cv::Mat* pixels)
+{
+    width = height = 0;
+    if (level == VALIDATION_HEADER) {
+        FileBuffer bytes;
+        ImageStructure structure = ImageStructure::BROKEN;
+        if (readFile(path, bytes)) {
+            structure = checkImageStructure(bytes.data(), bytes.size(), width, height);
+        }
+        if (structure != ImageStructure::UNKNOWN) return structure == ImageStructure::OK;
+        level = VALIDATION_FULL; // format we can't check from its structure, decode it
+    }
+
+    DecodeOptions options = decodeOptionsForLevel(level);
+    DecodeTicket ticket(path, options); // held until pixels went to the caller, hashing them is cheap
+    cv::Mat image;
+    try {
+        image = loadImage(path, options);
+    }
+    catch (...) {
+        // OpenCV exception - image is corrupted
+        image = cv::Mat();
+    }
+    if (image.empty()) return false;
+
+    width = image.cols;
+    height = image.rows;
+    if (level == VALIDATION_REDUCED) readImageSize(path, width, height); // decoded size is scaled down
+    if (pixels) *pixels = std::move(image);
+    return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// How an image should be decoded.
+// With reduced set, JPEGs larger than the target box are decoded at 1/2, 1/4 or 1/8
+// scale by libjpeg (IMREAD_REDUCED_*), so we never build pixels we throw away later.
+struct DecodeOptions {
+    bool reduced = false;
+    bool grayscale = false;
+    int targetWidth = 0; // box the caller shrinks the image into (0 = keep full size)
+    int targetHeight = 0;
+};
+
+// Reads width/height from the file header without decoding (JPEG, PNG, WebP, GIF, BMP).
+bool parseImageSize(const uint8_t* data, size_t size, int& width, int& height);
+bool readImageSize(const std::string& path, int& width, int& height);
+
+enum class ImageStructure {
+    OK,
+    BROKEN,  // truncated or damaged container
+    UNKNOWN, // format we can't check without decoding
+};
+
+// Checks magic bytes and container structure without decoding any pixels:
+// JPEG SOI..EOI, PNG chunk CRCs up to IEND, WebP RIFF size, GIF trailer, BMP file size.
+// Fills width/height from the header on success.
+ImageStructure checkImageStructure(const uint8_t* data, size_t size, int& width, int& height);
+
+// Largest power of two (1, 2, 4, 8) the image can be shrunk by and still cover the target box.
+int reducedScale(int width, int height, int targetWidth, int targetHeight);
+int decodeFlags(const DecodeOptions& options, int width, int height);
+
+// --io: how file bytes get to cv::imdecode, picked once at startup and used by every tool
+enum class IoBackend {
+    IMREAD, // cv::imread reads the file itself (default)
+    READ,   // read() into a buffer
+    MMAP,   // map the file (MADV_SEQUENTIAL/WILLNEED) and decode straight from the page cache
+    URING,  // pipeline readers batch their reads through io_uring, read() everywhere else
+};
+
+bool parseIoBackend(const std::string& name, IoBackend& backend); // "imread", "read", "mmap", "uring"
+void setIoBackend(IoBackend backend);
+IoBackend ioBackend();
+
+// Whole file contents, either read into memory or memory mapped. Move only.
+class FileBuffer {
+  public:
+    FileBuffer() = default;
+    ~FileBuffer() { reset(); }
+    FileBuffer(FileBuffer&& other) noexcept { *this = std::move(other); }
+    FileBuffer& operator=(FileBuffer&& other) noexcept;
+    FileBuffer(const FileBuffer&) = delete;
+    FileBuffer& operator=(const FileBuffer&) = delete;
+
+    const uchar* data() const { return mapped ? static_cast<const uchar*>(mapped) : owned.data(); }
+    size_t size() const { return mapped ? mappedSize : owned.size(); }
+    bool empty() const { return size() == 0; }
+
+    std::vector<uchar>& bytes() { return owned; }
+    bool map(const std::string& path);
+    void reset();
+
+  private:
+    std::vector<uchar> owned;
+    void* mapped = nullptr;
+    size_t mappedSize = 0;
+};
+
+// Reads with the selected backend (mmap or read())
+bool readFile(const std::string& path, FileBuffer& buffer);
+
+// --max-mem / --nice, set once at startup. Enforced by DecodeTicket.
+struct DecodeLimits {
+    size_t maxBytes = 0;         // pixels all decodes in flight may hold together (0 = no limit)
+    bool yieldUnderLoad = false; // wait while the rest of the system keeps every core busy
+};
+void setDecodeLimits(const DecodeLimits& limits);
+
+// Taken before a decode and held until its pixels are dropped. Waits until the decoded size (from the file header,
+// at the reduced scale for reduced decodes) fits in the budget next to the decodes in flight. A single image
+// larger than the whole budget still runs, on its own. Costs nothing without limits.
+class DecodeTicket {
+  public:
+    DecodeTicket() = default;
+    DecodeTicket(const std::string& path, const DecodeOptions& options);
+    DecodeTicket(const uchar* data, size_t size, const DecodeOptions& options); // file already read, header from memory
+    ~DecodeTicket() { release(); }
+    DecodeTicket(DecodeTicket&& other) noexcept { *this = std::move(other); }
+    DecodeTicket& operator=(DecodeTicket&& other) noexcept;
+    DecodeTicket(const DecodeTicket&) = delete;
+    DecodeTicket& operator=(const DecodeTicket&) = delete;
+
+    void release();
+
+  private:
+    void acquire(int width, int height, const DecodeOptions& options);
+
+    size_t bytes = 0;
+    bool held = false;
+};
+
+struct ImageWorkspace;
+
+cv::Mat loadImage(const std::string& path, const DecodeOptions& options);
+// Same, but the file is read into and decoded into the workspace's buffers: the result is only valid until the
+// thread's next image. --io imread can't be pointed at a buffer and allocates as before.
+cv::Mat loadImage(const std::string& path, const DecodeOptions& options, ImageWorkspace& workspace);
+cv::Mat decodeImage(const uchar* data, size_t size, const DecodeOptions& options); // no copy, data is wrapped in a Mat header
+cv::Mat decodeImage(const std::vector<uchar>& bytes, const DecodeOptions& options);
+
+// wpu-validator --level (ValidationLevel) checks.
+// level is raised to VALIDATION_FULL for formats a header check can't judge, width/height are the real image size.
+// pixels gets the decoded image (header checks decode nothing and leave it empty).
+DecodeOptions decodeOptionsForLevel(int level);
+bool validateImageFile(const std::string& path, int& level, int& width, int& height, cv::Mat* pixels = nullptr);
+
+// Reads the whole file, telling the kernel we'll stream it (posix_fadvise)
+bool readFileBytes(const std::string& path, std::vector<uchar>& bytes);
+
+// read -> decode -> analyze, every stage with its own threads and a bounded queue in between,
+// so slow disks and slow CPUs overlap instead of waiting on each other.
+struct PipelineConfig {
+    int readers = 2;
+    int decoders = 0; // 0 = one per core
+    int analyzers = 0;
+    size_t queueDepth = 16; // images allowed to wait between two stages
+};
+
+// "readers:decoders:analyzers[:queue]", e.g. "2:8:4" or "1:6:6:32"
+bool parsePipelineSpec(const std::string& spec, PipelineConfig& config);
+
+struct PipelineStages {
+    // Runs on a reader thread before the file is read, return false if the image was
+    // handled without decoding (e.g. cache hit). Optional.
+    std::function<bool(size_t index, int threadId)> wantsDecode;
+
+    // Gets an empty Mat if the file couldn't be read or decoded.
+    std::function<void(size_t index, cv::Mat& image, int threadId)> analyze;
+};
+
+void runImagePipeline(const std::vector<std::string>& paths, const PipelineConfig& config,
+                      const DecodeOptions& options, const PipelineStages& stages);
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <argparse/argparse.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "analysis.hpp"
+#include "dedupe.hpp"
+#include "features.hpp"
+#include "globals.hpp"
+#include "imageio.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
+#include "utils.hpp"
+#include "workspace.hpp"
+
+// wpu-index: builds the feature cache for wpu-validator, wpu-darkscore, wpu-grouper (and wpu-palette)
+// with one full decode per image instead of one per tool. Every analysis runs on the same pixels.
+
+std::mutex resultsMutex;
+std::vector<std::string> corruptFiles;
+std::atomic<size_t> decodedCount{0};
+std::atomic<size_t> cachedCount{0};
+
+// What the cache doesn't know about an image yet
+struct MissingFeatures {
+    bool validity = true; // verdict of a full decode, with width and height
+    bool darkness = true;
+    bool colors = true;  // grouper colors of the chosen algorithm
+    bool palette = true; // only with --palette
+    bool hash = true;    // validator --dedupe
+
+    bool any() const { return validity || darkness || colors || palette || hash; }
+};
+
+MissingFeatures missingFeatures(const FeatureRecord& record, int colorsKey, bool palette)
+{
+    auto hasColors = [&record](int key) {
+        auto it = record.colors.find(key);
+        return it != record.colors.end() && !it->second.empty();
+    };
+
+    MissingFeatures missing;
+    missing.validity = record.valid < 0 || record.validLevel < VALIDATION_FULL;
+    missing.darkness = record.darkness < 0;
+    missing.colors = !hasColors(colorsKey);
+    missing.palette = palette && !hasColors(PALETTE_CACHE_KEY + PALETTE_COLORS);
+    missing.hash = !record.hasDhash;
+    return missing;
+}
+
+// One decode, then every missing feature from the same Mat. false if the image can't be decoded.
+bool indexImage(const std::string& path, FeatureRecord& record, const MissingFeatures& missing, ALGORITHM algorithm)
+{
+    ImageWorkspace& workspace = ImageWorkspace::forThisThread();
+    DecodeOptions options; // full decode, the validator's --level 2 verdict needs it
+    DecodeTicket ticket(path, options);
+
+    cv::Mat image;
+    try {
+        image = loadImage(path, options, workspace);
+    }
+    catch (...) {
+        // OpenCV exception - image is corrupted
+        image = cv::Mat();
+    }
+
+    record.valid = image.empty() ? 0 : 1;
+    record.validLevel = VALIDATION_FULL;
+    if (image.empty()) return false;
+    record.width = image.cols;
+    record.height = image.rows;
+
+    if (missing.darkness) {
+        ProfileScope profile(Stage::DARKNESS);
+        record.darkness = computeDarkness(image, workspace);
+    }
+    if (missing.hash) {
+        ProfileScope profile(Stage::HASH);
+        record.dhash = dHash(image);
+        record.hasDhash = true;
+    }
+    if (missing.palette) {
+        // extractPalette shrinks to its own thumbnail, the shrunk copy below isn't needed for it
+        ProfileScope profile(Stage::COLORS);
+        record.colors[PALETTE_CACHE_KEY + PALETTE_COLORS] = toCachedPalette(extractPalette(image, PALETTE_COLORS, workspace));
+    }
+    if (missing.colors) {
+        // like wpu-grouper: 800x600 for everything but the histogram
+        cv::Mat sample = image;
+        if (algorithm != HISTOGRAM && (image.cols > 800 || image.rows > 600)) {
+            ProfileScope profile(Stage::RESIZE);
+            double scale = std::min(800.0 / image.cols, 600.0 / image.rows);
+            cv::Size size = scaledSize(image, scale);
+            sample = ImageWorkspace::view(workspace.shrunk, size.height, size.width, image.type());
+            cv::resize(image, sample, cv::Size(), scale, scale);
+        }
+        ProfileScope profile(Stage::COLORS);
+        record.colors[colorsCacheKey(algorithm)] = toCachedColors(extractDominantColors(sample, algorithm, workspace));
+    }
+    return true;
+}
+
+void indexFolder(const std::string& root, FeatureCache& cache, ALGORITHM algorithm, bool palette, int requestedThreads)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    int numThreads = resolveThreadCount(requestedThreads);
+    std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+
+    Progress progress("index");
+    progress.addCounter("decoded", []() { return (size_t)decodedCount; });
+    progress.addCounter("corrupt", []() {
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        return corruptFiles.size();
+    });
+    progress.start();
+
+    // images are indexed while the scan is still finding more
+    scanAndProcess(root, numThreads, [&](const std::string& path, int) {
+        FeatureRecord record;
+        bool hit;
+        {
+            ProfileScope profile(Stage::CACHE);
+            hit = cache.lookup(path, record);
+        }
+        bool knownCorrupt = hit && record.valid == 0 && record.validLevel >= VALIDATION_FULL;
+        MissingFeatures missing = missingFeatures(record, colorsCacheKey(algorithm), palette);
+
+        if (knownCorrupt || !missing.any()) {
+            ++cachedCount;
+        }
+        else {
+            ++decodedCount;
+            if (!indexImage(path, record, missing, algorithm)) knownCorrupt = true;
+            cache.store(path, record);
+        }
+
+        if (knownCorrupt) {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            corruptFiles.push_back(path);
+        }
+        ++progress.done;
+    }, &progress.total);
+
+    progress.stop();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    size_t total = progress.total;
+    std::cout << "\nIndexed " << total << " images in " << duration.count() << "ms: " << decodedCount << " decoded (once each), "
+              << cachedCount << " already in the cache, " << corruptFiles.size() << " corrupt" << std::endl;
+    if (decodedCount > 0) {
+        std::cout << "Average: " << std::fixed << std::setprecision(2) << (double)duration.count() / decodedCount
+                  << "ms per decoded image" << std::endl;
+    }
+
+    std::sort(corruptFiles.begin(), corruptFiles.end());
+    for (const auto& path : corruptFiles) std::cout << "Corrupt: " << path << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    freopen("/dev/null", "w", stderr); // suppress errors
+
+    argparse::ArgumentParser program("index", VERSION);
+    program.add_description(R"(decode every image once and fill the feature cache for all wpu tools:
+    full decode verdict, size and perceptual hash (wpu-validator, --dedupe), darkness (wpu-darkscore),
+    dominant colors (wpu-grouper -a) and with --palette the wpu-palette palette.
+    The tools then only decode images that changed since.)");
+
+    program.add_argument("-i", "--input")
+        .required()
+        .help("folder containing images (recursive)");
+
+    program.add_argument("-a", "--algorithm")
+        .default_value(0)
+        .metavar("0/1/2/3/4")
+        .scan<'i', int>()
+        .help("colors for which wpu-grouper algorithm (KMeans = 0, KMeansOptimized = 1, Histogram = 2, KMeansFast = 3, Palette = 4)");
+
+    program.add_argument("-p", "--palette")
+        .default_value(false)
+        .implicit_value(true)
+        .help("also the 8 color palette of wpu-palette");
+
+    program.add_argument("-t", "--threads")
+        .default_value(0)
+        .metavar("N")
+        .scan<'i', int>()
+        .help("number of worker threads (0 = one per core)");
+
+    program.add_argument("--max-mem")
+        .metavar("size")
+        .help("cap the memory decoded images may take together, decodes wait for room (sizes come from the file headers)");
+
+    program.add_argument("--nice")
+        .default_value(false)
+        .implicit_value(true)
+        .help("run in the background: lowest CPU and I/O priority, new decodes pause while the rest of the system keeps every core busy");
+
+    program.add_argument("--profile")
+        .default_value(false)
+        .implicit_value(true)
+        .help("print how long every stage took and write a Chrome trace (chrome://tracing) to index-trace.json");
+
+    program.add_argument("--progress")
+        .default_value(std::string("auto"))
+        .metavar("mode")
+        .help("how progress is shown: tty (redrawn in place), plain (a line every 10s), json (a JSON object per second) or none, auto = tty on a terminal, plain otherwise");
+
+    program.add_argument("--metrics")
+        .metavar("file.prom")
+        .help("also write progress as a Prometheus textfile (node_exporter textfile collector), replaced every 5s");
+
+    program.add_argument("--io")
+        .default_value(std::string("imread"))
+        .metavar("backend")
+        .help("how image files are read: imread, read or mmap (decode from the page cache)");
+
+    program.add_argument("--cache")
+        .default_value(FeatureCache::defaultPath())
+        .metavar("features.db")
+        .help("feature cache shared by all wpu tools, the one to fill");
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << program;
+        return 1;
+    }
+
+    ALGORITHM algorithm = KMEANS;
+    switch (program.get<int>("algorithm")) {
+        case 0: algorithm = KMEANS; break;
+        case 1: algorithm = KMEANSOPT; break;
+        case 2: algorithm = HISTOGRAM; break;
+        case 3: algorithm = KMEANSFAST; break;
+        case 4: algorithm = PALETTE; break;
+        default:
+            std::cout << "Invalid --algorithm: " << program.get<int>("algorithm") << std::endl;
+            return 1;
+    }
+
+    IoBackend io;
+    if (!parseIoBackend(program.get<std::string>("io"), io)) {
+        std::cout << "Invalid --io: " << program.get<std::string>("io") << std::endl;
+        return 1;
+    }
+    setIoBackend(io);
+
+    ProgressSettings progressSettings;
+    if (!parseProgressMode(program.get<std::string>("progress"), progressSettings.mode)) {
+        std::cout << "Invalid --progress: " << program.get<std::string>("progress") << std::endl;
+        return 1;
+    }
+    progressSettings.metricsPath = program.present("metrics").value_or("");
+    setProgressSettings(progressSettings);
+
+    DecodeLimits limits;
+    if (auto maxMem = program.present("max-mem")) {
+        if (!parseByteSize(*maxMem, limits.maxBytes) || limits.maxBytes == 0) {
+            std::cout << "Invalid --max-mem: " << *maxMem << std::endl;
+            return 1;
+        }
+    }
+    if (program.get<bool>("nice")) {
+        limits.yieldUnderLoad = true;
+        if (!enterIdlePriority()) std::cout << "Could not lower every priority, --nice is only partly in effect" << std::endl;
+    }
+    setDecodeLimits(limits);
+
+    bool profile = program.get<bool>("profile");
+    if (profile) Profile::enable();
+
+    std::string inputPath = program.get<std::string>("input");
+    if (!std::filesystem::is_directory(inputPath)) {
+        std::cout << "Not a folder: " << inputPath << std::endl;
+        return 1;
+    }
+    // canonical root, the paths are the cache keys the other tools look up
+    std::string root = std::filesystem::canonical(inputPath).string();
+
+    FeatureCache cache(program.get<std::string>("cache"));
+    if (cache.load()) {
+        std::cout << "Loaded " << cache.size() << " cached entries from " << cache.filePath() << std::endl;
+    }
+
+    std::cout << "Indexing folder: " << root << std::endl;
+    indexFolder(root, cache, algorithm, program.get<bool>("palette"), program.get<int>("threads"));
+
+    if (!cache.save()) {
+        std::cout << "Could not save feature cache to " << cache.filePath() << std::endl;
+        return 1;
+    }
+    std::cout << "Feature cache written to " << cache.filePath() << " (" << cache.size() << " entries)" << std::endl;
+
+    if (profile) {
+        Profile::report(std::cout);
+        if (Profile::writeTrace("index-trace.json")) std::cout << "\nTrace written to index-trace.json" << std::endl;
+    }
+
+    return 0;
+}
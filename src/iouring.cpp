@@ -0,0 +1,183 @@
+#include "iouring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int ioUringSetup(unsigned entries, io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+UringReader::UringReader(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(entries, &params);
+    if (fd < 0) return;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        close(fd);
+        return;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    }
+    else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            munmap(sqRing, sqRingSize);
+            sqRing = nullptr;
+            close(fd);
+            return;
+        }
+    }
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = nullptr;
+        if (cqRing != sqRing) munmap(cqRing, cqRingSize);
+        munmap(sqRing, sqRingSize);
+        sqRing = cqRing = nullptr;
+        close(fd);
+        return;
+    }
+
+    auto* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    auto* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    sqEntries = params.sq_entries;
+    ringFd = fd;
+}
+
+UringReader::~UringReader()
+{
+    if (ringFd < 0) return;
+    munmap(sqes, sqesSize);
+    if (cqRing != sqRing) munmap(cqRing, cqRingSize);
+    munmap(sqRing, sqRingSize);
+    close(ringFd);
+}
+
+// rest of a short read, done synchronously
+static bool finishRead(int fd, std::vector<uint8_t>& buffer, size_t done)
+{
+    while (done < buffer.size()) {
+        ssize_t n = pread(fd, buffer.data() + done, buffer.size() - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    buffer.resize(done);
+    return done > 0;
+}
+
+void UringReader::readFiles(const std::vector<std::string>& paths, std::vector<std::vector<uint8_t>>& buffers)
+{
+    buffers.assign(paths.size(), {});
+    std::vector<int> fds(paths.size(), -1);
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > UINT32_MAX) {
+            close(fd);
+            continue;
+        }
+        posix_fadvise(fd, 0, st.st_size, POSIX_FADV_SEQUENTIAL);
+        buffers[i].resize(st.st_size);
+        fds[i] = fd;
+    }
+
+    size_t next = 0;
+    unsigned inFlight = 0;   // queued in the ring, not completed yet
+    unsigned unsubmitted = 0; // queued but not taken by the kernel yet
+    while (!broken) { // a broken ring still holds stale entries of an earlier batch, everything is read below
+        // queue as many reads as the ring takes
+        unsigned tail = *sqTail;
+        unsigned queued = 0;
+        while (next < paths.size() && inFlight + queued < sqEntries) {
+            size_t i = next++;
+            if (fds[i] < 0) continue;
+
+            unsigned slot = (tail + queued) & *sqMask;
+            auto* sqe = static_cast<io_uring_sqe*>(sqes) + slot;
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fds[i];
+            sqe->addr = reinterpret_cast<uint64_t>(buffers[i].data());
+            sqe->len = (uint32_t)buffers[i].size();
+            sqe->off = 0;
+            sqe->user_data = i;
+            sqArray[slot] = slot;
+            queued++;
+        }
+        if (queued > 0) __atomic_store_n(sqTail, tail + queued, __ATOMIC_RELEASE);
+        inFlight += queued;
+        unsubmitted += queued;
+        if (inFlight == 0) break;
+
+        int ret = ioUringEnter(ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            if (inFlight == unsubmitted) { // kernel holds none of our buffers, finish with plain reads below
+                broken = true;              // stale entries are still in the ring, never submit again
+                break;
+            }
+            ret = 0;                            // wait for what the kernel already took
+        }
+        unsubmitted -= std::min<unsigned>(ret, unsubmitted);
+
+        unsigned head = *cqHead;
+        unsigned cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != cqTailNow; head++) {
+            auto* cqe = static_cast<io_uring_cqe*>(cqes) + (head & *cqMask);
+            size_t i = cqe->user_data;
+            if (cqe->res < 0) finishRead(fds[i], buffers[i], 0); // retry synchronously (EAGAIN, EINTR...)
+            else if ((size_t)cqe->res < buffers[i].size()) finishRead(fds[i], buffers[i], cqe->res);
+            close(fds[i]);
+            fds[i] = -1;
+            inFlight--;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // only left over if the ring failed (now or in an earlier batch)
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (fds[i] < 0) continue;
+        finishRead(fds[i], buffers[i], 0);
+        close(fds[i]);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Minimal io_uring file reader on raw syscalls (no liburing dependency).
+// Each thread owns its own reader, a whole batch of files is read with one submit.
+class UringReader {
+  public:
+    explicit UringReader(unsigned entries = 32);
+    ~UringReader();
+
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+
+    // false if the kernel has no io_uring (or it's blocked), callers fall back to read()
+    bool ok() const { return ringFd >= 0 && !broken; }
+    unsigned capacity() const { return sqEntries; }
+
+    // buffers[i] gets the whole of paths[i], left empty if the file can't be read
+    void readFiles(const std::vector<std::string>& paths, std::vector<std::vector<uint8_t>>& buffers);
+
+  private:
+    int ringFd = -1;
+    bool broken = false;
+    unsigned sqEntries = 0;
+
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    void* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    void* cqes = nullptr;
+};
@@ -0,0 +1,149 @@
+#include "opencl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "analysis.hpp"
+
+static AnalysisBackend backendInUse = AnalysisBackend::CPU;
+static size_t batchLimit = OPENCL_BATCH_SIZE;
+
+bool parseAnalysisBackend(const std::string& name, AnalysisBackend& backend)
+{
+    // clang-format off
+    if      (name == "cpu")    backend = AnalysisBackend::CPU;
+    else if (name == "opencl") backend = AnalysisBackend::OPENCL;
+    else return false;
+    // clang-format on
+    return true;
+}
+
+bool setAnalysisBackend(AnalysisBackend backend, int batchSize)
+{
+    if (backend == AnalysisBackend::OPENCL) {
+        if (!cv::ocl::haveOpenCL()) return false;
+        cv::ocl::setUseOpenCL(true);
+        if (!cv::ocl::useOpenCL()) return false; // built with OpenCL but no device
+    }
+    backendInUse = backend;
+    batchLimit = std::max(1, batchSize);
+    return true;
+}
+
+AnalysisBackend analysisBackend() { return backendInUse; }
+
+std::string openclDeviceName() { return cv::ocl::useOpenCL() ? cv::ocl::Device::getDefault().name() : ""; }
+
+static void runOnCpu(OpenclJob& job)
+{
+    cv::Mat image = *job.image;
+    if (job.scale < 1.0) {
+        cv::Mat shrunk;
+        if (job.shrunk) shrunk = *job.shrunk;
+        cv::resize(image, shrunk, cv::Size(), job.scale, job.scale);
+        if (job.shrunk) *job.shrunk = shrunk;
+        image = shrunk;
+    }
+    else if (job.shrunk) {
+        image.copyTo(*job.shrunk);
+    }
+    if (job.hsv) cv::cvtColor(image, *job.hsv, cv::COLOR_BGR2HSV);
+    if (job.darkness) *job.darkness = computeDarkness(image);
+}
+
+// Device memory of the submitting thread, kept from batch to batch like an ImageWorkspace
+struct DeviceBuffers {
+    std::vector<cv::UMat> source, shrunk, hsv, gray, rowSums;
+
+    void fit(size_t n)
+    {
+        for (auto* buffers : {&source, &shrunk, &hsv, &gray, &rowSums}) {
+            if (buffers->size() < n) buffers->resize(n);
+        }
+    }
+};
+
+void submitBatch(const std::vector<OpenclJob*>& jobs)
+{
+    thread_local DeviceBuffers device;
+    device.fit(jobs.size());
+
+    try {
+        // queue everything, nothing below waits for the device
+        for (size_t i = 0; i < jobs.size(); i++) {
+            OpenclJob& job = *jobs[i];
+            job.image->copyTo(device.source[i]);
+            cv::UMat* current = &device.source[i];
+            if (job.scale < 1.0) {
+                cv::resize(*current, device.shrunk[i], cv::Size(), job.scale, job.scale);
+                current = &device.shrunk[i];
+            }
+            if (job.hsv) cv::cvtColor(*current, device.hsv[i], cv::COLOR_BGR2HSV);
+            if (job.darkness) {
+                // row sums instead of cv::mean, which waits for its result on every image
+                const cv::UMat* luma = current;
+                if (current->channels() != 1) {
+                    cv::cvtColor(*current, device.gray[i], cv::COLOR_BGR2GRAY);
+                    luma = &device.gray[i];
+                }
+                cv::reduce(*luma, device.rowSums[i], 1, cv::REDUCE_SUM, CV_32S);
+            }
+        }
+
+        // the first read waits for the queue, the rest are already done
+        for (size_t i = 0; i < jobs.size(); i++) {
+            OpenclJob& job = *jobs[i];
+            if (job.shrunk) (job.scale < 1.0 ? device.shrunk[i] : device.source[i]).copyTo(*job.shrunk);
+            if (job.hsv) device.hsv[i].copyTo(*job.hsv);
+            if (job.darkness) {
+                cv::Mat sums = device.rowSums[i].getMat(cv::ACCESS_READ);
+                int64_t total = 0;
+                for (int y = 0; y < sums.rows; y++) total += sums.at<int>(y);
+                double pixels = (double)sums.rows * (job.scale < 1.0 ? device.shrunk[i].cols : job.image->cols);
+                *job.darkness = pixels > 0 ? 1.0 - total / pixels / 255.0 : 1.0;
+            }
+        }
+    }
+    catch (const cv::Exception&) {
+        for (OpenclJob* job : jobs) runOnCpu(*job);
+    }
+}
+
+// The batch being collected, replaced by a new one as soon as a worker takes it to the device
+struct Batch {
+    std::vector<OpenclJob*> jobs;
+    bool done = false;
+};
+
+static std::mutex batchMutex;
+static std::condition_variable batchChanged;
+static std::shared_ptr<Batch> collecting;
+
+void runOnDevice(OpenclJob& job)
+{
+    std::unique_lock<std::mutex> lock(batchMutex);
+    if (!collecting) collecting = std::make_shared<Batch>();
+    std::shared_ptr<Batch> batch = collecting;
+    batch->jobs.push_back(&job);
+
+    if (batch->jobs.size() < batchLimit) {
+        batchChanged.wait_for(lock, std::chrono::microseconds(OPENCL_BATCH_WAIT_US), [&] { return collecting != batch; });
+    }
+
+    if (collecting == batch) {
+        // full, or nobody else came in time: this worker submits it
+        collecting.reset();
+        lock.unlock();
+        batchChanged.notify_all();
+        submitBatch(batch->jobs);
+        lock.lock();
+        batch->done = true;
+        batchChanged.notify_all();
+        return;
+    }
+    batchChanged.wait(lock, [&] { return batch->done; });
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+constexpr int OPENCL_BATCH_SIZE = 8;
+// a batch that doesn't fill up is submitted after this, so a lone last image doesn't wait for company
+constexpr int OPENCL_BATCH_WAIT_US = 2000;
+
+// --backend: where the resize, color conversion and darkness stages run, picked once at startup
+enum class AnalysisBackend {
+    CPU,    // cv::Mat (default)
+    OPENCL, // cv::UMat through OpenCV's transparent API, several images per device submission
+};
+
+bool parseAnalysisBackend(const std::string& name, AnalysisBackend& backend); // "cpu", "opencl"
+// false if OpenCV has no usable OpenCL device, the CPU stays in use then.
+// batchSize = images that go to the device together, more than the worker threads can never fill up.
+bool setAnalysisBackend(AnalysisBackend backend, int batchSize = OPENCL_BATCH_SIZE);
+AnalysisBackend analysisBackend();
+std::string openclDeviceName();
+
+// One image for the device. Every output that is set gets filled, sized like the image after the shrink.
+// Outputs may be ImageWorkspace views, they are written in place when size and type match.
+struct OpenclJob {
+    const cv::Mat* image = nullptr;
+    double scale = 1.0;          // < 1 shrinks first, like cv::resize(image, shrunk, cv::Size(), scale, scale)
+    cv::Mat* shrunk = nullptr;   // the resized image
+    cv::Mat* hsv = nullptr;      // cv::COLOR_BGR2HSV of it
+    double* darkness = nullptr;  // 0 = white, 1 = black, like computeDarkness
+};
+
+// Uploads and queues the kernels of every job, then reads all results back: one wait on the device for all of them.
+// Whatever fails on the device (no memory, driver error) is done on the CPU instead.
+void submitBatch(const std::vector<OpenclJob*>& jobs);
+
+// Called from the worker threads: the job joins the batch being collected and this returns once the batch ran.
+// The worker that fills a batch (or waited OPENCL_BATCH_WAIT_US for it) submits it for everyone in it.
+void runOnDevice(OpenclJob& job);
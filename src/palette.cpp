@@ -1,81 +1,39 @@
 #include <algorithm>
+#include <argparse/argparse.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
 #include <opencv2/opencv.hpp>
 #include <string>
 #include <vector>
 
-struct ColorInfo {
-    cv::Vec3b color;
-    int count;
-    double saturation;
-    double brightness;
-    double hue;
-};
+#include "analysis.hpp"
+#include "features.hpp"
+#include "globals.hpp"
+#include "imageio.hpp"
+#include "progress.hpp"
+#include "utils.hpp"
 
 struct PaletteGroup {
-    std::vector<ColorInfo> colors;
+    std::vector<PaletteColor> colors;
     std::string name;
 };
 
 class ColorPaletteExtractor {
   private:
     cv::Mat image;
-    std::vector<ColorInfo> palette;
-
-    // Convert BGR to HSV and calculate color properties
-    void calculateColorProperties(ColorInfo& colorInfo)
-    {
-        cv::Mat bgrPixel(1, 1, CV_8UC3, cv::Scalar(colorInfo.color[0], colorInfo.color[1], colorInfo.color[2]));
-        cv::Mat hsvPixel;
-        cv::cvtColor(bgrPixel, hsvPixel, cv::COLOR_BGR2HSV);
-
-        cv::Vec3b hsv = hsvPixel.at<cv::Vec3b>(0, 0);
-        colorInfo.hue = hsv[0] * 2.0; // OpenCV hue is 0-179, convert to 0-359
-        colorInfo.saturation = hsv[1] / 255.0;
-        colorInfo.brightness = hsv[2] / 255.0;
-    }
+    std::vector<PaletteColor> palette;
 
     // Extract dominant colors using K-means clustering
     void extractPalette(int k = 8)
     {
         if (image.empty()) return;
-
-        // Reshape image to a 2D array of pixels
-        cv::Mat data = image.reshape(1, image.rows * image.cols);
-        data.convertTo(data, CV_32F);
-
-        // Apply K-means clustering
-        cv::Mat labels, centers;
-        cv::kmeans(data, k, labels,
-                   cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 20, 1.0),
-                   3, cv::KMEANS_PP_CENTERS, centers);
-
-        // Count occurrences of each cluster
-        std::vector<int> counts(k, 0);
-        for (int i = 0; i < labels.rows; i++) {
-            counts[labels.at<int>(i)]++;
-        }
-
-        // Convert centers to color info
-        palette.reserve(k);
-        palette.clear();
-        for (int i = 0; i < k; i++) {
-            ColorInfo colorInfo;
-            colorInfo.color = cv::Vec3b(
-                static_cast<uchar>(centers.at<float>(i, 0)),
-                static_cast<uchar>(centers.at<float>(i, 1)),
-                static_cast<uchar>(centers.at<float>(i, 2)));
-            colorInfo.count = counts[i];
-            calculateColorProperties(colorInfo);
-            palette.push_back(colorInfo);
-        }
-
-        // Sort by count (most dominant first)
-        std::sort(palette.begin(), palette.end(),
-                  [](const ColorInfo& a, const ColorInfo& b) {
-                      return a.count > b.count;
-                  });
+        palette = ::extractPalette(image, k);
     }
 
     // Group colors by characteristics
@@ -84,31 +42,9 @@ class ColorPaletteExtractor {
         std::map<std::string, PaletteGroup> groups;
 
         for (const auto& color : palette) {
-            // Vibrant colors: high saturation and brightness
-            if (color.saturation > 0.6 && color.brightness > 0.6) {
-                groups["Vibrant"].colors.push_back(color);
-                groups["Vibrant"].name = "Vibrant";
-            }
-            // Dark colors: low brightness
-            else if (color.brightness < 0.3) {
-                groups["Dark"].colors.push_back(color);
-                groups["Dark"].name = "Dark";
-            }
-            // Light colors: high brightness, low saturation
-            else if (color.brightness > 0.8 && color.saturation < 0.3) {
-                groups["Light"].colors.push_back(color);
-                groups["Light"].name = "Light";
-            }
-            // Muted colors: medium brightness, low saturation
-            else if (color.saturation < 0.4) {
-                groups["Muted"].colors.push_back(color);
-                groups["Muted"].name = "Muted";
-            }
-            // Medium colors: everything else
-            else {
-                groups["Medium"].colors.push_back(color);
-                groups["Medium"].name = "Medium";
-            }
+            std::string name = paletteGroupName(color);
+            groups[name].colors.push_back(color);
+            groups[name].name = name;
         }
 
         return groups;
@@ -241,30 +177,248 @@ class ColorPaletteExtractor {
     }
 };
 
+// Batch mode (-o / a folder): one palette per image, no windows
+struct ImagePalette {
+    std::string path;
+    std::vector<CachedColor> colors; // most dominant first, weight = share of the pixels
+};
+
+void extractPalettes(std::vector<ImagePalette>& palettes, int numColors, FeatureCache* cache, int requestedThreads)
+{
+    int numThreads = resolveThreadCount(requestedThreads);
+    std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+
+    // DCT scaled decode, the clusters come from a thumbnail anyway
+    DecodeOptions decodeOptions;
+    decodeOptions.reduced = true;
+    decodeOptions.targetWidth = 512;
+    decodeOptions.targetHeight = 512;
+
+    const int cacheKey = PALETTE_CACHE_KEY + numColors;
+    std::atomic<size_t> cached{0};
+
+    Progress progress("palette");
+    progress.total = palettes.size();
+    progress.addCounter("cached", [&cached]() { return (size_t)cached; });
+    progress.start();
+
+    parallelFor(palettes.size(), numThreads, [&](size_t i, int) {
+        ImagePalette& item = palettes[i];
+
+        FeatureRecord record;
+        bool hit = false;
+        if (cache && cache->lookup(item.path, record)) {
+            auto it = record.colors.find(cacheKey);
+            hit = it != record.colors.end() && !it->second.empty();
+            if (hit) item.colors = it->second;
+        }
+
+        if (hit) {
+            ++cached;
+        }
+        else {
+            cv::Mat image = loadImage(item.path, decodeOptions);
+            if (image.empty()) {
+                std::cout << "Warning: could not open " << item.path << std::endl;
+            }
+            else {
+                item.colors = toCachedPalette(extractPalette(image, numColors));
+                if (cache && !item.colors.empty()) {
+                    record.colors[cacheKey] = item.colors;
+                    cache->store(item.path, record);
+                }
+            }
+        }
+
+        ++progress.done;
+    });
+    progress.stop();
+    std::cout << "Palettes from cache: " << cached << std::endl;
+}
+
+// name, hex and HSV of a cached color, the same numbers the single image output shows
+static PaletteColor describe(const CachedColor& cached, std::string& hex)
+{
+    PaletteColor color;
+    color.color = cv::Vec3b(cached.b, cached.g, cached.r);
+    color.count = 0;
+    calculateColorProperties(color);
+
+    char buf[8];
+    snprintf(buf, sizeof(buf), "#%02x%02x%02x", cached.r, cached.g, cached.b);
+    hex = buf;
+    return color;
+}
+
+bool writePalettesJson(const std::string& path, const std::vector<ImagePalette>& palettes)
+{
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+
+    out << std::fixed << std::setprecision(4) << "[\n";
+    bool first = true;
+    for (const auto& item : palettes) {
+        if (item.colors.empty()) continue;
+        out << (first ? "" : ",\n") << "  {\"image\": \"" << jsonEscape(item.path) << "\", \"colors\": [";
+        first = false;
+        for (size_t i = 0; i < item.colors.size(); i++) {
+            std::string hex;
+            PaletteColor color = describe(item.colors[i], hex);
+            out << (i ? ", " : "") << "{\"hex\": \"" << hex << "\", \"weight\": " << item.colors[i].weight
+                << ", \"hue\": " << color.hue << ", \"saturation\": " << color.saturation << ", \"brightness\": " << color.brightness
+                << ", \"group\": \"" << paletteGroupName(color) << "\"}";
+        }
+        out << "]}";
+    }
+    out << "\n]\n";
+    return (bool)out;
+}
+
+// image|palette, palette = #rrggbb:weight;#rrggbb:weight...
+bool writePalettesCsv(const std::string& path, const std::vector<ImagePalette>& palettes)
+{
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+
+    out << "image" << CSV_DELIM << "palette\n" << std::fixed << std::setprecision(4);
+    for (const auto& item : palettes) {
+        if (item.colors.empty()) continue;
+        out << item.path << CSV_DELIM;
+        for (size_t i = 0; i < item.colors.size(); i++) {
+            std::string hex;
+            describe(item.colors[i], hex);
+            out << (i ? ";" : "") << hex << ":" << item.colors[i].weight;
+        }
+        out << "\n";
+    }
+    return (bool)out;
+}
+
 int main(int argc, char* argv[])
 {
-    std::string imagePath;
-    int numColors = 8;
+    argparse::ArgumentParser program("palette", VERSION);
+    program.add_description("show the most dominant colors in an image and make a color palette,\n"
+                            "or write the palettes of a whole folder to json/csv (batch mode, no windows)");
+
+    program.add_argument("input")
+        .help("image file, or a folder (recursive) for batch mode")
+        .metavar("file|folder");
+
+    program.add_argument("colors")
+        .help("number of colors")
+        .nargs(argparse::nargs_pattern::optional)
+        .default_value(PALETTE_COLORS)
+        .scan<'i', int>();
+
+    program.add_argument("-o", "--output")
+        .help("batch mode: write the palettes to this file, .json or csv otherwise [default for a folder: wpu-palette_output.json]")
+        .metavar("file.json|file.csv");
+
+    program.add_argument("-t", "--threads")
+        .default_value(0)
+        .metavar("N")
+        .scan<'i', int>()
+        .help("number of worker threads in batch mode (0 = one per core)");
+
+    program.add_argument("--io")
+        .default_value(std::string("imread"))
+        .metavar("backend")
+        .help("how image files are read: imread, read or mmap (decode from the page cache)");
+
+    program.add_argument("--progress")
+        .default_value(std::string("auto"))
+        .metavar("mode")
+        .help("batch mode: how progress is shown: tty (redrawn in place), plain (a line every 10s), json (a JSON object per second) or none, auto = tty on a terminal, plain otherwise");
+
+    program.add_argument("--metrics")
+        .metavar("file.prom")
+        .help("batch mode: also write progress as a Prometheus textfile (node_exporter textfile collector), replaced every 5s");
+
+    program.add_argument("--cache")
+        .default_value(FeatureCache::defaultPath())
+        .metavar("features.db")
+        .help("feature cache shared by all wpu tools (only changed images get decoded, grouper -a 4 reuses the palettes)");
+
+    program.add_argument("--no-cache")
+        .default_value(false)
+        .implicit_value(true)
+        .help("don't read or write the feature cache");
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << program;
+        return 1;
+    }
+
+    std::string inputPath = program.get<std::string>("input");
+    int numColors = program.get<int>("colors");
+    if (numColors < 1) {
+        std::cout << "Invalid number of colors: " << numColors << std::endl;
+        return 1;
+    }
 
-    if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <image_path> [num_colors]" << std::endl;
-        std::cout << "Enter image path: ";
-        std::getline(std::cin, imagePath);
+    IoBackend io;
+    if (!parseIoBackend(program.get<std::string>("io"), io)) {
+        std::cout << "Invalid --io: " << program.get<std::string>("io") << std::endl;
+        return 1;
     }
-    else {
-        imagePath = argv[1];
-        if (argc >= 3) {
-            numColors = std::atoi(argv[2]);
+    setIoBackend(io);
+
+    ProgressSettings progressSettings;
+    if (!parseProgressMode(program.get<std::string>("progress"), progressSettings.mode)) {
+        std::cout << "Invalid --progress: " << program.get<std::string>("progress") << std::endl;
+        return 1;
+    }
+    progressSettings.metricsPath = program.present("metrics").value_or("");
+    setProgressSettings(progressSettings);
+
+    std::string outputPath = program.present("output").value_or("");
+    bool isFolder = std::filesystem::is_directory(inputPath);
+    if (!isFolder && outputPath.empty()) {
+        ColorPaletteExtractor extractor;
+
+        if (!extractor.loadImage(inputPath)) {
+            return -1;
         }
+
+        extractor.processImage(numColors);
+        return 0;
     }
+    if (outputPath.empty()) outputPath = "wpu-palette_output.json";
 
-    ColorPaletteExtractor extractor;
+    std::vector<std::string> images;
+    getImages(images, inputPath);
+    if (images.empty()) {
+        std::cout << "No valid images found." << std::endl;
+        return 1;
+    }
 
-    if (!extractor.loadImage(imagePath)) {
-        return -1;
+    FeatureCache cache(program.get<std::string>("cache"));
+    bool useCache = !program.get<bool>("no-cache");
+    if (useCache && cache.load()) {
+        std::cout << "Loaded " << cache.size() << " cached entries from " << cache.filePath() << std::endl;
     }
 
-    extractor.processImage(numColors);
+    std::vector<ImagePalette> palettes(images.size());
+    for (size_t i = 0; i < images.size(); i++) palettes[i].path = images[i];
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    extractPalettes(palettes, numColors, useCache ? &cache : nullptr, program.get<int>("threads"));
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    std::cout << "Completed in " << duration.count() << "ms" << std::endl;
 
+    if (useCache && !cache.save()) {
+        std::cout << "Could not save feature cache to " << cache.filePath() << std::endl;
+    }
+
+    bool json = std::filesystem::path(outputPath).extension() == ".json";
+    if (!(json ? writePalettesJson(outputPath, palettes) : writePalettesCsv(outputPath, palettes))) {
+        std::cerr << "Error: Could not write " << outputPath << std::endl;
+        return 1;
+    }
+    std::cout << "Palettes written to " << outputPath << std::endl;
     return 0;
 }
@@ -0,0 +1,160 @@
+#include "prefetch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// formats the copy can keep, anything else is written as png
+static const std::vector<std::string> COPY_EXTENSIONS = {".jpg", ".jpeg", ".png", ".webp", ".bmp", ".tif", ".tiff"};
+
+Prefetcher::Prefetcher(int width, int height, std::string cacheDir)
+    : width(width), height(height), cacheDir(std::move(cacheDir)), worker(&Prefetcher::workerLoop, this)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (this->width <= 0 || this->height <= 0) return;
+    if (mkdir(this->cacheDir.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << "Error: could not create " << this->cacheDir << ": " << strerror(errno) << ", not scaling wallpapers" << std::endl;
+        this->width = this->height = 0;
+    }
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+
+    // the one on screen stays, the setter may load it again
+    for (const auto& copy : copies) {
+        if (copy != shownFile) unlink(copy.c_str());
+    }
+}
+
+void Prefetcher::prepare(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingPath = path;
+    }
+    wake.notify_one();
+}
+
+std::string Prefetcher::take(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    shownFile = (readyPath == path) ? readyFile : "";
+    return shownFile.empty() ? path : shownFile;
+}
+
+static void readAhead(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+std::string Prefetcher::scaleDown(const std::string& path)
+{
+    cv::Mat image = cv::imread(path, cv::IMREAD_COLOR);
+    if (image.empty()) return "";
+
+    // fill the screen, the setter crops: the smaller ratio would leave borders
+    double scale = std::max((double)width / image.cols, (double)height / image.rows);
+    if (scale >= 1.0) return ""; // nothing to gain, the original is read ahead already
+
+    std::string extension = ".png";
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos) {
+        std::string ext = path.substr(dot);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (std::find(COPY_EXTENSIONS.begin(), COPY_EXTENSIONS.end(), ext) != COPY_EXTENSIONS.end()) extension = ext;
+    }
+
+    // a new name for every wallpaper, setters tend to ignore a path they already show
+    std::ostringstream name;
+    name << cacheDir << "/" << std::hex << std::hash<std::string>{}(path) << std::dec << "-" << width << "x" << height << extension;
+    std::string file = name.str();
+    std::string tmpFile = file + ".tmp" + extension; // imwrite goes by the extension
+
+    cv::Mat scaled;
+    cv::resize(image, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+    std::vector<int> params;
+    if (extension == ".jpg" || extension == ".jpeg") params = {cv::IMWRITE_JPEG_QUALITY, 95};
+    else if (extension == ".png") params = {cv::IMWRITE_PNG_COMPRESSION, 1}; // it's in RAM, fast beats small
+
+    bool written = false;
+    try {
+        written = cv::imwrite(tmpFile, scaled, params);
+    }
+    catch (const cv::Exception& e) {
+        std::cerr << "Error: could not write " << tmpFile << ": " << e.what() << std::endl;
+    }
+    if (!written || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+        unlink(tmpFile.c_str());
+        return "";
+    }
+    return file;
+}
+
+void Prefetcher::workerLoop()
+{
+    while (true) {
+        std::string path;
+        bool scaling;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !pendingPath.empty(); });
+            if (stopping) return;
+            path = std::move(pendingPath);
+            pendingPath.clear();
+            scaling = width > 0 && height > 0;
+        }
+
+        readAhead(path);
+        std::string file = scaling ? scaleDown(path) : "";
+
+        std::lock_guard<std::mutex> lock(mutex);
+        readyPath = path;
+        readyFile = file;
+        if (file.empty()) continue;
+
+        // keep the copy on screen and this one, tmpfs is RAM
+        if (std::find(copies.begin(), copies.end(), file) == copies.end()) copies.push_back(file);
+        for (auto it = copies.begin(); it != copies.end();) {
+            if (*it != file && *it != shownFile) {
+                unlink(it->c_str());
+                it = copies.erase(it);
+            }
+            else ++it;
+        }
+    }
+}
+
+bool parseResolution(const std::string& text, int& width, int& height)
+{
+    char separator = 0;
+    int consumed = 0;
+    if (sscanf(text.c_str(), "%d%c%d%n", &width, &separator, &height, &consumed) != 3) return false;
+    return (separator == 'x' || separator == 'X') && consumed == (int)text.size() && width > 0 && height > 0;
+}
+
+std::string defaultPrefetchDir()
+{
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) return std::string(runtimeDir) + "/wpu-darkscore-select";
+    return "/dev/shm/wpu-darkscore-select-" + std::to_string(getuid());
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Gets the next wallpaper ready while the current one is on screen: its file is read into the
+// page cache (posix_fadvise WILLNEED) and, with a resolution, a copy scaled down to it is written
+// to cacheDir (meant to be tmpfs), so the --exec command loads a hot, right-sized file.
+class Prefetcher {
+  public:
+    // width/height 0 = read ahead only
+    Prefetcher(int width, int height, std::string cacheDir);
+    ~Prefetcher(); // waits for the file being worked on, drops the copy nobody got to see
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    void prepare(const std::string& path); // replaces a prepare() that hasn't started yet
+
+    // The file to pass on for path: the scaled copy if it's done, path itself otherwise (never waits)
+    std::string take(const std::string& path);
+
+  private:
+    void workerLoop();
+    std::string scaleDown(const std::string& path); // "" = keep the original
+
+    int width;
+    int height;
+    std::string cacheDir;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::string pendingPath;
+    std::string readyPath; // source of readyFile
+    std::string readyFile;
+    std::string shownFile;          // copy on screen right now, kept until the next one is
+    std::deque<std::string> copies; // written copies that are still on disk
+    bool stopping = false;
+    std::thread worker; // last, starts after the rest is set up
+};
+
+// "2560x1440" -> width, height
+bool parseResolution(const std::string& text, int& width, int& height);
+
+// $XDG_RUNTIME_DIR/wpu-darkscore-select, /dev/shm/wpu-darkscore-select-<uid> without it, both are tmpfs
+std::string defaultPrefetchDir();
@@ -0,0 +1,187 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const char* STAGE_NAMES[] = {"scan", "cache", "read", "decode", "load", "structure",
+                                    "resize", "colors", "group", "darkness", "validate", "hash"};
+static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == (size_t)Stage::COUNT, "name every stage");
+
+constexpr int HISTOGRAM_BUCKETS = 32;      // bucket b = [2^b, 2^(b+1)) microseconds
+constexpr size_t MAX_TRACE_EVENTS = 1 << 20; // per thread, keeps the trace loadable
+
+struct StageStats {
+    uint64_t calls = 0;
+    int64_t totalNs = 0;
+    int64_t maxNs = 0;
+    uint64_t histogram[HISTOGRAM_BUCKETS] = {};
+};
+
+struct TraceEvent {
+    int64_t startNs;
+    int64_t durationNs;
+    Stage stage;
+};
+
+struct ThreadProfile {
+    int id;
+    StageStats stages[(int)Stage::COUNT];
+    std::vector<TraceEvent> events;
+    size_t droppedEvents = 0;
+};
+
+namespace Profile {
+    std::atomic<bool> active{false};
+}
+
+// Threads register once, the data outlives them so pool threads that already exited still show up
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<ThreadProfile>> registry;
+static int64_t epochNs = 0;
+
+static ThreadProfile& threadProfile()
+{
+    thread_local ThreadProfile* profile = nullptr;
+    if (!profile) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<ThreadProfile>());
+        profile = registry.back().get();
+        profile->id = (int)registry.size();
+        profile->events.reserve(4096);
+    }
+    return *profile;
+}
+
+int64_t Profile::nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profile::enable()
+{
+    epochNs = nowNs();
+    active = true;
+}
+
+void Profile::record(Stage stage, int64_t startNs, int64_t endNs)
+{
+    ThreadProfile& profile = threadProfile();
+    int64_t duration = endNs - startNs;
+
+    StageStats& stats = profile.stages[(int)stage];
+    stats.calls++;
+    stats.totalNs += duration;
+    stats.maxNs = std::max(stats.maxNs, duration);
+
+    int bucket = 0;
+    for (int64_t us = duration / 1000; us > 1 && bucket < HISTOGRAM_BUCKETS - 1; us >>= 1) bucket++;
+    stats.histogram[bucket]++;
+
+    if (profile.events.size() < MAX_TRACE_EVENTS) profile.events.push_back({startNs, duration, stage});
+    else profile.droppedEvents++;
+}
+
+static std::string formatDuration(double ns)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (ns >= 1e9) out << ns / 1e9 << "s";
+    else if (ns >= 1e6) out << ns / 1e6 << "ms";
+    else out << ns / 1e3 << "us";
+    return out.str();
+}
+
+// upper bound of the histogram bucket holding the p-th call
+static double histogramPercentile(const StageStats& stats, double p)
+{
+    uint64_t target = (uint64_t)(p * stats.calls), seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += stats.histogram[b];
+        if (seen > target) return (double)(2LL << b) * 1000.0;
+    }
+    return (double)stats.maxNs;
+}
+
+void Profile::report(std::ostream& out)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    StageStats merged[(int)Stage::COUNT];
+    int64_t allNs = 0;
+    for (const auto& profile : registry) {
+        for (int s = 0; s < (int)Stage::COUNT; s++) {
+            const StageStats& stats = profile->stages[s];
+            merged[s].calls += stats.calls;
+            merged[s].totalNs += stats.totalNs;
+            merged[s].maxNs = std::max(merged[s].maxNs, stats.maxNs);
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) merged[s].histogram[b] += stats.histogram[b];
+            allNs += stats.totalNs;
+        }
+    }
+
+    out << "\nProfile (" << registry.size() << " threads, time summed over threads, outer stages include the ones they call):" << std::endl;
+    out << std::left << std::setw(11) << "stage" << std::right << std::setw(10) << "calls" << std::setw(11) << "total"
+        << std::setw(8) << "share" << std::setw(10) << "mean" << std::setw(10) << "p50<" << std::setw(10) << "p99<"
+        << std::setw(10) << "max" << std::endl;
+
+    for (int s = 0; s < (int)Stage::COUNT; s++) {
+        const StageStats& stats = merged[s];
+        if (stats.calls == 0) continue;
+        out << std::left << std::setw(11) << STAGE_NAMES[s] << std::right << std::setw(10) << stats.calls
+            << std::setw(11) << formatDuration(stats.totalNs)
+            << std::setw(7) << std::fixed << std::setprecision(1) << (allNs ? 100.0 * stats.totalNs / allNs : 0.0) << "%"
+            << std::setw(10) << formatDuration((double)stats.totalNs / stats.calls)
+            << std::setw(10) << formatDuration(histogramPercentile(stats, 0.50))
+            << std::setw(10) << formatDuration(histogramPercentile(stats, 0.99))
+            << std::setw(10) << formatDuration(stats.maxNs) << std::endl;
+    }
+
+    for (int s = 0; s < (int)Stage::COUNT; s++) {
+        const StageStats& stats = merged[s];
+        if (stats.calls == 0) continue;
+
+        uint64_t peak = *std::max_element(stats.histogram, stats.histogram + HISTOGRAM_BUCKETS);
+        out << "\n"
+            << STAGE_NAMES[s] << ":" << std::endl;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (stats.histogram[b] == 0) continue;
+            std::string range = "<" + formatDuration((double)(2LL << b) * 1000.0);
+            out << "  " << std::setw(9) << range << " " << std::left << std::setw(40)
+                << std::string((size_t)(40.0 * stats.histogram[b] / peak + 0.5), '#') << std::right << " "
+                << stats.histogram[b] << std::endl;
+        }
+    }
+}
+
+bool Profile::writeTrace(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& profile : registry) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << profile->id
+            << ",\"args\":{\"name\":\"thread " << profile->id << "\"}}";
+        first = false;
+        for (const auto& event : profile->events) {
+            out << ",\n{\"name\":\"" << STAGE_NAMES[(int)event.stage] << "\",\"cat\":\"wpu\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << profile->id << ",\"ts\":" << (event.startNs - epochNs) / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+        }
+        if (profile->droppedEvents > 0) {
+            out << ",\n{\"name\":\"dropped " << profile->droppedEvents << " events\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":"
+                << profile->id << ",\"ts\":0}";
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// --profile: per-stage timers for the hot path.
+// Every thread writes only to its own counters, so timing a stage costs two clock reads and no locks.
+// Off by default, a disabled ProfileScope is a single relaxed load.
+enum class Stage {
+    SCAN,      // directory walk
+    CACHE,     // feature cache lookup (stat)
+    READ,      // file -> memory
+    DECODE,    // memory -> pixels
+    LOAD,      // read + decode in one cv::imread
+    STRUCTURE, // validator header / container check
+    RESIZE,
+    COLORS,    // dominant color extraction
+    GROUP,     // group scoring
+    DARKNESS,
+    VALIDATE,
+    HASH,      // validator --dedupe perceptual hash
+    COUNT
+};
+
+namespace Profile {
+    extern std::atomic<bool> active;
+
+    void enable();
+    inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    void record(Stage stage, int64_t startNs, int64_t endNs);
+    int64_t nowNs();
+
+    // Call after every worker is done
+    void report(std::ostream& out);
+    bool writeTrace(const std::string& path); // Chrome trace event JSON (chrome://tracing, Perfetto)
+} // namespace Profile
+
+class ProfileScope {
+  public:
+    explicit ProfileScope(Stage stage) : stage(stage), start(Profile::enabled() ? Profile::nowNs() : -1) {}
+    ~ProfileScope()
+    {
+        if (start >= 0) Profile::record(stage, start, Profile::nowNs());
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+  private:
+    Stage stage;
+    int64_t start;
+};
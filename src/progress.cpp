@@ -0,0 +1,186 @@
+#include "progress.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+// the textfile collector reads it whenever it's scraped, no need to rewrite it on every tick
+constexpr int PROGRESS_METRICS_MS = 5000;
+
+static ProgressSettings progressSettings;
+
+void setProgressSettings(const ProgressSettings& settings) { progressSettings = settings; }
+
+bool parseProgressMode(const std::string& name, ProgressMode& mode)
+{
+    // clang-format off
+    if      (name == "auto")  mode = ProgressMode::AUTO;
+    else if (name == "tty")   mode = ProgressMode::TTY;
+    else if (name == "plain") mode = ProgressMode::PLAIN;
+    else if (name == "json")  mode = ProgressMode::JSON;
+    else if (name == "none")  mode = ProgressMode::NONE;
+    else return false;
+    // clang-format on
+    return true;
+}
+
+Progress::Progress(std::string tool)
+    : tool(std::move(tool)), mode(progressSettings.mode), metricsPath(progressSettings.metricsPath), samples(PROGRESS_RATE_SAMPLES)
+{
+    if (mode == ProgressMode::AUTO) mode = isatty(STDOUT_FILENO) ? ProgressMode::TTY : ProgressMode::PLAIN;
+}
+
+void Progress::addCounter(const std::string& name, std::function<size_t()> value)
+{
+    counters.push_back({name, std::move(value)});
+}
+
+void Progress::setTtyHeader(std::function<void()> print, std::mutex* lock)
+{
+    ttyHeader = std::move(print);
+    ttyLock = lock;
+}
+
+void Progress::start()
+{
+    started = std::chrono::steady_clock::now();
+    if (mode == ProgressMode::NONE && metricsPath.empty()) return;
+    if (mode == ProgressMode::TTY && ttyHeader) {
+        Cursor::hide();
+        Cursor::termClear();
+    }
+    thread = std::thread(&Progress::loop, this);
+}
+
+void Progress::stop()
+{
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void Progress::loop()
+{
+    auto lastOutput = started, lastMetrics = started;
+    int outputMs = mode == ProgressMode::PLAIN ? PROGRESS_PLAIN_MS : mode == ProgressMode::JSON ? PROGRESS_JSON_MS : PROGRESS_TTY_MS;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, std::chrono::milliseconds(PROGRESS_TTY_MS), [this] { return stopping; })) {
+        auto now = std::chrono::steady_clock::now();
+        samples[sampleCount++ % samples.size()] = {now, done.load(std::memory_order_relaxed)};
+        topRate = std::max(topRate, rate());
+
+        bool output = mode != ProgressMode::NONE && now - lastOutput >= std::chrono::milliseconds(outputMs);
+        bool metrics = !metricsPath.empty() && now - lastMetrics >= std::chrono::milliseconds(PROGRESS_METRICS_MS);
+        if (output) lastOutput = now;
+        if (metrics) lastMetrics = now;
+        if (output || metrics) {
+            lock.unlock(); // stop() doesn't have to wait for the terminal
+            report(false, output, metrics);
+            lock.lock();
+        }
+    }
+    lock.unlock();
+    report(true, true, !metricsPath.empty());
+}
+
+double Progress::rate() const
+{
+    if (sampleCount < 2) return 0.0;
+    size_t newest = (sampleCount - 1) % samples.size();
+    size_t oldest = sampleCount < samples.size() ? 0 : sampleCount % samples.size();
+    double seconds = std::chrono::duration<double>(samples[newest].at - samples[oldest].at).count();
+    return seconds > 0 ? (samples[newest].done - samples[oldest].done) / seconds : 0.0;
+}
+
+void Progress::report(bool finished, bool output, bool metrics)
+{
+    size_t current = done.load(std::memory_order_relaxed);
+    size_t all = total.load(std::memory_order_relaxed);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double speed = finished ? (elapsed > 0 ? current / elapsed : 0.0) : rate(); // the last line gets the overall average
+    double percent = all ? 100.0 * current / all : 0.0;
+    double eta = speed > 0 && current < all ? (all - current) / speed : 0.0;
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    if (mode == ProgressMode::JSON) {
+        line << "{\"tool\": \"" << tool << "\", \"done\": " << current << ", \"total\": " << all << ", \"percent\": " << percent
+             << ", \"rate\": " << speed << ", \"eta_s\": " << eta << ", \"elapsed_s\": " << elapsed;
+        for (const auto& counter : counters) line << ", \"" << counter.name << "\": " << counter.value();
+        line << ", \"finished\": " << (finished ? "true" : "false") << "}";
+    }
+    else {
+        line << "==: " << current << "/" << all << " ";
+        for (const auto& counter : counters) line << "(" << counter.name << ": " << counter.value() << ") ";
+        line << percent << "% (avg: " << speed << " i/s) (top: " << std::max(topRate, speed) << " i/s)";
+        if (eta > 0) line << " ETA: " << (int)eta / 60 << "m " << (int)eta % 60 << "s";
+    }
+
+    switch (output ? mode : ProgressMode::NONE) {
+        case ProgressMode::TTY:
+            if (ttyHeader) {
+                std::unique_lock<std::mutex> lock;
+                if (ttyLock) lock = std::unique_lock<std::mutex>(*ttyLock);
+                Cursor::reset();
+                ttyHeader();
+                std::cout << "\n" << line.str() << "               " << std::endl;
+                if (finished) Cursor::show();
+            }
+            else {
+                Cursor::cr();
+                std::cout << line.str() << "               " << (finished ? "\n" : "") << std::flush;
+            }
+            break;
+        case ProgressMode::PLAIN:
+        case ProgressMode::JSON:
+            std::cout << (mode == ProgressMode::PLAIN ? tool + " " : "") << line.str() << std::endl;
+            break;
+        default:
+            break;
+    }
+
+    if (!metrics) return;
+
+    // wpu_images_* with a tool label, so several tools can share one textfile directory
+    std::ostringstream prom;
+    std::string label = "{tool=\"" + tool + "\"}";
+    prom << "# HELP wpu_images_done Images processed so far.\n# TYPE wpu_images_done gauge\n"
+         << "wpu_images_done" << label << " " << current << "\n"
+         << "# HELP wpu_images_total Images found.\n# TYPE wpu_images_total gauge\n"
+         << "wpu_images_total" << label << " " << all << "\n"
+         << "# HELP wpu_images_per_second Recent processing rate.\n# TYPE wpu_images_per_second gauge\n"
+         << "wpu_images_per_second" << label << " " << speed << "\n"
+         << "# HELP wpu_eta_seconds Estimated time left.\n# TYPE wpu_eta_seconds gauge\n"
+         << "wpu_eta_seconds" << label << " " << eta << "\n"
+         << "# HELP wpu_elapsed_seconds Time since the run started.\n# TYPE wpu_elapsed_seconds gauge\n"
+         << "wpu_elapsed_seconds" << label << " " << elapsed << "\n"
+         << "# HELP wpu_finished 1 once the run is over.\n# TYPE wpu_finished gauge\n"
+         << "wpu_finished" << label << " " << (finished ? 1 : 0) << "\n";
+    for (const auto& counter : counters) {
+        prom << "# TYPE wpu_images_" << counter.name << " gauge\n"
+             << "wpu_images_" << counter.name << label << " " << counter.value() << "\n";
+    }
+
+    // the collector must never read half a file
+    std::string tmpPath = tempPathFor(metricsPath);
+    {
+        std::ofstream out(tmpPath);
+        out << prom.str();
+        if (!out) {
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), metricsPath.c_str()) != 0) std::remove(tmpPath.c_str());
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --progress: how a tool reports how far it got.
+//   tty   redraws one line (and whatever the tool shows above it) in place
+//   plain a line every PROGRESS_PLAIN_MS, no escape codes, for logs and the journal
+//   json  a JSON object per line every PROGRESS_JSON_MS and a last one with "finished": true
+//   none  nothing
+// auto (default) = tty when stdout is a terminal, plain otherwise.
+enum class ProgressMode { AUTO, TTY, PLAIN, JSON, NONE };
+
+bool parseProgressMode(const std::string& name, ProgressMode& mode);
+
+// --progress / --metrics, set once at startup like the I/O backend
+struct ProgressSettings {
+    ProgressMode mode = ProgressMode::AUTO;
+    std::string metricsPath; // Prometheus textfile, "" = none
+};
+void setProgressSettings(const ProgressSettings& settings);
+
+// Counters the workers bump (relaxed atomics, no lock) and a reporter thread that reads them.
+// The rate is the slope over the last PROGRESS_RATE_SAMPLES readings of a ring buffer,
+// so a burst of cache hits doesn't dominate it for long.
+// With a metrics path the same numbers are also written as a Prometheus textfile (node_exporter
+// --collector.textfile), replaced atomically every few seconds and once more at the end.
+class Progress {
+  public:
+    explicit Progress(std::string tool); // tool = name in the output and the metrics label
+    ~Progress() { stop(); }
+
+    Progress(const Progress&) = delete;
+    Progress& operator=(const Progress&) = delete;
+
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> total{0};
+
+    // extra number for every output, e.g. "corrupt" -> "corrupt": n in JSON, wpu_images_corrupt in the textfile
+    void addCounter(const std::string& name, std::function<size_t()> value);
+    // tty only: printed above the progress line, with lock held if given (for tools whose workers print too)
+    void setTtyHeader(std::function<void()> print, std::mutex* lock = nullptr);
+
+    void start();
+    void stop(); // prints the last line, idempotent
+
+    bool redraws() const { return mode == ProgressMode::TTY; }
+
+  private:
+    struct Sample {
+        std::chrono::steady_clock::time_point at;
+        size_t done;
+    };
+    struct Counter {
+        std::string name;
+        std::function<size_t()> value;
+    };
+
+    void loop();
+    // output = the --progress line, metrics = the textfile, each only when its own interval is up
+    void report(bool finished, bool output, bool metrics);
+    double rate() const; // images/s over the ring buffer
+
+    std::string tool;
+    ProgressMode mode;
+    std::string metricsPath;
+    std::vector<Counter> counters;
+    std::function<void()> ttyHeader;
+    std::mutex* ttyLock = nullptr;
+
+    std::chrono::steady_clock::time_point started;
+    std::vector<Sample> samples; // ring buffer, PROGRESS_RATE_SAMPLES long
+    size_t sampleCount = 0;
+    double topRate = 0.0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+};
+
+constexpr int PROGRESS_TTY_MS = 300;
+constexpr int PROGRESS_PLAIN_MS = 10000;
+constexpr int PROGRESS_JSON_MS = 1000;
+constexpr size_t PROGRESS_RATE_SAMPLES = 16;
@@ -0,0 +1,226 @@
+#include "scoreindex.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "globals.hpp"
+
+static const char SCORE_INDEX_MAGIC[8] = {'w', 'p', 'u', 'i', 'd', 'x', '\n', '\0'};
+constexpr uint32_t SCORE_INDEX_VERSION = 1;
+
+struct ScoreIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t buckets;
+    uint64_t count;
+    uint64_t stringsSize;
+};
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+int getDarknessBucket(double score)
+{
+    // very dark, dark, mid-dark, mid-bright, bright
+    for (int b = 0; b < DARKNESS_BUCKETS - 1; b++) {
+        if (score > DARKNESS_BUCKET_BOUNDS[b]) return b;
+    }
+    return DARKNESS_BUCKETS - 1; // very bright
+}
+
+ScoreIndex& ScoreIndex::operator=(ScoreIndex&& other) noexcept
+{
+    if (this == &other) return *this;
+    reset();
+    owned = std::move(other.owned);
+    mapped = other.mapped;
+    mappedSize = other.mappedSize;
+    count = other.count;
+    bucketStart = other.bucketStart;
+    scores = other.scores;
+    pathOffsets = other.pathOffsets;
+    strings = other.strings;
+    other.mapped = nullptr;
+    other.mappedSize = 0;
+    other.count = 0;
+    other.bucketStart = nullptr;
+    return *this;
+}
+
+bool ScoreIndex::isIndexFile(const std::string& path)
+{
+    char magic[sizeof(SCORE_INDEX_MAGIC)] = {};
+    std::ifstream in(path, std::ios::binary);
+    return in.read(magic, sizeof(magic)) && memcmp(magic, SCORE_INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+std::vector<uint8_t> ScoreIndex::build(const std::vector<DarkScoreResult>& results)
+{
+    struct Entry {
+        int bucket;
+        float score;
+        const std::string* path;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(results.size());
+    for (const auto& result : results) {
+        if (result.score < 0) continue;
+        entries.push_back({getDarknessBucket(result.score), (float)result.score, &result.filePath});
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.bucket != b.bucket ? a.bucket < b.bucket : a.score > b.score;
+    });
+
+    ScoreIndexHeader header;
+    memcpy(header.magic, SCORE_INDEX_MAGIC, sizeof(header.magic));
+    header.version = SCORE_INDEX_VERSION;
+    header.buckets = DARKNESS_BUCKETS;
+    header.count = entries.size();
+    header.stringsSize = 0;
+    for (const auto& e : entries) header.stringsSize += e.path->size() + 1;
+
+    const size_t bucketsAt = align8(sizeof(header));
+    const size_t scoresAt = align8(bucketsAt + (DARKNESS_BUCKETS + 1) * sizeof(uint32_t));
+    const size_t offsetsAt = align8(scoresAt + entries.size() * sizeof(float));
+    const size_t stringsAt = align8(offsetsAt + entries.size() * sizeof(uint32_t));
+    if (header.stringsSize > UINT32_MAX) return {};
+
+    std::vector<uint8_t> bytes(stringsAt + header.stringsSize, 0);
+    memcpy(bytes.data(), &header, sizeof(header));
+
+    auto* bucketStart = reinterpret_cast<uint32_t*>(bytes.data() + bucketsAt);
+    auto* scores = reinterpret_cast<float*>(bytes.data() + scoresAt);
+    auto* offsets = reinterpret_cast<uint32_t*>(bytes.data() + offsetsAt);
+    char* strings = reinterpret_cast<char*>(bytes.data() + stringsAt);
+
+    uint32_t offset = 0;
+    int bucket = 0;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        while (bucket <= entries[i].bucket) bucketStart[bucket++] = i;
+        scores[i] = entries[i].score;
+        offsets[i] = offset;
+        memcpy(strings + offset, entries[i].path->c_str(), entries[i].path->size() + 1);
+        offset += entries[i].path->size() + 1;
+    }
+    while (bucket <= DARKNESS_BUCKETS) bucketStart[bucket++] = entries.size();
+
+    return bytes;
+}
+
+bool ScoreIndex::attach(const uint8_t* data, size_t size)
+{
+    ScoreIndexHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SCORE_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != SCORE_INDEX_VERSION) return false;
+    if (header.buckets != DARKNESS_BUCKETS || header.count > UINT32_MAX) return false; // bucket bounds changed, rebuild it
+
+    const size_t bucketsAt = align8(sizeof(header));
+    const size_t scoresAt = align8(bucketsAt + (header.buckets + 1) * sizeof(uint32_t));
+    const size_t offsetsAt = align8(scoresAt + header.count * sizeof(float));
+    const size_t stringsAt = align8(offsetsAt + header.count * sizeof(uint32_t));
+    if (stringsAt > size || header.stringsSize != size - stringsAt) return false;
+
+    bucketStart = reinterpret_cast<const uint32_t*>(data + bucketsAt);
+    scores = reinterpret_cast<const float*>(data + scoresAt);
+    pathOffsets = reinterpret_cast<const uint32_t*>(data + offsetsAt);
+    strings = reinterpret_cast<const char*>(data + stringsAt);
+
+    // a damaged index must not send the reader out of bounds
+    bool ok = header.stringsSize == 0 ? header.count == 0 : strings[header.stringsSize - 1] == '\0';
+    for (uint32_t b = 0; ok && b < header.buckets; b++) {
+        ok = bucketStart[b] <= bucketStart[b + 1];
+    }
+    ok = ok && bucketStart[0] == 0 && bucketStart[header.buckets] == header.count;
+    for (uint64_t i = 0; ok && i < header.count; i++) {
+        ok = pathOffsets[i] < header.stringsSize;
+    }
+    if (!ok) {
+        bucketStart = nullptr;
+        return false;
+    }
+
+    count = (uint32_t)header.count;
+    return true;
+}
+
+bool ScoreIndex::open(const std::string& path)
+{
+    reset();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    mapped = addr;
+    mappedSize = st.st_size;
+    if (!attach(static_cast<const uint8_t*>(addr), mappedSize)) {
+        reset();
+        return false;
+    }
+    return true;
+}
+
+bool ScoreIndex::assign(std::vector<uint8_t> bytes)
+{
+    reset();
+    owned = std::move(bytes);
+    if (!attach(owned.data(), owned.size())) {
+        reset();
+        return false;
+    }
+    return true;
+}
+
+void ScoreIndex::reset()
+{
+    if (mapped) munmap(mapped, mappedSize);
+    mapped = nullptr;
+    mappedSize = 0;
+    owned.clear();
+    count = 0;
+    bucketStart = nullptr;
+    scores = nullptr;
+    pathOffsets = nullptr;
+    strings = nullptr;
+}
+
+bool writeScoreIndex(const std::string& path, const std::vector<DarkScoreResult>& results)
+{
+    std::vector<uint8_t> bytes = ScoreIndex::build(results);
+    if (bytes.empty()) return false;
+
+    // the running wpu-darkscore-select keeps the old file mapped, so never write it in place
+    std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        out.flush();
+        if (!out) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct DarkScoreResult {
+    std::string filePath;
+    double score;
+};
+
+// One entry of a ScoreIndex, the path points into it: only valid while that index is
+struct ScoreEntry {
+    std::string_view filePath;
+    float score = 0.0f;
+};
+
+// Map darkness score (0=bright, 1=dark)
+// bucket 0-5 (0=darkest, 5=brightest)
+int getDarknessBucket(double score);
+
+// Binary darkness score index written by wpu-darkscore --index and mmapped by wpu-darkscore-select,
+// so loading 100k+ wallpapers is one mmap instead of a CSV parse. Native byte order, layout:
+//   header        magic, version, bucket count, entry count, string table size
+//   bucketStart   uint32[buckets + 1], entries of bucket b are [bucketStart[b], bucketStart[b + 1])
+//   scores        float[count], grouped by bucket, darkest first
+//   pathOffsets   uint32[count], into the string table
+//   strings       NUL terminated paths
+class ScoreIndex {
+  public:
+    ScoreIndex() = default;
+    ~ScoreIndex() { reset(); }
+    ScoreIndex(ScoreIndex&& other) noexcept { *this = std::move(other); }
+    ScoreIndex& operator=(ScoreIndex&& other) noexcept;
+    ScoreIndex(const ScoreIndex&) = delete;
+    ScoreIndex& operator=(const ScoreIndex&) = delete;
+
+    static bool isIndexFile(const std::string& path); // checks the magic
+    static std::vector<uint8_t> build(const std::vector<DarkScoreResult>& results); // results with a score < 0 are left out
+
+    bool open(const std::string& path);   // mmap, false if missing or not a valid index
+    bool assign(std::vector<uint8_t> bytes); // same layout as the file, kept in memory (CSV input)
+    void reset();
+
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    uint32_t bucketBegin(int bucket) const { return bucketStart ? bucketStart[bucket] : 0; }
+    uint32_t bucketEnd(int bucket) const { return bucketStart ? bucketStart[bucket + 1] : 0; }
+    uint32_t bucketSize(int bucket) const { return bucketEnd(bucket) - bucketBegin(bucket); }
+
+    float score(uint32_t i) const { return scores[i]; }
+    const char* path(uint32_t i) const { return strings + pathOffsets[i]; }
+    ScoreEntry entry(uint32_t i) const { return {path(i), score(i)}; } // no copy of the path
+
+  private:
+    bool attach(const uint8_t* data, size_t size); // validates the layout, sets the pointers below
+
+    std::vector<uint8_t> owned;
+    void* mapped = nullptr;
+    size_t mappedSize = 0;
+
+    uint32_t count = 0;
+    const uint32_t* bucketStart = nullptr;
+    const float* scores = nullptr;
+    const uint32_t* pathOffsets = nullptr;
+    const char* strings = nullptr;
+};
+
+// Writes to a temp file and renames it over path
+bool writeScoreIndex(const std::string& path, const std::vector<DarkScoreResult>& results);
@@ -2,15 +2,32 @@
 #include "utils.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
 #include <ostream>
+#include <linux/fs.h>
+#include <linux/ioprio.h>
+#include <poll.h>
+#include <sched.h>
+#include <spawn.h>
 #include <string>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <unistd.h>
 #include <vector>
 
 std::vector<std::string> supportedExtensions = {
@@ -18,7 +35,9 @@ std::vector<std::string> supportedExtensions = {
 
 bool isSupportedFormat(const std::string& filename)
 {
-    std::string extension = filename.substr(filename.find_last_of("."));
+    size_t dot = filename.find_last_of(".");
+    if (dot == std::string::npos) return false;
+    std::string extension = filename.substr(dot);
     std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
     return std::find(supportedExtensions.begin(), supportedExtensions.end(), extension) != supportedExtensions.end();
 }
@@ -32,18 +51,13 @@ size_t scanFolder(std::vector<std::string>& imageFiles, const std::string& folde
         return 0;
     }
 
-    try {
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(folderPath)) {
-            if (entry.is_regular_file() && isSupportedFormat(entry.path().filename().string())) {
-                imageFiles.push_back(entry.path().string());
-            }
-        }
-    }
-    catch (const std::filesystem::filesystem_error& ex) {
-        std::cerr << "Error scanning folder: " << ex.what() << std::endl;
-        exit(1);
-        return 0;
-    }
+    std::mutex filesMutex;
+    size_t before = imageFiles.size();
+    scanTree(folderPath, SCAN_THREADS, [&](const std::string& path, int) {
+        std::lock_guard<std::mutex> lock(filesMutex);
+        imageFiles.push_back(path);
+    });
+    std::sort(imageFiles.begin() + before, imageFiles.end()); // same order every run
 
     size_t totalCount = imageFiles.size();
     std::cout << "Found " << totalCount << " image files." << std::endl;
@@ -57,12 +71,19 @@ size_t scanFolder(std::vector<std::string>& imageFiles, const std::string& folde
 
 size_t getImages(std::vector<std::string>& images, const std::string& inputPath)
 {
+    // canonical root, so scanned paths can be used as feature cache keys
+    std::string path = inputPath;
+    try {
+        path = std::filesystem::canonical(inputPath).string();
+    }
+    catch (const std::filesystem::filesystem_error&) {
+    }
 
-    if (std::filesystem::is_regular_file(inputPath)) {
-        images.push_back(inputPath);
+    if (std::filesystem::is_regular_file(path)) {
+        images.push_back(path);
     }
-    else if (std::filesystem::is_directory(inputPath)) {
-        scanFolder(images, inputPath);
+    else if (std::filesystem::is_directory(path)) {
+        scanFolder(images, path);
     }
     return images.size();
 }
@@ -141,6 +162,17 @@ bool checkKeyPress(char* c)
     return n > 0;
 }
 
+std::string jsonEscape(const std::string& str)
+{
+    std::string out;
+    for (char c : str) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
 std::string trim(const std::string& str)
 {
     const std::string whitespace = " \n\r\t\f\v";
@@ -150,43 +182,231 @@ std::string trim(const std::string& str)
     return str.substr(first, (last - first + 1));
 }
 
+// posix_spawn instead of fork: forking a multi-threaded process copies every thread's locks in whatever state they're in
+static pid_t spawnCommand(const std::string& program, const std::string& filePath)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    // Redirect stdout/stderr to /dev/null in child to avoid issues
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    // the child gets default signal handling and nothing blocked, whatever the caller set up
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGHUP);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGPIPE);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    // Execute the command directly
+    pid_t pid = -1;
+    char* argv[] = {const_cast<char*>(program.c_str()), const_cast<char*>(filePath.c_str()), nullptr};
+    int rc = posix_spawnp(&pid, program.c_str(), &actions, &attr, argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0) {
+        std::cerr << "Could not run " << program << ": " << strerror(rc) << std::endl;
+        return -1;
+    }
+    return pid;
+}
+
+// Waits for pid through a pidfd (polls waitpid on kernels without one).
+// After timeoutMs (<= 0 = never) it gets SIGTERM, COMMAND_KILL_GRACE_MS later SIGKILL.
+// Returns the exit code, -1 if it was killed or didn't exit normally.
+static int waitCommand(pid_t pid, int timeoutMs)
+{
+    int pidfd = -1;
+#ifdef SYS_pidfd_open
+    pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#endif
+
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    int signalsSent = 0;
+    int result = -1;
+    while (true) {
+        int status;
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid) {
+            if (signalsSent == 0 && WIFEXITED(status)) result = WEXITSTATUS(status);
+            break;
+        }
+        if (r < 0 && errno != EINTR) break; // ECHILD, reaped by someone else
+
+        int waitMs = -1;
+        if (timeoutMs > 0 && signalsSent < 2) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (left <= 0) {
+                kill(pid, signalsSent == 0 ? SIGTERM : SIGKILL);
+                if (signalsSent++ == 0) {
+                    std::cerr << "Command still running after " << timeoutMs << "ms, stopping it" << std::endl;
+                }
+                deadline = Clock::now() + std::chrono::milliseconds(COMMAND_KILL_GRACE_MS);
+                continue;
+            }
+            waitMs = (int)left;
+        }
+
+        if (pidfd >= 0) {
+            pollfd pfd = {pidfd, POLLIN, 0};
+            poll(&pfd, 1, waitMs);
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(waitMs < 0 || waitMs > 100 ? 100 : waitMs));
+        }
+    }
+
+    if (pidfd >= 0) close(pidfd);
+    return result;
+}
+
 bool executeCommand(const std::string& program, const std::string& filePath)
 {
-    pid_t pid = fork();
+    pid_t pid = spawnCommand(program, filePath);
+    if (pid < 0) return false;
 
-    if (pid < 0) {
-        std::cerr << "Fork failed" << std::endl;
+    int exitCode = waitCommand(pid, 0);
+    if (exitCode != 0) {
+        std::cerr << "Command exited with status: " << exitCode << std::endl;
         return false;
     }
+    return true;
+}
 
-    if (pid == 0) {
-        // Child process
-        // Redirect stdout/stderr to /dev/null in child to avoid issues
-        int devnull = open("/dev/null", O_WRONLY);
-        if (devnull != -1) {
-            dup2(devnull, STDOUT_FILENO);
-            dup2(devnull, STDERR_FILENO);
-            close(devnull);
-        }
+CommandRunner::CommandRunner(int timeoutMs) : timeoutMs(timeoutMs), worker(&CommandRunner::workerLoop, this) {}
 
-        // Execute the command directly
-        execlp(program.c_str(), program.c_str(), filePath.c_str(), nullptr);
+CommandRunner::~CommandRunner()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        hasPending = false;
+    }
+    wake.notify_all();
+    worker.join();
+}
 
-        // If execlp returns, it failed
-        exit(EXIT_FAILURE);
+void CommandRunner::run(const std::string& program, const std::string& filePath)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (hasPending) {
+            std::cout << "Skipping " << pendingFile << ", still applying the previous wallpaper" << std::endl;
+        }
+        pendingProgram = program;
+        pendingFile = filePath;
+        hasPending = true;
     }
-    else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+    wake.notify_one();
+}
+
+void CommandRunner::workerLoop()
+{
+    while (true) {
+        std::string program, filePath;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || hasPending; });
+            if (!hasPending) return;
+            program = std::move(pendingProgram);
+            filePath = std::move(pendingFile);
+            hasPending = false;
+        }
 
-        int exitCode = WEXITSTATUS(status);
+        pid_t pid = spawnCommand(program, filePath);
+        if (pid < 0) continue;
+        int exitCode = waitCommand(pid, timeoutMs);
         if (exitCode != 0) {
             std::cerr << "Command exited with status: " << exitCode << std::endl;
+        }
+    }
+}
+
+std::string tempPathFor(const std::string& path)
+{
+    static std::atomic<unsigned> counter{0};
+    return path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(counter++);
+}
+
+static bool copyRange(int in, int out, off_t size, std::string& error)
+{
+    off_t done = 0;
+    while (done < size) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, size - done, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // not supported here (EXDEV, EOPNOTSUPP, ...) or the file shrank, the loop below finishes
+        done += n;
+    }
+
+    std::vector<char> buffer(1 << 20);
+    while (done < size) {
+        ssize_t n = pread(in, buffer.data(), buffer.size(), done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error = n < 0 ? strerror(errno) : "file shrank while copying";
             return false;
         }
-        return true;
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = pwrite(out, buffer.data() + written, n - written, done + written);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) {
+                error = strerror(errno);
+                return false;
+            }
+            written += w;
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool copyFileFast(const std::string& src, const std::string& dst, bool clone, std::string& error)
+{
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        error = strerror(errno);
+        close(in);
+        return false;
+    }
+
+    std::string tmpPath = tempPathFor(dst);
+    int out = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+    if (out < 0) {
+        error = strerror(errno);
+        close(in);
+        return false;
+    }
+
+    bool ok = (clone && ioctl(out, FICLONE, in) == 0) || copyRange(in, out, st.st_size, error);
+    if (ok) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        futimens(out, times);
+    }
+    if (close(out) != 0 && ok) {
+        error = strerror(errno);
+        ok = false;
     }
+    close(in);
+
+    if (ok && rename(tmpPath.c_str(), dst.c_str()) != 0) {
+        error = strerror(errno);
+        ok = false;
+    }
+    if (!ok) unlink(tmpPath.c_str());
+    return ok;
 }
 
 bool fs_exists(const std::string& path)
@@ -198,3 +418,211 @@ bool fs_exists(const std::string& path)
     }
     return false;
 }
+
+int resolveThreadCount(int requested)
+{
+    if (requested > 0) return requested;
+    int numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0) numThreads = 4; // Fallback in case detection fails
+    return numThreads;
+}
+
+bool parseByteSize(const std::string& text, size_t& bytes)
+{
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) return false;
+
+    std::string unit = end;
+    if (unit.size() == 2 && (unit[1] == 'B' || unit[1] == 'b')) unit.pop_back(); // "2GB"
+    double multiplier = 1;
+    if (unit.empty() || unit == "B" || unit == "b") multiplier = 1;
+    else if (unit == "K" || unit == "k") multiplier = 1024.0;
+    else if (unit == "M" || unit == "m") multiplier = 1024.0 * 1024;
+    else if (unit == "G" || unit == "g") multiplier = 1024.0 * 1024 * 1024;
+    else if (unit == "T" || unit == "t") multiplier = 1024.0 * 1024 * 1024 * 1024;
+    else return false;
+
+    bytes = (size_t)(value * multiplier);
+    return true;
+}
+
+bool enterIdlePriority()
+{
+    bool ok = true;
+    // on Linux both only change the calling thread, threads started afterwards inherit them
+    if (setpriority(PRIO_PROCESS, 0, 19) != 0) ok = false;
+    sched_param param = {};
+    if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) ok = false;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) != 0) ok = false;
+    return ok;
+}
+
+ThreadPool::ThreadPool(int numThreads)
+{
+    numThreads = resolveThreadCount(numThreads);
+    workers.reserve(numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, t);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task, bool front)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (front) tasks.push_front(std::move(task));
+        else tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    allDone.wait(lock, [this] { return tasks.empty() && active == 0; });
+}
+
+void ThreadPool::workerLoop(int threadId)
+{
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return; // stopping and drained
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            active++;
+        }
+
+        task(threadId);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+            if (tasks.empty() && active == 0) allDone.notify_all();
+        }
+    }
+}
+
+void parallelFor(size_t count, int numThreads, const std::function<void(size_t index, int threadId)>& fn)
+{
+    numThreads = static_cast<int>(std::min<size_t>(resolveThreadCount(numThreads), std::max<size_t>(count, 1)));
+
+    ThreadPool pool(numThreads);
+    std::atomic<size_t> next{0};
+    for (int t = 0; t < numThreads; ++t) {
+        pool.submit([&](int threadId) {
+            for (size_t i = next++; i < count; i = next++) {
+                fn(i, threadId);
+            }
+        });
+    }
+    pool.wait();
+}
+
+// getdents64 record, glibc only wraps it since 2.30
+struct LinuxDirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+using FileCallback = std::function<void(const std::string& path, int threadId)>;
+
+static void scanDirectory(ThreadPool& pool, const std::string& dir, const FileCallback& onFile, int threadId)
+{
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Error scanning folder: " << dir << std::endl;
+        return;
+    }
+
+    std::vector<char> buffer(64 * 1024);
+    while (true) {
+        long bytes = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (bytes <= 0) break;
+
+        for (long offset = 0; offset < bytes;) {
+            auto* entry = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            bool isDir = entry->d_type == DT_DIR;
+            bool isFile = entry->d_type == DT_REG;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                // like recursive_directory_iterator: symlinked files count, symlinked folders aren't followed
+                struct stat st;
+                int flags = entry->d_type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW;
+                if (fstatat(fd, name, &st, flags) != 0) continue;
+                isFile = S_ISREG(st.st_mode);
+                isDir = S_ISDIR(st.st_mode) && entry->d_type != DT_LNK;
+            }
+
+            std::string path = dir + "/" + name;
+            if (isDir) {
+                // folders first, so the whole tree is in flight as early as possible
+                pool.submit([&pool, &onFile, path](int t) { scanDirectory(pool, path, onFile, t); }, true);
+            }
+            else if (isFile && isSupportedFormat(name)) {
+                onFile(path, threadId);
+            }
+        }
+    }
+
+    close(fd);
+}
+
+static size_t scanWithPool(ThreadPool& pool, const std::string& root, const FileCallback& onFile)
+{
+    std::string dir = root;
+    while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+
+    if (std::filesystem::is_regular_file(dir)) {
+        if (!isSupportedFormat(dir)) return 0;
+        onFile(dir, 0);
+        pool.wait();
+        return 1;
+    }
+
+    std::atomic<size_t> count{0};
+    FileCallback counted = [&](const std::string& path, int threadId) {
+        count++;
+        onFile(path, threadId);
+    };
+    pool.submit([&pool, &counted, dir](int t) { scanDirectory(pool, dir, counted, t); });
+    pool.wait();
+    return count;
+}
+
+size_t scanTree(const std::string& root, int numThreads, const FileCallback& onFile)
+{
+    ThreadPool pool(numThreads);
+    return scanWithPool(pool, root, onFile);
+}
+
+size_t scanAndProcess(const std::string& root, int numThreads, const FileCallback& process, std::atomic<size_t>* found)
+{
+    ThreadPool pool(numThreads);
+    return scanWithPool(pool, root, [&pool, &process, found](const std::string& path, int) {
+        if (found) (*found)++;
+        pool.submit([&process, path](int threadId) { process(path, threadId); });
+    });
+}
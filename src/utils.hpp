@@ -1,5 +1,11 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 extern std::vector<std::string> supportedExtensions;
@@ -18,7 +24,143 @@ namespace Cursor {
 
 std::vector<std::string> csv_split(const std::string& line, char delimiter);
 std::string trim(const std::string& str);
+std::string jsonEscape(const std::string& str); // for inside "", control characters are dropped
 void setNonBlockingInput(bool enable);
 bool checkKeyPress(char* c);
-bool executeCommand(const std::string& program, const std::string& filePath);
+bool executeCommand(const std::string& program, const std::string& filePath); // runs `program filePath` and waits
+
+// SIGTERM -> SIGKILL for commands that hit their timeout
+constexpr int COMMAND_KILL_GRACE_MS = 2000;
+
+// Runs `program filePath` on its own thread so the caller never waits for it.
+// One command at a time: requests that come in while one is running replace each other
+// and only the latest one is started once it's done. Commands still running after timeoutMs are stopped.
+class CommandRunner {
+  public:
+    explicit CommandRunner(int timeoutMs);
+    ~CommandRunner(); // drops what's pending, waits for the running command
+
+    CommandRunner(const CommandRunner&) = delete;
+    CommandRunner& operator=(const CommandRunner&) = delete;
+
+    void run(const std::string& program, const std::string& filePath);
+
+  private:
+    void workerLoop();
+
+    int timeoutMs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::string pendingProgram;
+    std::string pendingFile;
+    bool hasPending = false;
+    bool stopping = false;
+    std::thread worker; // last, starts after the rest is set up
+};
 bool fs_exists(const std::string& path);
+
+// Copies src over dst through a temp file next to it, so dst is never half written (or the hardlinked source
+// truncated). clone = try FICLONE first, the copy shares the extents with src (btrfs, XFS). Otherwise
+// copy_file_range (in kernel, server side on NFS 4.2), read/write where that's not supported.
+// Keeps mode and mtime, so a later run can tell it's up to date.
+bool copyFileFast(const std::string& src, const std::string& dst, bool clone, std::string& error);
+
+// Unique name for a temp file next to path, safe to use from several threads
+std::string tempPathFor(const std::string& path);
+
+// numThreads <= 0 means one per core
+int resolveThreadCount(int requested);
+
+// "512M", "2G", "1.5G", plain bytes, K/M/G/T are powers of 1024
+bool parseByteSize(const std::string& text, size_t& bytes);
+
+// --nice: lowest CPU priority (nice 19, SCHED_IDLE) and idle I/O class for this thread and every thread it starts,
+// call before any worker exists. false if the kernel refused some of it.
+bool enterIdlePriority();
+
+// Shared worker pool, tasks are pulled from one queue so a thread that finishes
+// early just grabs the next task instead of idling behind a fixed chunk.
+class ThreadPool {
+  public:
+    using Task = std::function<void(int threadId)>;
+
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    void submit(Task task, bool front = false); // front = run before everything already queued
+    void wait(); // blocks until every submitted task has finished
+    int size() const { return static_cast<int>(workers.size()); }
+
+  private:
+    void workerLoop(int threadId);
+
+    std::vector<std::thread> workers;
+    std::deque<Task> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable allDone;
+    size_t active = 0;
+    bool stopping = false;
+};
+
+// Blocking FIFO with a capacity, producers wait while it's full (backpressure)
+// and consumers wait while it's empty. pop() returns false once closed and drained.
+template <typename T>
+class BoundedQueue {
+  public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+  private:
+    size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    bool closed = false;
+};
+
+// directory reads are mostly waiting on the disk / NFS server, so more in flight than cores
+constexpr int SCAN_THREADS = 16;
+
+// Walks root recursively with one pool task per directory, using getdents64 d_type so only
+// entries the filesystem can't type (DT_UNKNOWN, symlinks) cost a stat.
+// onFile(path, threadId) runs on the scanning threads for every supported image, in no particular order.
+size_t scanTree(const std::string& root, int numThreads, const std::function<void(const std::string& path, int threadId)>& onFile);
+
+// Like scanTree, but every image becomes a process(path, threadId) task on the same pool right away,
+// so work starts before the scan is done. found is bumped as images are discovered (for progress output).
+size_t scanAndProcess(const std::string& root, int numThreads, const std::function<void(const std::string& path, int threadId)>& process,
+                      std::atomic<size_t>* found = nullptr);
+
+// Calls fn(index, threadId) for every index in [0, count), indices are handed out
+// one at a time so big and small files balance across threads.
+void parallelFor(size_t count, int numThreads, const std::function<void(size_t index, int threadId)>& fn);
@@ -10,9 +10,14 @@
 #include <thread>
 #include <vector>
 
+#include "debug.hpp"
+#include "dedupe.hpp"
+#include "features.hpp"
 #include "globals.hpp"
+#include "imageio.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
 #include "utils.hpp"
-#include "debug.hpp"
 
 struct ValidationResult {
     std::string filePath;
@@ -20,6 +25,9 @@ struct ValidationResult {
     bool isValid;
     int width;
     int height;
+    int level; // ValidationLevel the verdict came from
+    bool hashed = false; // --dedupe
+    uint64_t dhash = 0;
 };
 
 std::vector<ValidationResult> results;
@@ -27,159 +35,139 @@ std::mutex resultsMutex;
 
 std::atomic<int> corruptedCount = 0;
 
-ValidationResult validateImage(const std::string& imagePath)
+ValidationResult makeValidationResult(const std::string& imagePath, bool isValid, int width, int height, int level)
 {
     ValidationResult result;
     result.filePath = imagePath;
     result.filename = std::filesystem::path(imagePath).filename().string();
-    result.isValid = false;
-    result.width = 0;
-    result.height = 0;
-
-    try {
-        cv::Mat image = cv::imread(imagePath);
-        if (!image.empty()) {
-            result.isValid = true;
-            result.width = image.cols;
-            result.height = image.rows;
-        }
-    }
-    catch (const cv::Exception& e) {
-        // OpenCV exception - image is corrupted
-        result.isValid = false;
-    }
-    catch (...) {
-        // Any other exception
-        result.isValid = false;
-    }
+    result.isValid = isValid;
+    result.width = width;
+    result.height = height;
+    result.level = level;
 
     if (!result.isValid) { corruptedCount++; }
 
     return result;
 }
 
-void processImages(std::vector<std::string>& images)
+// hash = also compute the perceptual hash from the decoded pixels (--dedupe)
+ValidationResult validateDecoded(const std::string& imagePath, const cv::Mat& image, int level, bool hash)
 {
-    auto startTime = std::chrono::high_resolution_clock::now();
-
-    int numThreads = std::thread::hardware_concurrency();
-    if (numThreads == 0) numThreads = 4; // Fallback in case detection fails
-
-    std::cout << "Using " << numThreads << " threads for processing." << std::endl;
-
-    size_t totalImages = images.size();
-    size_t chunkSize = (totalImages + numThreads - 1) / numThreads;
-    std::atomic<int> processedImages{0};
-
-    std::vector<std::thread> threads;
-    threads.reserve(numThreads);
-    std::atomic<bool> running = true;
-
-    std::thread printThread([&running, &processedImages, &totalImages]() {
-        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-        std::chrono::steady_clock::time_point prev_time = start_time;
-        size_t prev_processed = 0;
-
-        // Moving average for i/s calculation
-        std::vector<double> speed_samples;
-        const size_t max_samples = 10; // Average over last 10 samples
-        float top_speed = 0.0f;
-
-        while (running) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(300));
-            {
-                size_t current = processedImages;
-                size_t corrupted = corruptedCount;
-                auto now = std::chrono::steady_clock::now();
-                std::chrono::duration<double> elapsed_time = now - start_time;
-                std::chrono::duration<double> time_delta = now - prev_time;
-
-                // Calculate instantaneous speed
-                double instant_speed = 0.0;
-                if (time_delta.count() > 0) {
-                    instant_speed = (current - prev_processed) / time_delta.count();
-                }
-
-                // Add to moving average (only if we processed some)
-                if (current > prev_processed) {
-                    speed_samples.push_back(instant_speed);
-                    if (speed_samples.size() > max_samples) {
-                        speed_samples.erase(speed_samples.begin());
-                    }
-                }
-
-                // Calculate averaged speed
-                double avg_speed = 0.0;
-                if (!speed_samples.empty()) {
-                    double sum = 0.0;
-                    for (double speed : speed_samples) {
-                        sum += speed;
-                    }
-                    avg_speed = sum / speed_samples.size();
-                }
+    ProfileScope profile(Stage::VALIDATE);
+    int width = image.cols, height = image.rows;
+    if (level == VALIDATION_REDUCED && !image.empty()) {
+        readImageSize(imagePath, width, height); // decoded size is scaled down
+    }
+    ValidationResult result = makeValidationResult(imagePath, !image.empty(), width, height, level);
+    if (hash && !image.empty()) {
+        result.dhash = dHash(image);
+        result.hashed = true;
+    }
+    return result;
+}
 
-                prev_time = now;
-                prev_processed = current;
+ValidationResult validateImage(const std::string& imagePath, int level, bool hash)
+{
+    ProfileScope profile(Stage::VALIDATE);
+    int width = 0, height = 0;
+    cv::Mat pixels;
+    bool valid = validateImageFile(imagePath, level, width, height, hash ? &pixels : nullptr);
+    ValidationResult result = makeValidationResult(imagePath, valid, width, height, level);
+    if (hash && !pixels.empty()) {
+        result.dhash = dHash(pixels);
+        result.hashed = true;
+    }
+    return result;
+}
 
-                float p = static_cast<float>(current) / static_cast<float>(totalImages);
+// With streamRoot set images is ignored, the folder is scanned and every image validated as soon as it's found
+void processImages(std::vector<std::string>& images, int level, FeatureCache* cache, int requestedThreads,
+                   const PipelineConfig* pipeline, const std::string* streamRoot, bool dedupe)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
 
-                // Calculate ETA
-                std::string eta_str = "";
-                if (avg_speed > 0 && current < totalImages) {
-                    double remaining_time = (totalImages - current) / avg_speed;
-                    int eta_minutes = static_cast<int>(remaining_time / 60);
-                    int eta_seconds = static_cast<int>(remaining_time) % 60;
-                    eta_str = " ETA: " + std::to_string(eta_minutes) + "m " + std::to_string(eta_seconds) + "s";
-                }
+    int numThreads = resolveThreadCount(requestedThreads);
+    if (level == VALIDATION_HEADER) pipeline = nullptr; // header checks have no decode stage to overlap
 
-                if (avg_speed > top_speed) top_speed = avg_speed;
+    if (pipeline) {
+        std::cout << "Using pipeline with " << pipeline->readers << " readers, " << resolveThreadCount(pipeline->decoders)
+                  << " decoders and " << resolveThreadCount(pipeline->analyzers) << " analyzers." << std::endl;
+    }
+    else {
+        std::cout << "Using " << numThreads << " threads for processing." << std::endl;
+    }
 
-                Cursor::cr();
-                std::cout << "==: " << current << "/" << totalImages << " (bad: " << corrupted << ") "
-                          << std::fixed << std::setprecision(1)
-                          << p * 100 << "% (avg: " << std::setprecision(1) << avg_speed << " i/s)" << " (top: " << top_speed << " i/s)"
-                          << eta_str << "               ";
-                std::cout.flush();
+    Progress progress("validator");
+    progress.total = streamRoot ? 0 : images.size(); // streaming: grows as the scan finds images
+    std::atomic<size_t>& totalImages = progress.total;
+    std::atomic<size_t>& processedImages = progress.done;
+    progress.addCounter("corrupt", []() { return (size_t)corruptedCount; });
+    progress.start();
+
+    std::vector<FeatureRecord> records(images.size());
+
+    auto storeResult = [&processedImages, cache](const std::string& path, FeatureRecord& record, const ValidationResult& result, bool fromCache) {
+        if (cache && !fromCache) {
+            record.valid = result.isValid ? 1 : 0;
+            record.validLevel = result.level;
+            record.width = result.width;
+            record.height = result.height;
+            if (result.hashed) {
+                record.dhash = result.dhash;
+                record.hasDhash = true;
             }
+            cache->store(path, record);
         }
-        std::cout << std::endl;
-    });
-
-    auto processImageThread = [&processedImages, &images](size_t start, size_t end, int threadId) {
-        UNUSED(threadId);
-        for (size_t i = start; i < end; ++i) {
-            ValidationResult result = validateImage(images[i]);
-            {
-                std::lock_guard<std::mutex> lock(resultsMutex);
-                results.push_back(result);
-            }
-            ++processedImages;
+        {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            results.push_back(result);
         }
+        ++processedImages;
     };
 
-    for (int t = 0; t < numThreads; ++t) {
-        size_t start = t * chunkSize;
-        size_t end = std::min(start + chunkSize, totalImages);
-        if (start >= totalImages) break;
-        threads.emplace_back(processImageThread, start, end, t);
-    }
+    // true if the verdict came from the feature cache and the image needs no decoding
+    auto validateFromCache = [&storeResult, level, cache, dedupe](const std::string& path, FeatureRecord& record) {
+        if (!cache || !cache->lookup(path, record)) return false;
+        if (record.valid < 0 || record.validLevel < level) return false; // not checked this thoroughly yet
+        if (dedupe && record.valid == 1 && !record.hasDhash) return false; // validated before --dedupe was used
+
+        ValidationResult result = makeValidationResult(path, record.valid == 1, record.width, record.height, record.validLevel);
+        result.hashed = record.hasDhash;
+        result.dhash = record.dhash;
+        storeResult(path, record, result, true);
+        return true;
+    };
 
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
+    if (streamRoot) {
+        scanAndProcess(*streamRoot, numThreads, [&](const std::string& path, int) {
+            FeatureRecord record;
+            if (validateFromCache(path, record)) return;
+            storeResult(path, record, validateImage(path, level, dedupe), false);
+        }, &totalImages);
+    }
+    else if (pipeline) {
+        PipelineStages stages;
+        stages.wantsDecode = [&](size_t i, int) { return !validateFromCache(images[i], records[i]); };
+        stages.analyze = [&images, &records, &storeResult, level, dedupe](size_t i, cv::Mat& image, int) {
+            storeResult(images[i], records[i], validateDecoded(images[i], image, level, dedupe), false);
+        };
+        runImagePipeline(images, *pipeline, decodeOptionsForLevel(level), stages);
+    }
+    else {
+        parallelFor(images.size(), numThreads, [&](size_t i, int) {
+            if (validateFromCache(images[i], records[i])) return;
+            storeResult(images[i], records[i], validateImage(images[i], level, dedupe), false);
+        });
     }
 
-    // stop print thread
-    running = false;
-    printThread.join();
+    progress.stop();
 
     auto endTime = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
 
     std::cout << "\nCompleted in " << duration.count() << "ms" << std::endl;
     std::cout << "Average: " << std::fixed << std::setprecision(2)
-              << (double)duration.count() / images.size() << "ms per image" << std::endl;
+              << (double)duration.count() / std::max<size_t>(totalImages, 1) << "ms per image" << std::endl;
     std::cout << "Total files processed: " << results.size() << std::endl;
     std::cout << "Valid images: " << (results.size() - corruptedCount) << std::endl;
     std::cout << "Corrupted/unreadable images: " << corruptedCount << std::endl;
@@ -239,34 +227,28 @@ void deleteCorruptedFiles()
     }
 }
 
-void moveCorruptedFiles(const std::string& quarantineFolder = "corrupted_images")
+// Moves files into folder, renaming on name clashes. what = how to call them in the messages
+void moveFilesToFolder(const std::vector<std::string>& files, const std::string& folder, const std::string& what)
 {
-    std::vector<std::string> corruptedFiles;
-    for (const auto& result : results) {
-        if (!result.isValid) {
-            corruptedFiles.push_back(result.filePath);
-        }
-    }
-
-    if (corruptedFiles.empty()) {
-        std::cout << "No corrupted files to move." << std::endl;
+    if (files.empty()) {
+        std::cout << "No " << what << " files to move." << std::endl;
         return;
     }
 
     try {
-        std::filesystem::create_directories(quarantineFolder);
+        std::filesystem::create_directories(folder);
 
         int movedCount = 0;
-        for (const auto& file : corruptedFiles) {
+        for (const auto& file : files) {
             std::filesystem::path sourcePath(file);
-            std::filesystem::path destPath = std::filesystem::path(quarantineFolder) / sourcePath.filename();
+            std::filesystem::path destPath = std::filesystem::path(folder) / sourcePath.filename();
 
             // Handle filename conflicts
             int counter = 1;
             while (fs_exists(destPath)) {
                 std::string stem = sourcePath.stem().string();
                 std::string extension = sourcePath.extension().string();
-                destPath = std::filesystem::path(quarantineFolder) / (stem + "_" + std::to_string(counter) + extension);
+                destPath = std::filesystem::path(folder) / (stem + "_" + std::to_string(counter) + extension);
                 counter++;
             }
 
@@ -279,13 +261,75 @@ void moveCorruptedFiles(const std::string& quarantineFolder = "corrupted_images"
                 std::cout << "Error moving " << file << ": " << ex.what() << std::endl;
             }
         }
-        std::cout << "\nMoved " << movedCount << " corrupted files to '" << quarantineFolder << "' folder." << std::endl;
+        std::cout << "\nMoved " << movedCount << " " << what << " files to '" << folder << "' folder." << std::endl;
     }
     catch (const std::filesystem::filesystem_error& ex) {
         std::cout << "Error creating quarantine folder: " << ex.what() << std::endl;
     }
 }
 
+void moveCorruptedFiles(const std::string& quarantineFolder = "corrupted_images")
+{
+    std::vector<std::string> corruptedFiles;
+    for (const auto& result : results) {
+        if (!result.isValid) {
+            corruptedFiles.push_back(result.filePath);
+        }
+    }
+    moveFilesToFolder(corruptedFiles, quarantineFolder, "corrupted");
+}
+
+// --dedupe: prints clusters of near-identical images, the copy to keep first (most pixels, then biggest file).
+// Returns the other copies.
+std::vector<std::string> reportDuplicates(int maxDistance)
+{
+    std::vector<const ValidationResult*> hashed;
+    for (const auto& result : results) {
+        if (result.isValid && result.hashed) hashed.push_back(&result);
+    }
+    std::sort(hashed.begin(), hashed.end(), [](const auto* a, const auto* b) { return a->filePath < b->filePath; });
+
+    std::vector<uint64_t> hashes(hashed.size());
+    for (size_t i = 0; i < hashed.size(); i++) hashes[i] = hashed[i]->dhash;
+
+    // file sizes break ties, only stat'ed for images that have a near hash
+    std::vector<intmax_t> sizes(hashed.size(), -1);
+    auto fileSize = [&](uint32_t i) {
+        if (sizes[i] < 0) {
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(hashed[i]->filePath, ec);
+            sizes[i] = ec ? 0 : (intmax_t)size;
+        }
+        return sizes[i];
+    };
+    auto better = [&](uint32_t a, uint32_t b) {
+        int64_t pixelsA = (int64_t)hashed[a]->width * hashed[a]->height, pixelsB = (int64_t)hashed[b]->width * hashed[b]->height;
+        if (pixelsA != pixelsB) return pixelsA > pixelsB;
+        return fileSize(a) > fileSize(b);
+    };
+    auto clusters = findDuplicateClusters(hashes, maxDistance, better);
+
+    std::vector<std::string> extras;
+    if (clusters.empty()) {
+        std::cout << "\nNo duplicates found in " << hashed.size() << " images." << std::endl;
+        return extras;
+    }
+
+    std::cout << "\nDuplicates (max distance " << maxDistance << "):" << std::endl;
+    for (const auto& cluster : clusters) {
+        std::cout << std::endl;
+        for (size_t i = 0; i < cluster.size(); i++) {
+            const auto* result = hashed[cluster[i]];
+            std::cout << (i == 0 ? "  keep " : "       ") << result->width << "x" << result->height << " "
+                      << result->filePath << std::endl;
+            if (i > 0) extras.push_back(result->filePath);
+        }
+    }
+    std::cout << "\n"
+              << clusters.size() << " groups of duplicates, " << extras.size() << " extra copies." << std::endl;
+    return extras;
+}
+
 int main(int argc, char* argv[])
 {
     freopen("/dev/null", "w", stderr); // suppress errors
@@ -311,6 +355,76 @@ int main(int argc, char* argv[])
         .implicit_value(true)
         .help("prompt what to do after scanning (nothing/delete/move)");
 
+    program.add_argument("-l", "--level")
+        .default_value(2)
+        .metavar("0/1/2")
+        .scan<'i', int>()
+        .help("how thoroughly to check (0 = headers and container structure only, 1 = reduced resolution decode, 2 = full decode)");
+
+    program.add_argument("--dedupe")
+        .default_value(false)
+        .implicit_value(true)
+        .help("also find near-duplicates (same image at another resolution, re-encoded) from a perceptual hash of the decoded pixels");
+
+    program.add_argument("--dedupe-distance")
+        .default_value(4)
+        .metavar("bits")
+        .scan<'i', int>()
+        .help("with --dedupe, how many of the 64 hash bits two images may differ in and still count as duplicates");
+
+    program.add_argument("--move-duplicates")
+        .default_value(false)
+        .implicit_value(true)
+        .help("with --dedupe, move every copy but the largest to duplicate_images folder");
+
+    program.add_argument("-t", "--threads")
+        .default_value(0)
+        .metavar("N")
+        .scan<'i', int>()
+        .help("number of worker threads (0 = one per core)");
+
+    program.add_argument("--max-mem")
+        .metavar("size")
+        .help("cap the memory decoded images may take together, decodes wait for room (sizes come from the file headers)");
+
+    program.add_argument("--nice")
+        .default_value(false)
+        .implicit_value(true)
+        .help("run in the background: lowest CPU and I/O priority, new decodes pause while the rest of the system keeps every core busy");
+
+    program.add_argument("-P", "--pipeline")
+        .metavar("readers:decoders:analyzers[:queue]")
+        .help("overlap disk reads, decoding and analysis with separate thread pools (0 = one per core)");
+
+    program.add_argument("--profile")
+        .default_value(false)
+        .implicit_value(true)
+        .help("print how long every stage took and write a Chrome trace (chrome://tracing) to validator-trace.json");
+
+    program.add_argument("--progress")
+        .default_value(std::string("auto"))
+        .metavar("mode")
+        .help("how progress is shown: tty (redrawn in place), plain (a line every 10s), json (a JSON object per second) or none, auto = tty on a terminal, plain otherwise");
+
+    program.add_argument("--metrics")
+        .metavar("file.prom")
+        .help("also write progress as a Prometheus textfile (node_exporter textfile collector), replaced every 5s");
+
+    program.add_argument("--io")
+        .default_value(std::string("imread"))
+        .metavar("backend")
+        .help("how image files are read: imread, read, mmap (decode from the page cache) or uring (batched io_uring reads, needs --pipeline and --level 1 or 2)");
+
+    program.add_argument("--cache")
+        .default_value(FeatureCache::defaultPath())
+        .metavar("features.db")
+        .help("feature cache shared by all wpu tools (only changed images get decoded)");
+
+    program.add_argument("--no-cache")
+        .default_value(false)
+        .implicit_value(true)
+        .help("don't read or write the feature cache");
+
     try {
         program.parse_args(argc, argv);
     }
@@ -326,16 +440,116 @@ int main(int argc, char* argv[])
     else if (program.get<bool>("move"))   { choice = 2; }
 
 
+    int level = program.get<int>("level");
+    if (level < VALIDATION_HEADER || level > VALIDATION_FULL) {
+        std::cout << "Invalid --level: " << level << std::endl;
+        return 1;
+    }
+
+    bool dedupe = program.get<bool>("dedupe");
+    int dedupeDistance = program.get<int>("dedupe-distance");
+    if (dedupe && level == VALIDATION_HEADER) {
+        std::cout << "--dedupe hashes the decoded pixels, use --level 1 or 2" << std::endl;
+        return 1;
+    }
+    if (dedupeDistance < 0 || dedupeDistance > 64) {
+        std::cout << "Invalid --dedupe-distance: " << dedupeDistance << std::endl;
+        return 1;
+    }
+    if (program.get<bool>("move-duplicates") && !dedupe) {
+        std::cout << "--move-duplicates needs --dedupe" << std::endl;
+        return 1;
+    }
+
+    PipelineConfig pipeline;
+    bool usePipeline = false;
+    if (auto spec = program.present("pipeline")) {
+        if (!parsePipelineSpec(*spec, pipeline)) {
+            std::cout << "Invalid --pipeline spec: " << *spec << std::endl;
+            return 1;
+        }
+        usePipeline = true;
+    }
+
+    IoBackend io;
+    if (!parseIoBackend(program.get<std::string>("io"), io)) {
+        std::cout << "Invalid --io: " << program.get<std::string>("io") << std::endl;
+        return 1;
+    }
+    if (io == IoBackend::URING && (!usePipeline || level == VALIDATION_HEADER)) {
+        // the batched reads are a pipeline reader stage, header checks have none
+        std::cout << "--io uring needs --pipeline and --level 1 or 2" << std::endl;
+        return 1;
+    }
+    setIoBackend(io);
+
+    ProgressSettings progressSettings;
+    if (!parseProgressMode(program.get<std::string>("progress"), progressSettings.mode)) {
+        std::cout << "Invalid --progress: " << program.get<std::string>("progress") << std::endl;
+        return 1;
+    }
+    progressSettings.metricsPath = program.present("metrics").value_or("");
+    setProgressSettings(progressSettings);
+
+    DecodeLimits limits;
+    if (auto maxMem = program.present("max-mem")) {
+        if (!parseByteSize(*maxMem, limits.maxBytes) || limits.maxBytes == 0) {
+            std::cout << "Invalid --max-mem: " << *maxMem << std::endl;
+            return 1;
+        }
+    }
+    if (program.get<bool>("nice")) {
+        limits.yieldUnderLoad = true;
+        if (!enterIdlePriority()) std::cout << "Could not lower every priority, --nice is only partly in effect" << std::endl;
+    }
+    setDecodeLimits(limits);
+
+    bool profile = program.get<bool>("profile");
+    if (profile) Profile::enable();
+
     std::string inputPath = program.get<std::string>("input");
     std::vector<std::string> images;
-    getImages(images, inputPath);
-    if (images.empty()) {
+
+    // folders are validated while they're being scanned, the pipeline needs the full list up front
+    std::string streamRoot;
+    if (!usePipeline && std::filesystem::is_directory(inputPath)) {
+        streamRoot = std::filesystem::canonical(inputPath).string();
+        std::cout << "Scanning and validating folder: " << streamRoot << std::endl;
+    }
+    else {
+        ProfileScope scan(Stage::SCAN);
+        getImages(images, inputPath);
+        if (images.empty()) {
+            std::cout << "No valid images found." << std::endl;
+            return 1;
+        }
+        results.reserve(images.size());
+    }
+
+    FeatureCache cache(program.get<std::string>("cache"));
+    bool useCache = !program.get<bool>("no-cache");
+    if (useCache && cache.load()) {
+        std::cout << "Loaded " << cache.size() << " cached entries from " << cache.filePath() << std::endl;
+    }
+
+    processImages(images, level, useCache ? &cache : nullptr, program.get<int>("threads"), usePipeline ? &pipeline : nullptr,
+                  streamRoot.empty() ? nullptr : &streamRoot, dedupe);
+    if (results.empty()) {
         std::cout << "No valid images found." << std::endl;
         return 1;
     }
-    results.reserve(images.size());
 
-    processImages(images);
+    if (useCache && !cache.save()) {
+        std::cout << "Could not save feature cache to " << cache.filePath() << std::endl;
+    }
+
+    if (profile) {
+        Profile::report(std::cout);
+        if (Profile::writeTrace("validator-trace.json")) std::cout << "\nTrace written to validator-trace.json" << std::endl;
+    }
+
+    std::vector<std::string> duplicates;
+    if (dedupe) duplicates = reportDuplicates(dedupeDistance);
 
     if (program.get<bool>("prompt")) {
         std::cout << "\nWhat would you like to do with corrupted files?" << std::endl;
@@ -361,5 +575,9 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (program.get<bool>("move-duplicates") && !duplicates.empty()) {
+        moveFilesToFolder(duplicates, "duplicate_images", "duplicate");
+    }
+
     return 0;
 }
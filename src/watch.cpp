@@ -0,0 +1,179 @@
+#include "watch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "utils.hpp"
+
+// IN_CLOSE_WRITE instead of IN_CREATE/IN_MODIFY: a file is only picked up once whoever wrote it is done
+constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR;
+
+TreeWatcher::TreeWatcher(const std::string& root)
+{
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cout << "Error: inotify_init1 failed: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    std::string dir = root;
+    while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+    addTree(dir, false);
+    if (dirs.empty()) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+TreeWatcher::~TreeWatcher()
+{
+    if (fd >= 0) close(fd);
+}
+
+void TreeWatcher::addTree(const std::string& dir, bool reportImages)
+{
+    int wd = inotify_add_watch(fd, dir.c_str(), WATCH_EVENTS);
+    if (wd < 0) {
+        if (errno == ENOSPC) std::cout << "Error: out of inotify watches (raise fs.inotify.max_user_watches)" << std::endl;
+        return;
+    }
+    dirs[wd] = dir;
+
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) return;
+    while (dirent* entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+
+        std::string path = dir + "/" + name;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        // symlinked folders aren't followed, same as the scan
+        if (type == DT_DIR) addTree(path, reportImages);
+        else if (reportImages && type == DT_REG && isSupportedFormat(name)) changed.insert(path);
+    }
+    closedir(handle);
+}
+
+void TreeWatcher::handleEvents(const char* buffer, size_t length)
+{
+    for (size_t pos = 0; pos < length;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + pos);
+        pos += sizeof(inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            overflowed = true;
+            continue;
+        }
+
+        auto it = dirs.find(event->wd);
+        if (it == dirs.end()) continue;
+        if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+            dirs.erase(it);
+            continue;
+        }
+        if (event->len == 0) continue;
+
+        std::string name = event->name;
+        std::string path = it->second + "/" + name;
+
+        if (event->mask & IN_ISDIR) {
+            // a folder that was created or moved in may already hold images by the time it's watched
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) addTree(path, true);
+            else if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+                // its watches go away by themselves (IN_IGNORED), the ones of a moved folder get dropped here
+                for (auto d = dirs.begin(); d != dirs.end();) {
+                    if (d->second == path || d->second.rfind(path + "/", 0) == 0) {
+                        inotify_rm_watch(fd, d->first);
+                        d = dirs.erase(d);
+                    }
+                    else ++d;
+                }
+                removed.insert(path + "/");
+            }
+            continue;
+        }
+
+        if (!isSupportedFormat(name)) continue;
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            removed.erase(path);
+            changed.insert(path);
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            changed.erase(path);
+            removed.insert(path);
+        }
+    }
+}
+
+bool TreeWatcher::wait(WatchBatch& batch, int debounceMs)
+{
+    batch = WatchBatch();
+    if (fd < 0) return false;
+    // the root is gone and its removal was reported by the last call, nothing can come in any more
+    if (dirs.empty() && changed.empty() && removed.empty() && !overflowed) return false;
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point first, last;
+    bool pending = !changed.empty() || !removed.empty() || overflowed;
+    if (pending) first = last = Clock::now();
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    while (true) {
+        int timeout = -1;
+        if (pending) {
+            auto now = Clock::now();
+            auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(last + std::chrono::milliseconds(debounceMs) - now).count();
+            auto limit = std::chrono::duration_cast<std::chrono::milliseconds>(first + std::chrono::milliseconds(WATCH_MAX_DELAY_MS) - now).count();
+            timeout = (int)std::max<long long>(0, std::min<long long>(quiet, limit));
+            if (timeout == 0) break;
+        }
+
+        pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (ready == 0) continue; // the timeout is checked at the top
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            return false;
+        }
+        handleEvents(buffer, n);
+
+        bool nowPending = !changed.empty() || !removed.empty() || overflowed;
+        if (nowPending) {
+            last = Clock::now();
+            if (!pending) first = last;
+        }
+        pending = nowPending;
+        if (dirs.empty()) break; // the root itself is gone
+    }
+
+    batch.changed.assign(changed.begin(), changed.end());
+    batch.removed.assign(removed.begin(), removed.end());
+    std::sort(batch.changed.begin(), batch.changed.end());
+    batch.rescan = overflowed;
+    changed.clear();
+    removed.clear();
+    overflowed = false;
+    return !dirs.empty() || !batch.removed.empty() || !batch.changed.empty();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// --watch: inotify over a whole tree. Folders that appear later are watched as they show up,
+// bursts of events (a big download, an unpacked archive) are debounced into one batch.
+struct WatchBatch {
+    std::vector<std::string> changed; // images that were written or moved in
+    std::vector<std::string> removed; // images that were deleted or moved out, folders end with '/'
+    bool rescan = false;              // the kernel dropped events, only a full scan is reliable now
+};
+
+class TreeWatcher {
+  public:
+    explicit TreeWatcher(const std::string& root);
+    ~TreeWatcher();
+
+    TreeWatcher(const TreeWatcher&) = delete;
+    TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+    bool ok() const { return fd >= 0; }
+
+    // Blocks until something changed and then nothing for debounceMs (at most WATCH_MAX_DELAY_MS after the first event).
+    // false if the watch itself failed or the root is gone (after the batch that reports its removal).
+    bool wait(WatchBatch& batch, int debounceMs);
+
+  private:
+    void addTree(const std::string& dir, bool reportImages); // reportImages = images already inside count as changed
+    void handleEvents(const char* buffer, size_t length);
+
+    int fd = -1;
+    std::unordered_map<int, std::string> dirs; // watch descriptor -> folder
+    std::unordered_set<std::string> changed;
+    std::unordered_set<std::string> removed;
+    bool overflowed = false;
+};
+
+// a download that keeps writing shouldn't hold a batch back forever
+constexpr int WATCH_MAX_DELAY_MS = 30000;
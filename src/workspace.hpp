@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "imageio.hpp"
+
+// Scratch memory one thread reuses for image after image: the decode target, the shrunk copy, the float
+// samples for k-means, labels, centers, the gray copy, histograms. Every buffer only grows, so once the
+// biggest image went through a thread no longer allocates pixels, instead of an mmap/munmap (and the page
+// faults after it) for every multi-MB Mat.
+// Mats handed out by view() point into these buffers and are only valid until the thread's next image.
+struct ImageWorkspace {
+    FileBuffer file; // --io read keeps its capacity
+    cv::Mat decoded;
+    cv::Mat shrunk;    // grouper's 800x600 copy
+    cv::Mat thumbnail; // kmeans-opt and palette downsample
+    cv::Mat gray;
+    cv::Mat hsv;     // --backend opencl histogram input
+    cv::Mat samples; // pixels as float rows for cv::kmeans
+    cv::Mat labels;
+    cv::Mat centers;
+
+    // extractDominantColorsFast and the histogram
+    std::vector<float> b, g, r, nearest, fastCenters;
+    std::vector<int> fastLabels, counts;
+    std::vector<double> sums;
+    std::vector<uint32_t> histogram;
+    std::vector<int> peaks;
+
+    // rows x cols of type, backed by buffer (which is grown if it's too small)
+    static cv::Mat view(cv::Mat& buffer, int rows, int cols, int type)
+    {
+        size_t bytes = (size_t)rows * cols * CV_ELEM_SIZE(type);
+        if (buffer.empty() || buffer.total() * buffer.elemSize() < bytes) {
+            buffer.create(1, (int)std::max<size_t>(bytes, 1), CV_8UC1);
+        }
+        return cv::Mat(rows, cols, type, (void*)buffer.data);
+    }
+
+    // The calling thread's workspace, worker threads live for the whole run so this is where the reuse comes from
+    static ImageWorkspace& forThisThread()
+    {
+        thread_local ImageWorkspace workspace;
+        return workspace;
+    }
+};
+
+// What cv::resize(src, dst, cv::Size(), scale, scale) makes, so dst can be a view of that size
+inline cv::Size scaledSize(const cv::Mat& src, double scale)
+{
+    return cv::Size(cvRound(src.cols * scale), cvRound(src.rows * scale));
+}
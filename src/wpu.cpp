@@ -0,0 +1,67 @@
+#include <argparse/argparse.hpp>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "control.hpp"
+#include "globals.hpp"
+
+int main(int argc, char* argv[])
+{
+    argparse::ArgumentParser program("wpu", VERSION);
+    program.add_description(R"(talk to a running wpu-darkscore-select -l/-d over its control socket
+
+    requests:
+        next            change the wallpaper now, prints the new one
+        score <file>    darkness score and bucket of a file (from the index, decoded if it isn't in there)
+        reload          reload the input file (like SIGRTMIN+11)
+        status          current and next wallpaper, time until the next change
+        stats           uptime, changes, reloads and bucket sizes)");
+
+    program.add_argument("request")
+        .help("next, score, reload, status or stats");
+
+    program.add_argument("file")
+        .help("image for score")
+        .nargs(argparse::nargs_pattern::optional);
+
+    program.add_argument("--socket")
+        .help("control socket of the daemon [default: $XDG_RUNTIME_DIR/wpu.sock]")
+        .metavar("path");
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << program;
+        return 1;
+    }
+
+    std::string request = program.get<std::string>("request");
+    if (request == "score") {
+        auto file = program.present("file");
+        if (!file) {
+            std::cout << "score needs a file" << std::endl;
+            return 1;
+        }
+        // the index holds canonical paths (wpu-darkscore canonicalizes the folder it scans), symlinks resolved
+        std::error_code ec;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(*file, ec);
+        request += " " + (ec ? *file : canonical.string());
+    }
+    else if (program.present("file")) {
+        std::cout << "Invalid request: " << request << " takes no file" << std::endl;
+        return 1;
+    }
+
+    std::string reply;
+    bool ok = controlRequest(program.present("socket").value_or(defaultControlSocket()), request, reply);
+    if (!ok) {
+        std::cout << "Error: " << reply << std::endl;
+        return 1;
+    }
+    std::cout << reply;
+    if (!reply.empty() && reply.back() != '\n') std::cout << std::endl;
+    return 0;
+}